@@ -48,156 +48,465 @@ OpenGL 4 Shading language Cookbook
 */
 
 #include "GLIncludes.h"
+#include "FrameRing.h"
+#include "VertexPacking.h"
+#include "ShadowFilter.h"
+#include "ProgramCache.h"
 
 GLuint renderProgram;		//This program contains the shader which are used to render the final image and do the final calculations
 
 // Global data members
 #pragma region Base_data
 // This is your reference to your shader program.
-// This will be assigned with glCreateProgram().
+// This will be assigned with a program from the program cache.
 // This program will run on your GPU.
 GLuint program;
 
-// These are your references to your actual compiled shaders
-GLuint vertex_shader;
-GLuint fragment_shader;
-
-// This is a reference to your uniform MVP matrix in your vertex shader
-GLuint uniMVP;
-
 // Reference to the window object being created by GLFW.
 GLFWwindow* window;
 #pragma endregion Base_data								  
 
 //This struct consists of the basic stuff needed for getting the shape on the screen.
+//The vertices and indices themselves live in the mesh registry's shared buffers (see MeshRegistry below),
+//so all that is kept here is where they are and what is needed to read them back.
 struct stuff_for_drawing{
 
-	GLuint vao;
+	//Where the mesh's vertices start in the shared vertex buffers. It is added to every index of the mesh.
+	int baseVertex;
 
-	//This stores the address the buffer/memory in the GPU. It acts as a handle to access the buffer memory in GPU.
-	GLuint vbo;
+	//Where the mesh's indices start in the shared index buffer.
+	int firstIndex;
 
 	//This will be used to tell the GPU, how many vertices will be needed to draw during drawcall.
 	int numberOfVertices;
 
-	//This function gets the number of vertices and all the vertex values and stores them in the buffer.
-	void initBuffer(int numVertices, VertexFormat* vertices)
+	//The number of indices to draw. Meshes which were given without indices get the trivial ones, 0 to numberOfVertices - 1.
+	int numberOfIndices;
+
+	//How the vertices are stored in the vertex buffer. See VertexPacking.h.
+	VertexLayout layout;
+
+	//Takes the stored positions back to model space. It has to be applied before the model matrix.
+	glm::mat4 dequantize;
+
+	//The color of the whole mesh, if the layout doesn't store one per vertex. White otherwise.
+	//It goes into every object's color, since the draws of all the meshes are submitted together.
+	glm::vec4 materialColor;
+
+	//A sphere around all the vertices in model space. xyz is the center, w the radius.
+	glm::vec4 boundingSphere;
+
+	//The box around all the vertices in model space.
+	BoundingBox boundingBox;
+
+	//This function converts the vertices to the given layout, and appends them and the indices to the shared data.
+	//The interleaved vertices go into vertexData, the positions alone into positionData (for the depth pass).
+	void initBuffer(int numVertices, VertexFormat* vertices, int numIndices, GLuint* indices, const VertexLayout &iLayout,
+		std::vector<unsigned char> &vertexData, std::vector<unsigned char> &positionData, std::vector<GLuint> &indexData)
 	{
 		numberOfVertices = numVertices;
+		layout = iLayout;
+
+		PackedVertices packed;
+		packVertices(layout, numVertices, vertices, packed);
+		dequantize = packed.dequantize;
+		materialColor = (layout.color == COLOR_MATERIAL) ? packed.materialColor : glm::vec4(1.0f);
+
+		// The center of the box around the vertices, and the distance to the vertex furthest from it.
+		glm::vec3 boxMin(vertices[0].position), boxMax(vertices[0].position);
+		for (int i = 1; i < numVertices; i++)
+		{
+			boxMin = glm::min(boxMin, vertices[i].position);
+			boxMax = glm::max(boxMax, vertices[i].position);
+		}
+		float radius = 0.0f;
+		for (int i = 0; i < numVertices; i++)
+			radius = std::max(radius, glm::length(vertices[i].position - (boxMin + boxMax) * 0.5f));
+		boundingSphere = glm::vec4((boxMin + boxMax) * 0.5f, radius);
+		boundingBox = BoundingBox(boxMin, boxMax);
+
+		// Both streams have the same vertex order, so one baseVertex works for both.
+		baseVertex = vertexData.size() / layout.stride();
+		vertexData.insert(vertexData.end(), packed.vertices.begin(), packed.vertices.end());
+		positionData.insert(positionData.end(), packed.positions.begin(), packed.positions.end());
+
+		// Welded vertices are shared between triangles, so each one only has to be stored (and transformed) once.
+		firstIndex = indexData.size();
+		if (numIndices > 0)
+		{
+			numberOfIndices = numIndices;
+			indexData.insert(indexData.end(), indices, indices + numIndices);
+		}
+		else
+		{
+			numberOfIndices = numVertices;
+			for (int i = 0; i < numVertices; i++)
+				indexData.push_back(i);
+		}
+	}
+
+	//Returns the command which draws the given number of instances of the mesh.
+	//Instanced attributes start reading at element baseInstance instead of 0.
+	DrawCommand command(int instanceCount, int baseInstance) const
+	{
+		DrawCommand command;
+		command.count = numberOfIndices;
+		command.instanceCount = instanceCount;
+		command.firstIndex = firstIndex;
+		command.baseVertex = baseVertex;
+		command.baseInstance = baseInstance;
+		return command;
+	}
+};
+
+//Which instances to draw. The shadow map caches the static casters and only redraws the dynamic ones on top.
+enum CasterLayer { ALL_CASTERS, STATIC_CASTERS, DYNAMIC_CASTERS };
+
+//A mesh which is stored on the GPU only once, together with the list of places it is drawn at.
+struct Mesh
+{
+	stuff_for_drawing base;
+
+	//If the mesh hides what's behind it, a copy of its triangles on the CPU, for the occlusion culling (see OcclusionCulling.h).
+	std::vector<glm::vec3> occluderPositions;
+	std::vector<GLuint> occluderIndices;
+
+	//Where this mesh's objects start in the frame's object array, filled by Scene::writeObjects. The static ones come first, then the dynamic ones.
+	int firstInstance;
+	int staticCount;
+	int dynamicCount;
+
+	//Returns the mesh's bounding sphere, placed with the given model matrix.
+	//The radius is scaled by the largest scale of the matrix, so the sphere stays around the mesh if it is squashed.
+	glm::vec4 worldBounds(const glm::mat4 &model)
+	{
+		glm::vec3 center = glm::vec3(model * glm::vec4(glm::vec3(base.boundingSphere), 1.0f));
+		float scale = std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+		return glm::vec4(center, base.boundingSphere.w * scale);
+	}
+};
+
+//The mesh registry owns every mesh in the scene. A mesh is registered once under a name, and every object
+//using it (see Scene.h) draws an instance of it instead of uploading its own copy.
+//All the meshes are packed one after the other into the same vertex and index buffers, read by one vao (or
+//depthVao for the depth pass). Since nothing has to be bound between the meshes, a whole pass is submitted
+//as a list of DrawCommands with a single glMultiDrawElementsIndirect, however many meshes and objects it draws.
+struct MeshRegistry
+{
+	std::vector<Mesh> meshes;
+	std::vector<std::string> names;
 
+	//How the vertices of all the meshes are stored. It is the same for every mesh, so they can share the buffers.
+	VertexLayout layout;
+
+	//The shared buffers, and a copy of their contents. Adding a mesh appends to the copy and uploads it again.
+	GLuint vertexBuffer = 0;
+	GLuint positionBuffer;
+	GLuint indexBuffer;
+	std::vector<unsigned char> vertexData;
+	std::vector<unsigned char> positionData;
+	std::vector<GLuint> indexData;
+
+	//vao reads the whole vertices, depthVao only the positions.
+	GLuint vao;
+	GLuint depthVao;
+
+	//Handle to a buffer holding the numbers 0 to MAX_OBJECTS - 1, shared by all meshes as their object id attribute.
+	//The attribute has a divisor of 1, so it advances once per instance instead of once per vertex. It starts at
+	//each command's baseInstance, which gives the shader the index of the object it is drawing.
+	GLuint objectIDs;
+
+	//The commands of the pass being drawn, reused.
+	std::vector<DrawCommand> commands;
+
+	//Draw calls made, the commands they held and the triangles those drew, since the counters were last reset.
+	//Commands the GPU culling wrote are counted as calls and commands, but their triangles are unknown here.
+	int drawCalls = 0;
+	int commandsDrawn = 0;
+	long long trianglesDrawn = 0;
+
+	//Returns the id of the mesh with the given name, or -1 if there is none.
+	int find(const std::string &name)
+	{
+		for (unsigned int i = 0; i < names.size(); i++)
+			if (names[i] == name)
+				return i;
+		return -1;
+	}
+
+	//Creates the shared buffers and the vaos reading them.
+	void initBuffers()
+	{
+		layout = vertexLayout;
+
+		std::vector<GLuint> ids(MAX_OBJECTS);
+		for (int i = 0; i < MAX_OBJECTS; i++)
+			ids[i] = i;
+
+		glGenBuffers(1, &objectIDs);
+		glBindBuffer(GL_ARRAY_BUFFER, objectIDs);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(GLuint) * MAX_OBJECTS, &ids[0], GL_STATIC_DRAW);
+
+		glGenBuffers(1, &vertexBuffer);
+		glGenBuffers(1, &positionBuffer);
+		glGenBuffers(1, &indexBuffer);
 		glGenVertexArrays(1, &vao);
+		glGenVertexArrays(1, &depthVao);
+
+		initVertexVao(vao);
+		setObjectIDPointer(objectIDs);
+
+		// Position only stream for the depth pass, at the same attribute location as above.
+		initDepthVao(depthVao);
+		setObjectIDPointer(objectIDs);
+
+		glBindVertexArray(0);
+	}
 
-		// This generates buffer object names
-		// The first parameter is the number of buffer objects, and the second parameter is a pointer to an array of buffer objects (yes, before this call, vbo was an empty variable)
-		glGenBuffers(1, &vbo);
-
-		glBindVertexArray(vao);
-		//// Binds a named buffer object to the specified buffer binding point. Give it a target (GL_ARRAY_BUFFER) to determine where to bind the buffer.
-		//// There are several different target parameters, GL_ARRAY_BUFFER is for vertex attributes, feel free to Google the others to find out what else there is.
-		//// The second paramter is the buffer object reference. If no buffer object with the given name exists, it will create one.
-		//// Buffer object names are unsigned integers (like vbo). Zero is a reserved value, and there is no default buffer for each target (targets, like GL_ARRAY_BUFFER).
-		//// Passing in zero as the buffer name (second parameter) will result in unbinding any buffer bound to that target, and frees up the memory.
-		glBindBuffer(GL_ARRAY_BUFFER, vbo);
-
-		//// Creates and initializes a buffer object's data.
-		//// First parameter is the target, second parameter is the size of the buffer, third parameter is a pointer to the data that will copied into the buffer, and fourth parameter is the 
-		//// expected usage pattern of the data. Possible usage patterns: GL_STREAM_DRAW, GL_STREAM_READ, GL_STREAM_COPY, GL_STATIC_DRAW, GL_STATIC_READ, GL_STATIC_COPY, GL_DYNAMIC_DRAW, 
-		//// GL_DYNAMIC_READ, or GL_DYNAMIC_COPY
-		//// Stream means that the data will be modified once, and used only a few times at most. Static means that the data will be modified once, and used a lot. Dynamic means that the data 
-		//// will be modified repeatedly, and used a lot. Draw means that the data is modified by the application, and used as a source for GL drawing. Read means the data is modified by 
-		//// reading data from GL, and used to return that data when queried by the application. Copy means that the data is modified by reading from the GL, and used as a source for drawing.
-		glBufferData(GL_ARRAY_BUFFER, sizeof(VertexFormat) * numVertices, vertices, GL_STATIC_DRAW);
+	//Binds the given vao and makes it read the whole shared vertices and the indices, like vao does.
+	//Only the object id attribute is left for the caller to set.
+	void initVertexVao(GLuint vertexArray)
+	{
+		glBindVertexArray(vertexArray);
+		glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
 
 		//// By default, all client-side capabilities are disabled, including all generic vertex attribute arrays.
 		//// When enabled, the values in a generic vertex attribute array will be accessed and used for rendering when calls are made to vertex array commands (like glDrawArrays/glDrawElements)
 		//// A GL_INVALID_VALUE will be generated if the index parameter is greater than or equal to GL_MAX_VERTEX_ATTRIBS
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(VertexFormat), (void*)16);
-		
+		//// Normalized integer attributes are converted to floats between 0 and 1 (or -1 and 1 for signed types) before the shader sees them.
+		int stride = layout.stride();
+		setPositionPointer(stride);
+
+		int offset = layout.positionSize();
 		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(VertexFormat), (void*)28);
+		if (layout.normal == NORMAL_FLOAT)
+			glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)(size_t)offset);
+		else if (layout.normal == NORMAL_SNORM10)
+			glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)(size_t)offset);
+		else
+			glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, stride, (void*)(size_t)offset);
+
+		offset += layout.normalSize();
+		if (layout.color == COLOR_FLOAT)
+		{
+			glEnableVertexAttribArray(2);
+			glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, stride, (void*)(size_t)offset);
+		}
+		else if (layout.color == COLOR_RGBA8)
+		{
+			glEnableVertexAttribArray(2);
+			glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, (void*)(size_t)offset);
+		}
+		// With COLOR_MATERIAL attribute 2 stays disabled, and setConstantColor() sets its constant value to white.
+		// The mesh's color is in the color of its objects instead.
+
+		// The element array binding is part of the VAO's state, so it has to be bound while the VAO is.
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+	}
+
+	//Points attribute 0 at the positions in the currently bound buffer.
+	void setPositionPointer(int stride)
+	{
+		glEnableVertexAttribArray(0);
+		if (layout.position == POSITION_FLOAT)
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+		else if (layout.position == POSITION_HALF)
+			glVertexAttribPointer(0, 3, GL_HALF_FLOAT, GL_FALSE, stride, (void*)0);
+		else
+			glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)0);
+	}
 
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(VertexFormat), (void*)0);
+	//Points attribute 3 of the currently bound vao at the given buffer of ids, starting offset bytes in and advancing once per instance.
+	void setObjectIDPointer(GLuint ids, GLintptr offset = 0)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, ids);
+		glEnableVertexAttribArray(3);
+		glVertexAttribIPointer(3, 1, GL_UNSIGNED_INT, sizeof(GLuint), (void*)offset);
+		glVertexAttribDivisor(3, 1);
+	}
 
-		glBindVertexArray(0);
+	//Binds the given vao and makes it read the shared positions and indices, like depthVao does.
+	//Passes with their own instanced attributes (like the point light's) build their vao on top of this.
+	void initDepthVao(GLuint vertexArray)
+	{
+		glBindVertexArray(vertexArray);
+		glBindBuffer(GL_ARRAY_BUFFER, positionBuffer);
+		setPositionPointer(layout.positionSize());
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
 	}
-};
 
+	//Uploads the mesh and returns its id. If a mesh with this name is already registered, nothing is uploaded and its id is returned.
+	int add(const std::string &name, int numVertices, VertexFormat* vertices, int numIndices = 0, GLuint* indices = nullptr)
+	{
+		int id = find(name);
+		if (id >= 0)
+			return id;
+
+		if (vertexBuffer == 0)
+			initBuffers();
+
+		Mesh mesh;
+		mesh.base.initBuffer(numVertices, vertices, numIndices, indices, layout, vertexData, positionData, indexData);
+
+		// glBufferData gives the buffers new storage, which the vaos pick up since they refer to the buffers by name.
+		glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+		glBufferData(GL_ARRAY_BUFFER, vertexData.size(), &vertexData[0], GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, positionBuffer);
+		glBufferData(GL_ARRAY_BUFFER, positionData.size(), &positionData[0], GL_STATIC_DRAW);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, indexBuffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, sizeof(GLuint) * indexData.size(), &indexData[0], GL_STATIC_DRAW);
+
+		meshes.push_back(mesh);
+		names.push_back(name);
+		return meshes.size() - 1;
+	}
 
-struct Sphere
-{
-	glm::vec3 origin;
-	float radius;
-	glm::mat4 MVP;
-	glm::mat4 ModelView;
-	glm::mat3 NormalMatrix;
-	stuff_for_drawing base;
-}sphere1, sphere2;
+	//Marks the mesh as an occluder, keeping a copy of the given triangles. They can be a simpler version of the mesh,
+	//as long as they don't stick out of it.
+	void setOccluder(int meshID, int numVertices, VertexFormat* vertices, int numIndices, GLuint* indices)
+	{
+		Mesh &mesh = meshes[meshID];
+		mesh.occluderPositions.resize(numVertices);
+		for (int i = 0; i < numVertices; i++)
+			mesh.occluderPositions[i] = vertices[i].position;
+		mesh.occluderIndices.assign(indices, indices + numIndices);
+	}
 
+	//Draws the instances of the given layer of every mesh, with whichever program is currently bound.
+	//The depth pass sets depthOnly, so only the positions are fetched.
+	//If visible is given, it holds for every object in the frame's object array whether to draw it. Each run of
+	//visible instances becomes one command, so the ones left out are skipped without rewriting the object array.
+	void draw(bool depthOnly, CasterLayer layer = ALL_CASTERS, const std::vector<bool>* visible = nullptr)
+	{
+		commands.clear();
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			Mesh &mesh = meshes[i];
+			int first = mesh.firstInstance;
+			int n = mesh.staticCount + mesh.dynamicCount;
+
+			if (layer == STATIC_CASTERS)
+				n = mesh.staticCount;
+			else if (layer == DYNAMIC_CASTERS)
+			{
+				first += mesh.staticCount;
+				n = mesh.dynamicCount;
+			}
+
+			if (n <= 0)
+				continue;
+
+			if (visible == nullptr)
+			{
+				commands.push_back(mesh.base.command(n, first));
+				continue;
+			}
+
+			for (int j = first; j < first + n; j++)
+			{
+				if (!(*visible)[j])
+					continue;
+
+				int runStart = j;
+				while (j < first + n && (*visible)[j])
+					j++;
+				commands.push_back(mesh.base.command(j - runStart, runStart));
+			}
+		}
+
+		if (!depthOnly)
+			setConstantColor();
+		submit(depthOnly ? depthVao : vao, commands);
+	}
 
-struct Plane
-{
-	//Construct the plane here 
-	stuff_for_drawing base;
-	unsigned int numberOfVertices;
-	glm::mat4 MVP;
-	glm::mat4 ModelView;
-	glm::mat3 NormalMatrix;
-	glm::vec3 origin;
+	//With COLOR_MATERIAL the color attribute is disabled, and reads a constant instead. The constant isn't part of the vao,
+	//so it is set to white before every draw reading colors. The objects' colors hold the meshes' colors.
+	void setConstantColor()
+	{
+		if (layout.color == COLOR_MATERIAL)
+			glVertexAttrib4f(2, 1.0f, 1.0f, 1.0f, 1.0f);
+	}
 
-	void initBuffer()
+	//Draws the commands with the given vao, which has to read the shared buffers the way vao or depthVao do.
+	//They go into the frame's section of the frameRing, and are all drawn by one glMultiDrawElementsIndirect.
+	//If the section has no room left for them, they are drawn one call at a time instead.
+	void submit(GLuint vertexArray, const std::vector<DrawCommand> &drawCommands)
 	{
-		numberOfVertices = 6;
+		if (drawCommands.empty())
+			return;
+
+		glBindVertexArray(vertexArray);
+		commandsDrawn += drawCommands.size();
+		for (unsigned int i = 0; i < drawCommands.size(); i++)
+			trianglesDrawn += (long long)(drawCommands[i].count / 3) * drawCommands[i].instanceCount;
+
+		GLintptr offset = frameRing.writeCommands(&drawCommands[0], drawCommands.size());
+		if (offset >= 0)
+		{
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)offset, drawCommands.size(), 0);
+			drawCalls++;
+			return;
+		}
+
+		for (unsigned int i = 0; i < drawCommands.size(); i++)
+		{
+			const DrawCommand &command = drawCommands[i];
+			glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, command.count, GL_UNSIGNED_INT, (void*)(sizeof(GLuint) * command.firstIndex),
+				command.instanceCount, command.baseVertex, command.baseInstance);
+			drawCalls++;
+		}
+	}
 
-		VertexFormat A, B, C, D;
+}meshRegistry;
 
-		/*
-		
-			A-----------------------B
-			|						|
-			|						|
-			C-----------------------D
 
-		*/
+//Registers the plane the spheres stand on as a mesh, and returns its id. It is 20 by 20 units, lying flat around the origin.
+int createPlaneMesh()
+{
+	VertexFormat A, B, C, D;
 
-		A.position = glm::vec3(-10.0f, 0.0f, -10.0f);
-		A.normal = glm::vec3(0.0f, 1.0f, 0.0f);
-		A.color = glm::vec4(0.75f, 0.75f, 0.75f, 1.0f);
+	/*
+	
+		A-----------------------B
+		|						|
+		|						|
+		C-----------------------D
 
-		B.position = glm::vec3(10.0f, 0.0f, -10.0f);
-		B.normal = glm::vec3(0.0f, 1.0f, 0.0f);
-		B.color = glm::vec4(0.75f, 0.75f, 0.75f, 1.0f);
+	*/
 
-		C.position = glm::vec3(-10.0f, 0.0f, 10.0f);
-		C.normal = glm::vec3(0.0f, 1.0f, 0.0f);
-		C.color = glm::vec4(0.75f, 0.75f, 0.75f, 1.0f);
+	A.position = glm::vec3(-10.0f, 0.0f, -10.0f);
+	A.normal = glm::vec3(0.0f, 1.0f, 0.0f);
+	A.color = glm::vec4(0.75f, 0.75f, 0.75f, 1.0f);
 
-		D.position = glm::vec3(10.0f, 0.0f, 10.0f);
-		D.normal = glm::vec3(0.0f, 1.0f, 0.0f);
-		D.color = glm::vec4(0.75f, 0.75f, 0.75f, 1.0f);
+	B.position = glm::vec3(10.0f, 0.0f, -10.0f);
+	B.normal = glm::vec3(0.0f, 1.0f, 0.0f);
+	B.color = glm::vec4(0.75f, 0.75f, 0.75f, 1.0f);
 
-		std::vector<VertexFormat> planeVerts;
-		
-		planeVerts.push_back(A);
-		planeVerts.push_back(B);
-		planeVerts.push_back(C);
+	C.position = glm::vec3(-10.0f, 0.0f, 10.0f);
+	C.normal = glm::vec3(0.0f, 1.0f, 0.0f);
+	C.color = glm::vec4(0.75f, 0.75f, 0.75f, 1.0f);
 
-		planeVerts.push_back(B);
-		planeVerts.push_back(D);
-		planeVerts.push_back(C);
+	D.position = glm::vec3(10.0f, 0.0f, 10.0f);
+	D.normal = glm::vec3(0.0f, 1.0f, 0.0f);
+	D.color = glm::vec4(0.75f, 0.75f, 0.75f, 1.0f);
 
-		numberOfVertices = 6;
-		base.initBuffer(numberOfVertices, &planeVerts[0]);
+	std::vector<VertexFormat> planeVerts;
+	
+	planeVerts.push_back(A);
+	planeVerts.push_back(B);
+	planeVerts.push_back(C);
 
-		origin = glm::vec3(0.0f, -0.5f, 0.0f);
-	}
+	planeVerts.push_back(B);
+	planeVerts.push_back(D);
+	planeVerts.push_back(C);
 
-}plane;
+	return meshRegistry.add("plane", planeVerts.size(), &planeVerts[0]);
+}
 
 
 std::string readShader(std::string fileName)
 {
+	PROFILE_ZONE("readShader");
 	std::string shaderCode;
 	std::string line;
 
@@ -235,10 +544,26 @@ std::string readShader(std::string fileName)
 	return shaderCode;
 }
 
+// Inserts the given #define lines right after the #version line of the shader source, which has to stay the first statement.
+// This lets us compile different variants of one shader file.
+std::string addDefines(const std::string &sourceCode, const std::string &defines)
+{
+	size_t version = sourceCode.find("#version");
+	if (version == std::string::npos || defines.empty())
+		return sourceCode;
+
+	size_t lineEnd = sourceCode.find('\n', version);
+	if (lineEnd == std::string::npos)
+		return sourceCode + "\n" + defines;
+
+	return sourceCode.substr(0, lineEnd + 1) + defines + sourceCode.substr(lineEnd + 1);
+}
+
 // This method will consolidate some of the shader code we've written to return a GLuint to the compiled shader.
 // It only requires the shader source code and the shader type.
 GLuint createShader(std::string sourceCode, GLenum shaderType)
 {
+	PROFILE_ZONE("createShader");
 	// glCreateShader, creates a shader given a type (such as GL_VERTEX_SHADER) and returns a GLuint reference to that shader.
 	GLuint shader = glCreateShader(shaderType);
 	const char *shader_code_ptr = sourceCode.c_str(); // We establish a pointer to our shader code string
@@ -250,6 +575,15 @@ GLuint createShader(std::string sourceCode, GLenum shaderType)
 	glShaderSource(shader, 1, &shader_code_ptr, &shader_code_size);
 	glCompileShader(shader); // This just compiles the shader, given the source code.
 
+	// We don't ask whether it compiled yet. The answer would make us wait for the compile, and the driver can compile
+	// many shaders at the same time if we let it. The program cache checks once the program is linked (see ProgramCache.h).
+	return shader;
+}
+
+// Prints the compile error of the shader, if it has one, and returns whether it compiled.
+// If the shader is still being compiled, this waits for it.
+bool checkShader(GLuint shader)
+{
 	GLint isCompiled = 0;
 
 	// Check the compile status to see if the shader compiled correctly.
@@ -264,56 +598,68 @@ GLuint createShader(std::string sourceCode, GLenum shaderType)
 		std::cout << "The shader failed to compile with the error:" << std::endl << infolog << std::endl;
 
 		// Provide the infolog in whatever manor you deem best.
-		// Exit with failure.
-		glDeleteShader(shader); // Don't leak the shader.
 
-		// NOTE: I almost always put a break point here, so that instead of the program continuing with a deleted/failed shader, it stops and gives me a chance to look at what may 
+		// NOTE: I almost always put a break point here, so that instead of the program continuing with a failed shader, it stops and gives me a chance to look at what may 
 		// have gone wrong. You can check the console output to see what the error was, and usually that will point you in the right direction.
+		return false;
 	}
 
-	return shader;
+	return true;
+}
+
+// Requests the program used by the lit pass, specialized for the vertex layout and the given filter, and returns it without waiting.
+GLuint requestRenderProgram(const ShadowFilter &filter)
+{
+	PROFILE_ZONE("requestRenderProgram");
+	std::string cascadeDefines = "#define NUM_CASCADES " + std::to_string(NUM_CASCADES) + "\n";
+
+	// Tell the lit pass' vertex shader how the normals are stored.
+	std::string defines = cascadeDefines;
+	if (vertexLayout.normal == NORMAL_OCTAHEDRAL)
+		defines += "#define OCTAHEDRAL_NORMALS\n";
+
+	std::string vertShader = addDefines(readShader("LightVertexShader.glsl"), defines);
+	// The fragment shader only contains the code of the chosen filter kernel.
+	std::string fragShader = addDefines(readShader("LightFragShader.glsl"), cascadeDefines + filter.defines());
+
+	// Every variant is cached on its own, since the defines are part of the source.
+	return programCache.request("lit pass (" + filter.name() + ")", vertShader, fragShader);
+}
+
+// Requests the program used by the lit pass into renderProgram, for the current shadowFilter.
+// Later filter changes go through setShadowFilter or requestShadowFilter in main.cpp.
+void createRenderProgram()
+{
+	// Replace the previous variant, if there is one.
+	if (renderProgram != 0)
+		programCache.release(renderProgram);
+
+	renderProgram = requestRenderProgram(shadowFilter);
 }
 
 // Initialization code
 void init()
 {
+	PROFILE_ZONE("init");
 	// Initializes the glew library
 	glewInit();
 
 	// Enables the depth test, which you will want in most cases. You can disable this in the render loop if you need to.
 	glEnable(GL_DEPTH_TEST);
 
+	// The shaders size their cascade arrays with this.
+	std::string cascadeDefines = "#define NUM_CASCADES " + std::to_string(NUM_CASCADES) + "\n";
+
 	// Read in the shader code from a file.
-	std::string vertShader = readShader("VertexShader.glsl");
+	std::string vertShader = addDefines(readShader("VertexShader.glsl"), cascadeDefines);
 	std::string fragShader = readShader("FragmentShader.glsl");
 
-	// createShader consolidates all of the shader compilation code
-	vertex_shader = createShader(vertShader, GL_VERTEX_SHADER);
-	fragment_shader = createShader(fragShader, GL_FRAGMENT_SHADER);
-
 	// A shader is a program that runs on your GPU instead of your CPU. In this sense, OpenGL refers to your groups of shaders as "programs".
-	// Using glCreateProgram creates a shader program and returns a GLuint reference to it.
-	program = glCreateProgram();
-	glAttachShader(program, vertex_shader);		// This attaches our vertex shader to our program.
-	glAttachShader(program, fragment_shader);	// This attaches our fragment shader to our program.
-
-	// This links the program, using the vertex and fragment shaders to create executables to run on the GPU.
-	glLinkProgram(program);
-
-	uniMVP = glGetUniformLocation(program, "MVP");
-
-
-
-	vertShader = readShader("LightVertexShader.glsl");
-	fragShader = readShader("LightFragShader.glsl");
-
-	vertex_shader = createShader(vertShader, GL_VERTEX_SHADER);
-	fragment_shader = createShader(fragShader, GL_FRAGMENT_SHADER);
+	// The program cache compiles the shaders with createShader and links them into a program, or loads the program
+	// linked on an earlier run if it has one (see ProgramCache.h). Neither program is waited for here, so they compile together.
+	program = programCache.request("depth pass", vertShader, fragShader);
 
-	renderProgram = glCreateProgram();
-	glAttachShader(renderProgram, vertex_shader);
-	glAttachShader(renderProgram, fragment_shader);
-	glLinkProgram(renderProgram);
+	createRenderProgram();
 
 	glFrontFace(GL_CW);
 	glEnable(GL_CULL_FACE);
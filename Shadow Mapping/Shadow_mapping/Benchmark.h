@@ -0,0 +1,264 @@
+/*
+Title: Shadow mapping (Hard Shadows)
+File Name: Benchmark.h
+Copyright  2015
+Original authors: Srinivasan Thiagarajan
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+This file contains the scripted benchmark: a path for the camera and the
+light to follow, and the numbers a run of it produces.
+
+The path only depends on the frame's number. Frame i is at time
+i * BENCHMARK_TIMESTEP, however long the frames before it took, so every
+run renders exactly the same frames, and runs with different settings (or
+on different machines) can be compared frame by frame. The camera circles
+the spheres while the light circles above them, so the light's frustum,
+the cascades and the shadow map all have to be redone every frame. The
+spheres marked dynamic (see --dynamic-objects) keep bouncing as well.
+
+A run records the CPU time of every frame (until glFinish returned, so the
+GPU's work is in it), the triangles drawn, the shadow map texels rendered,
+how often the static and the dynamic casters were drawn, and how long the
+shadow pass took on the GPU. From those it gives the mean
+and the 50th, 95th and 99th percentile frame time, the triangles drawn per
+second and the shadow map fill rate: texels rendered per second of shadow
+pass GPU time. The fill rate counts each texel of a layer once, however
+often it was drawn over.
+
+The results are written with the run's settings, as one line per run, so a
+sweep over a setting is a loop of runs appending to the same file.
+*/
+
+#ifndef _BENCHMARK_H
+#define _BENCHMARK_H
+
+#include "GLIncludes.h"
+#include <algorithm>
+#include <fstream>
+
+// Simulated time between two frames of the path, in seconds.
+#define BENCHMARK_TIMESTEP (1.0 / 60.0)
+// Frames rendered before the timed ones, for the driver to compile and upload what it puts off.
+#define BENCHMARK_WARMUP 10
+
+// Where the camera and the light are at a point in time.
+struct BenchmarkPath
+{
+	// The camera goes around the origin once every cameraPeriod seconds, at its starting distance and height.
+	float cameraRadius = 3.0f;
+	float cameraHeight = 1.0f;
+	float cameraPeriod = 8.0f;
+
+	// The light goes around the point above the origin once every lightPeriod seconds.
+	// It is never straight above, where its view's up vector would be along the view direction.
+	float lightRadius = 2.0f;
+	float lightHeight = 10.0f;
+	float lightPeriod = 5.0f;
+
+	glm::vec3 cameraPosition(double time)
+	{
+		float angle = (float)(6.2831853 * time / cameraPeriod);
+		return glm::vec3(cameraRadius * sin(angle), cameraHeight, cameraRadius * cos(angle));
+	}
+
+	glm::vec3 lightPosition(double time)
+	{
+		float angle = (float)(6.2831853 * time / lightPeriod);
+		return glm::vec3(lightRadius * cos(angle), lightHeight, lightRadius * sin(angle));
+	}
+
+}benchmarkPath;
+
+// The settings and the measurements of one run.
+struct BenchmarkRun
+{
+	int divisions;
+	int shadowMapSize;
+	int objects;
+	int dynamicObjects;
+	int spotLights;
+	std::string filter;
+	std::string culling;
+
+	std::vector<double> frameMs;	// CPU time of every timed frame
+	long long triangles = 0;		// Drawn in all the timed frames, by draws whose commands the CPU built
+	bool trianglesCounted = true;	// False if the GPU built some of the commands, so their triangles are unknown
+	long long shadowTexels = 0;		// Rendered into the shadow maps in all the timed frames
+	int staticRenders = 0;			// Timed frames which drew the static casters again
+	int dynamicRenders = 0;			// Timed frames which drew the dynamic casters over the cached static ones
+	double shadowGpuMs = 0.0;		// GPU time of the shadow pass, over the frames the GPU timers read
+	int shadowGpuFrames = 0;		// Number of frames the GPU timers read
+
+	double totalMs() const
+	{
+		double total = 0.0;
+		for (unsigned int i = 0; i < frameMs.size(); i++)
+			total += frameMs[i];
+		return total;
+	}
+
+	double meanMs() const
+	{
+		return frameMs.empty() ? 0.0 : totalMs() / frameMs.size();
+	}
+
+	//Returns the frame time p percent of the frames were at most as long as (nearest rank).
+	double percentileMs(double p) const
+	{
+		if (frameMs.empty())
+			return 0.0;
+
+		std::vector<double> sorted(frameMs);
+		std::sort(sorted.begin(), sorted.end());
+		int rank = (int)ceil(p / 100.0 * sorted.size());
+		return sorted[std::min(std::max(rank - 1, 0), (int)sorted.size() - 1)];
+	}
+
+	//Returns how many triangles were drawn per second, or -1 if that isn't known.
+	double trianglesPerSecond() const
+	{
+		double seconds = totalMs() / 1000.0;
+		return (!trianglesCounted || seconds <= 0.0) ? -1.0 : triangles / seconds;
+	}
+
+	//Returns how many million shadow map texels were rendered per second of shadow pass GPU time, or -1 if it wasn't timed.
+	double shadowFillRate() const
+	{
+		if (shadowGpuFrames == 0 || shadowGpuMs <= 0.0 || frameMs.empty())
+			return -1.0;
+
+		// The texels of an average frame, in the average frame's shadow pass time.
+		double texelsPerFrame = (double)shadowTexels / frameMs.size();
+		double secondsPerFrame = shadowGpuMs / shadowGpuFrames / 1000.0;
+		return texelsPerFrame / secondsPerFrame / 1e6;
+	}
+
+	//Writes the run as one line of JSON. Unknown numbers are null.
+	void writeJson(std::ostream &out) const
+	{
+		double trianglesRate = trianglesPerSecond();
+		double fillRate = shadowFillRate();
+		out << "{\"divisions\": " << divisions << ", \"shadow_map_size\": " << shadowMapSize << ", \"objects\": " << objects
+			<< ", \"dynamic_objects\": " << dynamicObjects << ", \"spot_lights\": " << spotLights << ", \"filter\": \"" << filter << "\", \"culling\": \"" << culling << "\""
+			<< ", \"frames\": " << frameMs.size() << ", \"timestep_s\": " << BENCHMARK_TIMESTEP
+			<< ", \"mean_ms\": " << meanMs() << ", \"p50_ms\": " << percentileMs(50) << ", \"p95_ms\": " << percentileMs(95)
+			<< ", \"p99_ms\": " << percentileMs(99) << ", \"triangles_per_frame\": ";
+		if (trianglesCounted)
+			out << (frameMs.empty() ? 0 : triangles / (long long)frameMs.size());
+		else
+			out << "null";
+		out << ", \"triangles_per_s\": ";
+		if (trianglesRate >= 0.0)
+			out << trianglesRate;
+		else
+			out << "null";
+		out << ", \"shadow_texels_per_frame\": " << (frameMs.empty() ? 0 : shadowTexels / (long long)frameMs.size())
+			<< ", \"static_renders\": " << staticRenders << ", \"dynamic_renders\": " << dynamicRenders << ", \"shadow_gpu_ms\": ";
+		if (shadowGpuFrames > 0)
+			out << shadowGpuMs / shadowGpuFrames;
+		else
+			out << "null";
+		out << ", \"shadow_fill_mtexels_per_s\": ";
+		if (fillRate >= 0.0)
+			out << fillRate;
+		else
+			out << "null";
+		out << "}\n";
+	}
+
+	//Writes the names of the columns writeCsv writes.
+	static void writeCsvHeader(std::ostream &out)
+	{
+		out << "divisions,shadow_map_size,objects,dynamic_objects,spot_lights,filter,culling,frames,timestep_s,mean_ms,p50_ms,p95_ms,p99_ms,"
+			<< "triangles_per_frame,triangles_per_s,shadow_texels_per_frame,static_renders,dynamic_renders,shadow_gpu_ms,"
+			<< "shadow_fill_mtexels_per_s\n";
+	}
+
+	//Writes the run as one line of CSV. Unknown numbers are left empty.
+	void writeCsv(std::ostream &out) const
+	{
+		double trianglesRate = trianglesPerSecond();
+		double fillRate = shadowFillRate();
+		out << divisions << "," << shadowMapSize << "," << objects << "," << dynamicObjects << "," << spotLights << "," << filter << "," << culling << ","
+			<< frameMs.size() << "," << BENCHMARK_TIMESTEP << "," << meanMs() << "," << percentileMs(50) << "," << percentileMs(95) << ","
+			<< percentileMs(99) << ",";
+		if (trianglesCounted)
+			out << (frameMs.empty() ? 0 : triangles / (long long)frameMs.size());
+		out << ",";
+		if (trianglesRate >= 0.0)
+			out << trianglesRate;
+		out << "," << (frameMs.empty() ? 0 : shadowTexels / (long long)frameMs.size()) << "," << staticRenders << "," << dynamicRenders << ",";
+		if (shadowGpuFrames > 0)
+			out << shadowGpuMs / shadowGpuFrames;
+		out << ",";
+		if (fillRate >= 0.0)
+			out << fillRate;
+		out << "\n";
+	}
+
+	//Appends the run to the file, as a line of JSON if its name ends in .json or .jsonl, and of CSV otherwise.
+	//A new CSV file gets the header first. Returns whether the file could be written.
+	bool append(const std::string &fileName) const
+	{
+		bool json = (fileName.size() >= 5 && fileName.compare(fileName.size() - 5, 5, ".json") == 0)
+			|| (fileName.size() >= 6 && fileName.compare(fileName.size() - 6, 6, ".jsonl") == 0);
+
+		bool empty;
+		{
+			std::ifstream in(fileName.c_str(), std::ios::ate);
+			empty = !in || in.tellg() == 0;
+		}
+
+		std::ofstream out(fileName.c_str(), std::ios::app);
+		if (!out)
+			return false;
+
+		if (json)
+			writeJson(out);
+		else
+		{
+			if (empty)
+				writeCsvHeader(out);
+			writeCsv(out);
+		}
+		return true;
+	}
+
+	//Prints the results for people.
+	void print(std::ostream &out) const
+	{
+		out << "benchmark: " << frameMs.size() << " frames of " << BENCHMARK_TIMESTEP * 1000.0 << " ms, " << divisions << " divisions, "
+			<< shadowMapSize << "x" << shadowMapSize << " shadow map, " << objects << " spheres (" << dynamicObjects << " moving), " << spotLights << " spot lights, "
+			<< filter << " filter, " << culling << " culling\n";
+		out << "  frame: mean " << meanMs() << " ms, p50 " << percentileMs(50) << " ms, p95 " << percentileMs(95) << " ms, p99 "
+			<< percentileMs(99) << " ms\n";
+		if (trianglesCounted)
+			out << "  triangles: " << trianglesPerSecond() / 1e6 << " million per second\n";
+		else
+			out << "  triangles: unknown, the GPU culling builds the draw commands\n";
+		if (shadowGpuFrames > 0)
+			out << "  shadow map: " << shadowFillRate() << " million texels per second, " << shadowGpuMs / shadowGpuFrames << " ms per frame on the GPU\n";
+		else
+			out << "  shadow map: fill rate unknown, the GPU timers are off\n";
+		out << "  shadow map: " << staticRenders << " static renders, " << dynamicRenders << " dynamic renders\n";
+	}
+};
+
+#endif _BENCHMARK_H
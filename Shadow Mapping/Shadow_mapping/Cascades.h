@@ -0,0 +1,178 @@
+/*
+Title: Shadow mapping (Hard Shadows)
+File Name: Cascades.h
+Copyright  2015
+Original authors: Srinivasan Thiagarajan
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+This file contains the cascaded shadow maps.
+
+A single shadow map spreads its texels evenly over everything the light
+sees, so close to the camera, where a lot of screen pixels land on each
+texel, the shadows get blocky. Cascaded shadow maps split the camera's view
+frustum along its depth into NUM_CASCADES slices and give every slice its
+own layer of a texture array. The near slices are small, so their texels
+are small as well.
+
+Each cascade looks through the same light frustum as before; it just
+zooms in on the part of the light's image which contains its slice. That
+zoom is a "crop" matrix applied after the light's projection: it scales and
+offsets x and y so that the slice's bounding rectangle fills the layer.
+Depth is left alone, so everything between the light and the slice is
+still captured as a caster.
+
+To keep shadow edges from shimmering when the camera moves, the crop
+rectangle's size is rounded up to a power of two fraction of the light's
+image, and its position is snapped to whole texels of the layer.
+
+The fragment shader picks the cascade from the view space depth of the
+fragment, using the split distances in CascadeSplits.
+
+References:
+Zhang et al., Parallel-Split Shadow Maps for Large-scale Virtual Environments
+Microsoft, Common Techniques to Improve Shadow Depth Maps
+*/
+
+#ifndef _CASCADES_H
+#define _CASCADES_H
+
+#include "GLIncludes.h"
+#include "FrustumCulling.h"
+
+// Number of slices the camera frustum is split into. The splits are passed to the shaders in a vec4, so 4 at most.
+#define NUM_CASCADES 4
+// Nothing further away from the camera than this gets shadows.
+#define SHADOW_DISTANCE 25.0f
+// Blend between logarithmic (1) and uniform (0) split distances.
+#define CASCADE_SPLIT_LAMBDA 0.75f
+
+struct ShadowCascades
+{
+	// The light's projection * view, cropped to each cascade.
+	glm::mat4 PV[NUM_CASCADES];
+
+	// The view space depth at which each cascade ends.
+	float splits[NUM_CASCADES];
+
+	// The part of the light's image each cascade covers, in the light's normalized device coordinates (min x, min y, max x, max y).
+	glm::vec4 rect[NUM_CASCADES];
+
+	// Set by update() when any of the matrices changed, so the shadow map has to be rendered again.
+	bool changed = true;
+
+	//Recalculates the cascades for the given camera and light.
+	void update(const glm::mat4 &cameraView, const glm::mat4 &cameraPV, const glm::mat4 &lightPV, int textureSize)
+	{
+		PROFILE_ZONE("shadowCascades.update");
+		// The corners of the camera frustum: the near plane is z = -1 and the far plane z = 1 in normalized device coordinates.
+		glm::mat4 inverse = glm::inverse(cameraPV);
+		glm::vec3 nearCorners[4], farCorners[4];
+		float nearDepth = 0.0f, farDepth = 0.0f;
+		for (int i = 0; i < 4; i++)
+		{
+			glm::vec2 xy((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f);
+			glm::vec4 n = inverse * glm::vec4(xy, -1.0f, 1.0f);
+			glm::vec4 f = inverse * glm::vec4(xy, 1.0f, 1.0f);
+			nearCorners[i] = glm::vec3(n) / n.w;
+			farCorners[i] = glm::vec3(f) / f.w;
+		}
+		nearDepth = -(cameraView * glm::vec4(nearCorners[0], 1.0f)).z;
+		farDepth = -(cameraView * glm::vec4(farCorners[0], 1.0f)).z;
+		float shadowDepth = std::min(farDepth, SHADOW_DISTANCE);
+
+		float sliceStart = nearDepth;
+		for (int c = 0; c < NUM_CASCADES; c++)
+		{
+			// Practical split scheme: logarithmic splits keep the texel to pixel ratio even, uniform ones spend more on the distance.
+			float t = (c + 1) / (float)NUM_CASCADES;
+			float logSplit = nearDepth * powf(shadowDepth / nearDepth, t);
+			float uniformSplit = nearDepth + (shadowDepth - nearDepth) * t;
+			splits[c] = CASCADE_SPLIT_LAMBDA * logSplit + (1.0f - CASCADE_SPLIT_LAMBDA) * uniformSplit;
+
+			// Bounding rectangle of the slice's 8 corners in the light's image.
+			glm::vec2 rectMin(1.0f), rectMax(-1.0f);
+			bool behindLight = false;
+			for (int i = 0; i < 8; i++)
+			{
+				// Points on a ray from the eye move linearly in view space depth, so we can interpolate between the near and far corner.
+				float depth = (i < 4) ? sliceStart : splits[c];
+				float t = (depth - nearDepth) / (farDepth - nearDepth);
+				glm::vec3 corner = nearCorners[i % 4] + (farCorners[i % 4] - nearCorners[i % 4]) * t;
+
+				glm::vec4 clip = lightPV * glm::vec4(corner, 1.0f);
+				if (clip.w <= 0.0f)
+				{
+					behindLight = true;
+					break;
+				}
+				rectMin = glm::min(rectMin, glm::vec2(clip) / clip.w);
+				rectMax = glm::max(rectMax, glm::vec2(clip) / clip.w);
+			}
+			sliceStart = splits[c];
+
+			// Nothing outside the light's frustum gets rendered anyway. A slice reaching behind the light can't be bounded, so it gets all of it.
+			if (behindLight)
+			{
+				rectMin = glm::vec2(-1.0f);
+				rectMax = glm::vec2(1.0f);
+			}
+			rectMin = glm::max(rectMin, glm::vec2(-1.0f));
+			rectMax = glm::min(rectMax, glm::vec2(1.0f));
+
+			// Round the size up to 2, 1, 0.5, ... of the light's image, leaving a texel of room on both sides for the snapping below.
+			float extent = std::max(rectMax.x - rectMin.x, rectMax.y - rectMin.y);
+			float size = 2.0f;
+			while (size * 0.5f >= extent * (1.0f + 4.0f / textureSize) && size > 4.0f / textureSize)
+				size *= 0.5f;
+
+			// Snap the center to whole texels of this cascade.
+			float texel = size / textureSize;
+			glm::vec2 center = (rectMin + rectMax) * 0.5f;
+			center = glm::floor(center / texel + 0.5f) * texel;
+			// Keep the rectangle inside the light's image. Both limits are whole texels away from 0 as well.
+			center = glm::clamp(center, glm::vec2(-1.0f + size * 0.5f), glm::vec2(1.0f - size * 0.5f));
+			rect[c] = glm::vec4(center - size * 0.5f, center + size * 0.5f);
+
+			// The crop matrix maps the rectangle onto -1 to 1.
+			float scale = 2.0f / size;
+			glm::mat4 crop(1.0f);
+			crop[0][0] = scale;
+			crop[1][1] = scale;
+			crop[3][0] = -center.x * scale;
+			crop[3][1] = -center.y * scale;
+
+			glm::mat4 cascadePV = crop * lightPV;
+			if (cascadePV != PV[c])
+				changed = true;
+			PV[c] = cascadePV;
+		}
+	}
+
+	//Fills visible with, for every object in bounds, whether it can cast a shadow into the cascade. Returns how many can't.
+	//The cascade's matrix has the same sides as its rectangle of the light's image, and a caster can be anywhere
+	//between the light and the far plane, so the near plane isn't tested.
+	int cullCasters(int cascade, const std::vector<glm::vec4> &bounds, std::vector<bool> &visible)
+	{
+		return Frustum(PV[cascade]).cullSpheres(bounds, visible, FRUSTUM_NO_NEAR_PLANE);
+	}
+
+}shadowCascades;
+
+#endif _CASCADES_H
@@ -0,0 +1,247 @@
+/*
+Title: Shadow mapping (Hard Shadows)
+File Name: CpuProfiler.h
+Copyright  2015
+Original authors: Srinivasan Thiagarajan
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+This file contains the CPU profiler: how long the parts of the program
+took on the CPU, on every thread, to be looked at as a timeline in
+chrome://tracing or Perfetto.
+
+A zone is a block of code marked with PROFILE_ZONE("name"). It records
+when the block was entered and left. Zones inside zones nest on the
+timeline.
+
+Recording has to be cheap, and the occlusion culler's worker threads
+record zones at the same time as the main thread. So every thread writes
+into its own buffer, which only it ever writes to, and recording a zone is
+two clock reads and a store, with no lock. A thread's buffer is made the
+first time it records something, and added to the list of all buffers
+with a compare and swap. When the thread exits, its buffer is freed for
+the next new thread, which carries on recording into it on the same
+track. So threads which come and go don't add up to more buffers than
+were ever running at once. When a buffer is full, further zones on that
+thread are counted in dropped instead.
+
+writeTrace writes every buffer as Chrome's trace event JSON, with one
+complete ("X") event per zone. Call it once the threads are done.
+
+In release builds (NDEBUG, or MSVC without _DEBUG) CPU_PROFILER is 0, and
+PROFILE_ZONE compiles to nothing.
+*/
+
+#ifndef _CPU_PROFILER_H
+#define _CPU_PROFILER_H
+
+#ifndef CPU_PROFILER
+#if defined(NDEBUG) || (defined(_MSC_VER) && !defined(_DEBUG))
+#define CPU_PROFILER 0
+#else
+#define CPU_PROFILER 1
+#endif
+#endif
+
+#include <string>
+
+#if CPU_PROFILER
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+
+// Number of zones each thread can record.
+#define CPU_PROFILER_ZONES 65536
+
+// One zone, as it was left.
+struct CpuZoneEvent
+{
+	const char* name;	// Has to live for the whole run, like a string literal
+	long long beginNs;	// From the start of the profiler
+	long long endNs;
+};
+
+// The zones of one thread. Only that thread writes to it.
+struct CpuZoneBuffer
+{
+	CpuZoneEvent events[CPU_PROFILER_ZONES];
+	std::atomic<int> count;
+	int dropped;
+	int threadID;
+	std::atomic<bool> inUse;	// Whether a running thread owns it
+	CpuZoneBuffer* next;
+};
+
+// Gives the calling thread's buffer back when the thread exits.
+struct CpuThreadBuffer
+{
+	CpuZoneBuffer* buffer = nullptr;
+
+	~CpuThreadBuffer()
+	{
+		if (buffer != nullptr)
+			buffer->inUse.store(false, std::memory_order_release);
+	}
+};
+
+struct CpuProfiler
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	// Every thread's buffer, newest first.
+	std::atomic<CpuZoneBuffer*> buffers{ nullptr };
+	std::atomic<int> threads{ 0 };
+
+	long long now()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	//Returns the calling thread's buffer. On the first call it takes one a thread which exited left free, or makes a new one.
+	CpuZoneBuffer* threadBuffer()
+	{
+		static thread_local CpuThreadBuffer owned;
+		if (owned.buffer != nullptr)
+			return owned.buffer;
+
+		for (CpuZoneBuffer* candidate = buffers.load(); candidate != nullptr; candidate = candidate->next)
+		{
+			bool expected = false;
+			if (candidate->inUse.compare_exchange_strong(expected, true, std::memory_order_acquire))
+				return owned.buffer = candidate;
+		}
+
+		CpuZoneBuffer* buffer = owned.buffer = new CpuZoneBuffer();
+		buffer->count = 0;
+		buffer->dropped = 0;
+		buffer->inUse = true;
+		buffer->threadID = threads++;
+
+		// Push it on the front of the list. If another thread got there first, try again with the new front.
+		CpuZoneBuffer* head = buffers.load();
+		do
+			buffer->next = head;
+		while (!buffers.compare_exchange_weak(head, buffer));
+		return buffer;
+	}
+
+	//Records a zone of the calling thread.
+	void record(const char* name, long long beginNs, long long endNs)
+	{
+		CpuZoneBuffer* buffer = threadBuffer();
+		int i = buffer->count.load(std::memory_order_relaxed);
+		if (i >= CPU_PROFILER_ZONES)
+		{
+			buffer->dropped++;
+			return;
+		}
+
+		buffer->events[i].name = name;
+		buffer->events[i].beginNs = beginNs;
+		buffer->events[i].endNs = endNs;
+		// Release, so the event is written before a reader on another thread sees the count.
+		buffer->count.store(i + 1, std::memory_order_release);
+	}
+
+	//Writes the zones of every thread as Chrome trace event JSON. Returns whether the file could be written.
+	bool writeTrace(const std::string &fileName)
+	{
+		std::ofstream out(fileName.c_str());
+		if (!out)
+			return false;
+
+		out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+		bool first = true;
+		for (CpuZoneBuffer* buffer = buffers.load(); buffer != nullptr; buffer = buffer->next)
+		{
+			out << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer->threadID
+				<< ", \"args\": {\"name\": \"" << (buffer->threadID == 0 ? std::string("main") : "thread " + std::to_string(buffer->threadID)) << "\"}}";
+			first = false;
+
+			// Trace times are in microseconds.
+			int count = buffer->count.load(std::memory_order_acquire);
+			for (int i = 0; i < count; i++)
+			{
+				const CpuZoneEvent &event = buffer->events[i];
+				out << ",\n{\"name\": \"" << event.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->threadID
+					<< ", \"ts\": " << event.beginNs / 1000.0 << ", \"dur\": " << (event.endNs - event.beginNs) / 1000.0 << "}";
+			}
+		}
+		out << "\n]}\n";
+		return true;
+	}
+
+	//Returns the number of zones recorded, and of those dropped because a buffer was full, over all threads.
+	void counts(int &recorded, int &dropped)
+	{
+		recorded = dropped = 0;
+		for (CpuZoneBuffer* buffer = buffers.load(); buffer != nullptr; buffer = buffer->next)
+		{
+			recorded += buffer->count.load(std::memory_order_acquire);
+			dropped += buffer->dropped;
+		}
+	}
+
+}cpuProfiler;
+
+// Records the enclosing block as a zone, from when it is made until it goes out of scope.
+struct CpuZone
+{
+	const char* name;
+	long long beginNs;
+
+	CpuZone(const char* iName)
+	{
+		name = iName;
+		beginNs = cpuProfiler.now();
+	}
+
+	~CpuZone()
+	{
+		cpuProfiler.record(name, beginNs, cpuProfiler.now());
+	}
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_ZONE(name) CpuZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+
+#else
+
+// Without the profiler there is nothing to record, and no trace to write.
+struct CpuProfiler
+{
+	bool writeTrace(const std::string &)
+	{
+		return false;
+	}
+
+	void counts(int &recorded, int &dropped)
+	{
+		recorded = dropped = 0;
+	}
+
+}cpuProfiler;
+
+#define PROFILE_ZONE(name) ((void)0)
+
+#endif
+
+#endif _CPU_PROFILER_H
@@ -0,0 +1,217 @@
+/*
+Title: Shadow mapping (Hard Shadows)
+File Name: CullCompute.glsl
+Copyright  2015
+Original authors: Srinivasan Thiagarajan
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+This compute shader culls every object drawn this frame on the GPU, and
+writes the draw commands for the objects which are left (see GpuCulling.h).
+
+Each invocation tests one object's bounding sphere against the camera's
+frustum, for the lit pass, and against the sides and the far plane of the
+light's frustum, for the depth pass. If it is inside, the object reserves a
+place in its mesh's command by incrementing the command's instance count,
+and writes its index there in the list of visible ids. The instanced id
+attribute then reads that list, starting at the command's baseInstance.
+
+The objects of a mesh are in one range of the frame's object array, so the
+mesh an object belongs to is found with a binary search over the ranges.
+
+With the Hi-Z culling, the shader runs twice per frame (see Phase below).
+In the first phase, the lit pass only gets the objects which were visible
+last frame. In the second, every object in the camera's frustum is tested
+against the Hi-Z pyramid made from them: its bounding sphere is projected
+to a rectangle on the screen, and the pyramid level is picked where that
+rectangle covers at most 2 x 2 texels. Each texel holds the farthest depth
+below it, so if the sphere's nearest point is behind all four, the object
+is hidden.
+*/
+
+#version 430 core
+
+layout(local_size_x = CULL_GROUP_SIZE, local_size_y = 1, local_size_z = 1) in;
+
+// Where a mesh is in the shared buffers, and where its objects are in the frame's object array.
+struct MeshDraw
+{
+	uint count;
+	uint firstIndex;
+	int baseVertex;
+	uint firstInstance;
+	uint staticCount;
+	uint dynamicCount;
+	uint pad0;
+	uint pad1;
+};
+
+// The layout glMultiDrawElementsIndirect reads.
+struct DrawCommand
+{
+	uint count;
+	uint instanceCount;
+	uint firstIndex;
+	int baseVertex;
+	uint baseInstance;
+};
+
+// The bounding sphere of every object, in the order of the frame's object array.
+layout(std430, binding = 3) readonly buffer Bounds
+{
+	vec4 bounds[];
+};
+
+layout(std430, binding = 4) readonly buffer Meshes
+{
+	MeshDraw meshes[];
+};
+
+// One command per mesh for the lit pass, then two per mesh (static and dynamic casters) for the depth pass, then one per mesh
+// for the objects the second phase revealed.
+// They come in with their instance counts at 0.
+layout(std430, binding = 5) buffer Commands
+{
+	DrawCommand commands[];
+};
+
+// The visible ids of the lit pass, then MAX_OBJECTS later those of the depth pass, then those revealed by the second phase.
+layout(std430, binding = 6) writeonly buffer VisibleIDs
+{
+	uint ids[];
+};
+
+// The scene slot of every object, and for every slot whether the object was visible last frame.
+layout(std430, binding = 7) buffer Visibility
+{
+	uint objectSlots[MAX_OBJECTS];
+	uint wasVisible[];
+};
+
+// The Hi-Z pyramid: each texel of level n holds the farthest depth of 2^(n + 1) x 2^(n + 1) pixels.
+layout(binding = HIZ_TEXTURE_UNIT) uniform sampler2D HiZ;
+
+uniform uint ObjectCount;
+uniform uint MeshCount;
+
+// 0 to cull once, without the Hi-Z pyramid. 1 for the first phase, which culls the casters and draws what was visible last frame.
+// 2 for the second phase, which tests against the pyramid.
+uniform uint Phase;
+
+uniform mat4 CameraPV;
+uniform int HiZLevels;
+uniform float HiZSize;		// Width and height, in pixels, of the depth the pyramid was built from
+
+// As (normal, distance), with the normals pointing inside. The light's near plane is left out,
+// since a caster between the light and its near plane still casts a shadow.
+uniform vec4 CameraPlanes[6];
+uniform vec4 LightPlanes[5];
+
+// Returns whether the sphere is behind the depths in the Hi-Z pyramid.
+// If it can't tell, because the sphere reaches behind the camera's near plane, it says it isn't.
+bool hiZOccluded(vec4 sphere)
+{
+	// The rectangle around the projected corners of the box around the sphere holds the projected sphere.
+	vec2 low = vec2(1.0f), high = vec2(-1.0f);
+	float nearest = 1.0f;
+	for (int c = 0; c < 8; c++)
+	{
+		vec3 corner = sphere.xyz + sphere.w * vec3((c & 1) != 0 ? 1.0f : -1.0f, (c & 2) != 0 ? 1.0f : -1.0f, (c & 4) != 0 ? 1.0f : -1.0f);
+		vec4 clip = CameraPV * vec4(corner, 1.0f);
+		if (clip.w <= 0.0f)
+			return false;
+		vec3 ndc = clip.xyz / clip.w;
+		low = min(low, ndc.xy);
+		high = max(high, ndc.xy);
+		nearest = min(nearest, ndc.z);
+	}
+	if (nearest < -1.0f)
+		return false;
+
+	vec2 uvLow = clamp(low * 0.5f + 0.5f, 0.0f, 1.0f);
+	vec2 uvHigh = clamp(high * 0.5f + 0.5f, 0.0f, 1.0f);
+	vec2 pixels = (uvHigh - uvLow) * HiZSize;
+	int level = clamp(int(ceil(log2(max(max(pixels.x, pixels.y), 1.0f)))) - 1, 0, HiZLevels - 1);
+
+	ivec2 size = textureSize(HiZ, level);
+	ivec2 a = clamp(ivec2(uvLow * vec2(size)), ivec2(0), size - 1);
+	ivec2 b = clamp(ivec2(uvHigh * vec2(size)), ivec2(0), size - 1);
+	float farthest = max(max(texelFetch(HiZ, a, level).r, texelFetch(HiZ, ivec2(b.x, a.y), level).r),
+		max(texelFetch(HiZ, ivec2(a.x, b.y), level).r, texelFetch(HiZ, b, level).r));
+
+	return nearest * 0.5f + 0.5f > farthest;
+}
+
+void main(void)
+{
+	uint i = gl_GlobalInvocationID.x;
+	if (i >= ObjectCount)
+		return;
+
+	// The last mesh whose objects start at or before this one. Meshes without objects start where the next one does, so they are skipped.
+	uint low = 0u, high = MeshCount - 1u;
+	while (low < high)
+	{
+		uint middle = (low + high + 1u) / 2u;
+		if (meshes[middle].firstInstance <= i)
+			low = middle;
+		else
+			high = middle - 1u;
+	}
+	MeshDraw mesh = meshes[low];
+	vec4 sphere = bounds[i];
+
+	bool inCamera = true;
+	for (int p = 0; p < 6; p++)
+		inCamera = inCamera && dot(CameraPlanes[p].xyz, sphere.xyz) + CameraPlanes[p].w >= -sphere.w;
+
+	if (Phase == 2u)
+	{
+		// What the first phase drew was visible last frame. Everything else that is visible now was just revealed.
+		uint slot = objectSlots[i];
+		bool visible = inCamera && !hiZOccluded(sphere);
+		if (visible && wasVisible[slot] == 0u)
+		{
+			uint revealed = atomicAdd(commands[MeshCount * 3u + low].instanceCount, 1u);
+			ids[MAX_OBJECTS * 2u + mesh.firstInstance + revealed] = i;
+		}
+		wasVisible[slot] = visible ? 1u : 0u;
+		return;
+	}
+
+	bool inLight = true;
+	for (int p = 0; p < 5; p++)
+		inLight = inLight && dot(LightPlanes[p].xyz, sphere.xyz) + LightPlanes[p].w >= -sphere.w;
+
+	if (inCamera && (Phase == 0u || wasVisible[objectSlots[i]] != 0u))
+	{
+		uint slot = atomicAdd(commands[low].instanceCount, 1u);
+		ids[mesh.firstInstance + slot] = i;
+	}
+
+	if (inLight)
+	{
+		// The static casters come first in the mesh's range, then the dynamic ones.
+		bool dynamicCaster = i >= mesh.firstInstance + mesh.staticCount;
+		uint command = MeshCount + low * 2u + (dynamicCaster ? 1u : 0u);
+		uint start = mesh.firstInstance + (dynamicCaster ? mesh.staticCount : 0u);
+		uint slot = atomicAdd(commands[command].instanceCount, 1u);
+		ids[MAX_OBJECTS + start + slot] = i;
+	}
+}
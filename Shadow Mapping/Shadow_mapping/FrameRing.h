@@ -0,0 +1,251 @@
+/*
+Title: Shadow mapping (Hard Shadows)
+File Name: FrameRing.h
+Copyright  2015
+Original authors: Srinivasan Thiagarajan
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+This file contains the ring buffer which feeds the shaders their per-frame
+constants. Instead of setting every matrix with its own glUniform* call,
+everything a frame needs is written into one buffer:
+
+- FrameConstants (a std140 uniform block) holds the camera and light data
+  shared by every object.
+- An array of InstanceFormat (a std430 shader storage block) holds the
+  model and normal matrix of every object drawn this frame.
+- An array of SpotLightData (another std430 block) holds the spot lights
+  which can be seen this frame, and where their shadows are in the shadow
+  atlas (see ShadowAtlas.h).
+- An array of DrawCommand holds the draws of every pass, read by
+  glMultiDrawElementsIndirect (see MeshRegistry in BasicFunctions.h).
+
+The buffer is created with glBufferStorage and stays mapped for the whole
+run (persistent mapping), so writing the constants is just a memcpy. The
+GPU may still be reading what we wrote a frame or two ago, so the buffer is
+split into RING_FRAMES sections. Every frame writes to the next section, and
+a fence placed after the frame's draw calls tells us when the GPU is done
+with that section, before we write into it again.
+
+On drivers without GL_ARB_buffer_storage the same layout is used, but the
+section is mapped and unmapped every frame instead.
+*/
+
+#ifndef _FRAME_RING_H
+#define _FRAME_RING_H
+
+#include "GLIncludes.h"
+#include "Cascades.h"
+
+// Number of frames which can be in flight at the same time.
+#define RING_FRAMES 3
+// Maximum number of objects (instances) which can be drawn in one frame.
+#define MAX_OBJECTS 4096
+// Maximum number of spot lights which can light one frame.
+#define MAX_SPOT_LIGHTS 512
+// Maximum number of draw commands, of all the passes together, in one frame.
+#define MAX_DRAW_COMMANDS 16384
+
+// Binding points of the blocks. shaderParams::initUniforms attaches the blocks of each program to these.
+#define FRAME_CONSTANTS_BINDING 0
+#define OBJECTS_BINDING 1
+#define SPOT_LIGHTS_BINDING 2
+
+// The data shared by all the objects in a frame. Follows the std140 rules, so every vec3 is padded to a vec4.
+struct FrameConstants
+{
+	glm::mat4 PV;				// Camera projection * view
+	glm::mat4 View;				// Camera view
+	glm::mat4 CascadePV[NUM_CASCADES];	// Light projection * view, cropped to each cascade
+	glm::vec4 CascadeSplits;	// View space depth at which each cascade ends, one per component
+	glm::vec4 lightPosition;	// pointLight.position, w is the far plane of the point light's cube map
+	glm::vec4 lightIntensity;	// pointLight.Intensity, w is unused
+};
+
+// One spot light, as the lit pass sees it. Follows the std430 rules.
+struct SpotLightData
+{
+	glm::vec4 positionRange;	// Position, and the distance at which the light fades out
+	glm::vec4 directionCos;		// Direction the light points in, and the cosine of half the cone's angle
+	glm::vec4 color;			// Intensity, w is 1 if the light has a tile in the atlas and 0 if it casts no shadows
+	glm::mat4 shadowMatrix;		// World space to the light's tile in the atlas, in texture coordinates
+};
+
+// One draw of a glMultiDrawElementsIndirect call, laid out the way the GL reads it from the buffer.
+struct DrawCommand
+{
+	GLuint count;			// Number of indices
+	GLuint instanceCount;
+	GLuint firstIndex;		// Where the mesh's indices start in the shared index buffer
+	GLint baseVertex;		// Added to every index, where the mesh's vertices start in the shared vertex buffers
+	GLuint baseInstance;	// First object in the frame's object array
+};
+
+struct FrameRing
+{
+	GLuint buffer;
+
+	// Pointer to the start of the buffer while it is mapped, and to the start of this frame's section.
+	// Without persistent mapping only the section is mapped, and mapped is unused.
+	char* mapped;
+	char* frame;
+
+	// One fence per section, signaled once the GPU is done with the frame which used it.
+	GLsync fences[RING_FRAMES];
+
+	// Size of one section, and where the objects and the spot lights start inside it. All respect the driver's offset alignment.
+	GLintptr sectionSize;
+	GLintptr objectsOffset;
+	GLintptr spotLightsOffset;
+	GLintptr commandsOffset;
+
+	// The section being written this frame, and how many draw commands it already holds.
+	int section;
+	int commandCount;
+
+	bool persistent;
+
+	//Rounds value up to the next multiple of alignment.
+	static GLintptr align(GLintptr value, GLint alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	void init()
+	{
+		GLint uniformAlignment, storageAlignment;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+		glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storageAlignment);
+		GLint alignment = std::max(uniformAlignment, storageAlignment);
+
+		objectsOffset = align(sizeof(FrameConstants), alignment);
+		spotLightsOffset = align(objectsOffset + sizeof(InstanceFormat) * MAX_OBJECTS, alignment);
+		// The spot lights are preceded by their count, padded to a uvec4.
+		commandsOffset = align(spotLightsOffset + sizeof(glm::uvec4) + sizeof(SpotLightData) * MAX_SPOT_LIGHTS, alignment);
+		sectionSize = align(commandsOffset + sizeof(DrawCommand) * MAX_DRAW_COMMANDS, alignment);
+
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+
+		persistent = GLEW_ARB_buffer_storage != 0;
+		if (persistent)
+		{
+			// Coherent means our writes become visible to the GPU without flushing them.
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_UNIFORM_BUFFER, sectionSize * RING_FRAMES, nullptr, flags);
+			mapped = (char*)glMapBufferRange(GL_UNIFORM_BUFFER, 0, sectionSize * RING_FRAMES, flags);
+		}
+		else
+		{
+			glBufferData(GL_UNIFORM_BUFFER, sectionSize * RING_FRAMES, nullptr, GL_STREAM_DRAW);
+			mapped = nullptr;
+		}
+		frame = nullptr;
+
+		for (int i = 0; i < RING_FRAMES; i++)
+			fences[i] = 0;
+		section = 0;
+		commandCount = 0;
+	}
+
+	//Waits until the GPU is done with this frame's section and returns where the frame constants go.
+	FrameConstants* beginFrame()
+	{
+		if (fences[section] != 0)
+		{
+			// Usually the fence was signaled long ago. If not, we wait, flushing so the fence actually gets to the GPU.
+			while (glClientWaitSync(fences[section], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED);
+			glDeleteSync(fences[section]);
+			fences[section] = 0;
+		}
+
+		if (persistent)
+			frame = mapped + section * sectionSize;
+		else
+		{
+			// The fence already guarantees the GPU isn't using the section, so the driver doesn't need to synchronize either.
+			glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+			frame = (char*)glMapBufferRange(GL_UNIFORM_BUFFER, section * sectionSize, sectionSize,
+				GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		}
+
+		commandCount = 0;
+		return (FrameConstants*)frame;
+	}
+
+	//Returns where this frame's objects go. There is room for MAX_OBJECTS of them.
+	InstanceFormat* objects()
+	{
+		return (InstanceFormat*)(frame + objectsOffset);
+	}
+
+	//Returns where this frame's spot lights go. There is room for MAX_SPOT_LIGHTS of them.
+	SpotLightData* spotLights()
+	{
+		return (SpotLightData*)(frame + spotLightsOffset + sizeof(glm::uvec4));
+	}
+
+	//Makes this frame's section visible to the shaders. Call once the constants, objectCount objects and spotLightCount spot lights are written.
+	void bind(int objectCount, int spotLightCount)
+	{
+		*(glm::uvec4*)(frame + spotLightsOffset) = glm::uvec4(spotLightCount, 0, 0, 0);
+
+		if (!persistent)
+		{
+			glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+			glUnmapBuffer(GL_UNIFORM_BUFFER);
+			frame = nullptr;
+		}
+
+		glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_CONSTANTS_BINDING, buffer, section * sectionSize, sizeof(FrameConstants));
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, OBJECTS_BINDING, buffer, section * sectionSize + objectsOffset,
+			sizeof(InstanceFormat) * std::max(objectCount, 1));
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, SPOT_LIGHTS_BINDING, buffer, section * sectionSize + spotLightsOffset,
+			sizeof(glm::uvec4) + sizeof(SpotLightData) * std::max(spotLightCount, 1));
+	}
+
+	//Appends the draw commands to this frame's section, and binds the buffer as the draw indirect buffer.
+	//Returns the offset of the first command, to pass to glMultiDrawElementsIndirect, or -1 if there is no room for them.
+	//Call after bind, since without persistent mapping the section isn't mapped anymore and is written with glBufferSubData.
+	GLintptr writeCommands(const DrawCommand* commands, int count)
+	{
+		if (commandCount + count > MAX_DRAW_COMMANDS)
+			return -1;
+
+		GLintptr offset = section * sectionSize + commandsOffset + sizeof(DrawCommand) * commandCount;
+		commandCount += count;
+
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer);
+		if (persistent)
+			memcpy(mapped + offset, commands, sizeof(DrawCommand) * count);
+		else
+			glBufferSubData(GL_DRAW_INDIRECT_BUFFER, offset, sizeof(DrawCommand) * count, commands);
+		return offset;
+	}
+
+	//Call after the last draw call reading this frame's section. Fences the section and moves on to the next one.
+	void endFrame()
+	{
+		fences[section] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		section = (section + 1) % RING_FRAMES;
+	}
+
+}frameRing;
+
+#endif _FRAME_RING_H
@@ -0,0 +1,143 @@
+/*
+Title: Shadow mapping (Hard Shadows)
+File Name: FrustumCulling.h
+Copyright  2015
+Original authors: Srinivasan Thiagarajan
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+This file contains the frustum culling: finding which objects can't be
+seen by a camera (or a light) at all, because their bounding sphere is
+completely outside its frustum.
+
+A frustum is the space between 6 planes, which can be read straight off
+the rows of the projection * view matrix. A sphere is outside if its
+center is further than its radius behind any one of the planes.
+
+Every object's sphere is tested every frame, for the camera and for every
+shadow map, so the spheres are tested in batches of 4 with SSE. Four
+spheres are loaded and transposed, so one register holds the four x
+coordinates, the next the four y coordinates and so on. Then each plane
+is tested against all four at once.
+*/
+
+#ifndef _FRUSTUM_CULLING_H
+#define _FRUSTUM_CULLING_H
+
+#include "GLIncludes.h"
+#include "OcclusionCulling.h"
+
+// Which planes to test, as bits of a mask. A shadow map's casters can be anywhere between the light and
+// the frustum, so they are only tested against the sides and the far plane.
+#define FRUSTUM_ALL_PLANES 0x3f
+#define FRUSTUM_NO_NEAR_PLANE 0x2f
+
+//How many objects the culling tested and left out, for each kind of pass.
+struct CullingStats
+{
+	int viewTested;		// Objects tested against the camera in the last frame
+	int viewCulled;		// ...and how many of them were outside
+	int occluded;		// Objects inside the camera's frustum, but hidden behind occluders
+	int shadowTested;	// Caster draws tested against the shadow maps' frustums, since the start
+	int shadowCulled;	// ...and how many of them were left out
+
+	CullingStats()
+	{
+		viewTested = viewCulled = occluded = shadowTested = shadowCulled = 0;
+	}
+}cullingStats;
+
+struct Frustum
+{
+	// As (normal, distance), with the normal pointing inside and normalized so the distance is in world units.
+	// In the order left, right, bottom, top, near, far.
+	glm::vec4 planes[6];
+
+	Frustum()
+	{
+	}
+
+	//Gets the planes of the given projection * view matrix.
+	Frustum(const glm::mat4 &PV)
+	{
+		glm::mat4 m = glm::transpose(PV);
+		planes[0] = m[3] + m[0];
+		planes[1] = m[3] - m[0];
+		planes[2] = m[3] + m[1];
+		planes[3] = m[3] - m[1];
+		planes[4] = m[3] + m[2];
+		planes[5] = m[3] - m[2];
+		for (int i = 0; i < 6; i++)
+			planes[i] /= glm::length(glm::vec3(planes[i]));
+	}
+
+	//Returns whether any part of the sphere (xyz is the center, w the radius) is inside the planes in the mask.
+	bool sphereVisible(const glm::vec4 &sphere, int planeMask = FRUSTUM_ALL_PLANES) const
+	{
+		for (int i = 0; i < 6; i++)
+			if ((planeMask & (1 << i)) && glm::dot(glm::vec3(planes[i]), glm::vec3(sphere)) + planes[i].w < -sphere.w)
+				return false;
+		return true;
+	}
+
+	//Fills visible with sphereVisible for every sphere, and returns how many are not visible.
+	int cullSpheres(const std::vector<glm::vec4> &spheres, std::vector<bool> &visible, int planeMask = FRUSTUM_ALL_PLANES) const
+	{
+		visible.resize(spheres.size());
+		int culled = 0;
+		unsigned int i = 0;
+#if OCCLUSION_SSE
+		for (; i + 4 <= spheres.size(); i += 4)
+		{
+			// Turn 4 (x, y, z, r) into x x x x, y y y y, z z z z and r r r r.
+			__m128 x = _mm_loadu_ps(&spheres[i][0]);
+			__m128 y = _mm_loadu_ps(&spheres[i + 1][0]);
+			__m128 z = _mm_loadu_ps(&spheres[i + 2][0]);
+			__m128 r = _mm_loadu_ps(&spheres[i + 3][0]);
+			_MM_TRANSPOSE4_PS(x, y, z, r);
+			__m128 minusR = _mm_sub_ps(_mm_setzero_ps(), r);
+
+			__m128 outside = _mm_setzero_ps();
+			for (int p = 0; p < 6; p++)
+			{
+				if (!(planeMask & (1 << p)))
+					continue;
+				__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes[p].x), x), _mm_mul_ps(_mm_set1_ps(planes[p].y), y)),
+					_mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes[p].z), z), _mm_set1_ps(planes[p].w)));
+				outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, minusR));
+			}
+
+			int mask = _mm_movemask_ps(outside);
+			for (int j = 0; j < 4; j++)
+			{
+				visible[i + j] = !(mask & (1 << j));
+				culled += (mask >> j) & 1;
+			}
+		}
+#endif
+		for (; i < spheres.size(); i++)
+		{
+			visible[i] = sphereVisible(spheres[i], planeMask);
+			culled += !visible[i];
+		}
+		return culled;
+	}
+};
+
+#endif _FRUSTUM_CULLING_H
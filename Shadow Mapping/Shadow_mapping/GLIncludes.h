@@ -55,14 +55,15 @@ OpenGL 4 Shading language Cookbook
 #include <vector>
 #include <string>
 #include <algorithm>
-#include <soil\SOIL.h>
-#include "glew\glew.h"
-#include "glfw\glfw3.h"
-#include "glm\glm.hpp"
-#include "glm\gtc\matrix_transform.hpp"
-#include "glm\gtc\type_ptr.hpp"
-#include "glm\gtc\quaternion.hpp"
-#include "glm\gtx\quaternion.hpp"
+#include <soil/SOIL.h>
+#include "glew/glew.h"
+#include "glfw/glfw3.h"
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+#include "glm/gtc/type_ptr.hpp"
+#include "glm/gtc/quaternion.hpp"
+#include "glm/gtx/quaternion.hpp"
+#include "CpuProfiler.h"
 
 // We create a VertexFormat struct, which defines how the data passed into the shader code wil be formatted
 struct VertexFormat
@@ -88,4 +89,76 @@ struct VertexFormat
 	}
 };
 
+// InstanceFormat defines the data we store for every copy (instance) of a mesh that gets drawn.
+// The shaders read it from a std430 storage block, indexed by the instance being drawn.
+struct InstanceFormat
+{
+	glm::mat4 model;		// The model matrix, taking the mesh from model space to world space
+	glm::mat4 normal;		// The inverse transpose of the model matrix' upper 3x3, used to transform the normals.
+							// Stored as a mat4, since std430 pads the columns of a mat3 to vec4s anyway.
+	glm::vec4 color;		// The color of the object's material, which multiplies the mesh's colors
+
+	InstanceFormat()
+	{
+		model = glm::mat4(1.0f);
+		normal = glm::mat4(1.0f);
+		color = glm::vec4(1.0f);
+	}
+
+	InstanceFormat(const glm::mat4 &iModel)
+	{
+		model = iModel;
+		normal = glm::mat4(glm::transpose(glm::inverse(glm::mat3(iModel))));
+		color = glm::vec4(1.0f);
+	}
+
+	// For meshes with quantized positions. The dequantize matrix is folded into the model matrix,
+	// but it only applies to the positions, so the normal matrix is built from iModel alone.
+	InstanceFormat(const glm::mat4 &iModel, const glm::mat4 &dequantize, const glm::vec4 &iColor = glm::vec4(1.0f))
+	{
+		model = iModel * dequantize;
+		normal = glm::mat4(glm::transpose(glm::inverse(glm::mat3(iModel))));
+		color = iColor;
+	}
+};
+
+// An axis aligned box, given by its smallest and largest corner.
+struct BoundingBox
+{
+	glm::vec3 min;
+	glm::vec3 max;
+
+	BoundingBox()
+	{
+		min = glm::vec3(0.0f);
+		max = glm::vec3(0.0f);
+	}
+
+	BoundingBox(const glm::vec3 &iMin, const glm::vec3 &iMax)
+	{
+		min = iMin;
+		max = iMax;
+	}
+
+	// Returns corner i, where bit 0, 1 and 2 of i pick the max instead of the min for x, y and z.
+	glm::vec3 corner(int i) const
+	{
+		return glm::vec3((i & 1) ? max.x : min.x, (i & 2) ? max.y : min.y, (i & 4) ? max.z : min.z);
+	}
+
+	// Returns the box around this box moved by the given matrix.
+	BoundingBox transformed(const glm::mat4 &matrix) const
+	{
+		glm::vec3 first = glm::vec3(matrix * glm::vec4(corner(0), 1.0f));
+		BoundingBox box(first, first);
+		for (int i = 1; i < 8; i++)
+		{
+			glm::vec3 p = glm::vec3(matrix * glm::vec4(corner(i), 1.0f));
+			box.min = glm::min(box.min, p);
+			box.max = glm::max(box.max, p);
+		}
+		return box;
+	}
+};
+
 #endif _GL_INCLUDES_H
\ No newline at end of file
@@ -0,0 +1,443 @@
+/*
+Title: Shadow mapping (Hard Shadows)
+File Name: GpuCulling.h
+Copyright  2015
+Original authors: Srinivasan Thiagarajan
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+This file contains the GPU culling: a compute pass (CullCompute.glsl)
+which decides which objects the lit pass and the depth pass draw, and
+writes their draw commands itself.
+
+The CPU culling (see FrustumCulling.h) walks over every object, every
+frame, and builds the commands from what is left. Here the CPU only
+uploads the objects' bounding spheres and one empty command per mesh and
+pass. The compute shader tests every sphere and fills in the commands'
+instance counts, and the passes draw them with glMultiDrawElementsIndirect
+straight from the buffer the shader wrote. So the CPU never learns which
+objects were visible, and never has to wait for the GPU to find out.
+
+The commands' instances don't read the object id from the identity buffer
+the mesh registry uses, but from the lists of visible ids the shader
+wrote, one list for the lit pass and one for the depth pass. Each gets its
+own vao.
+
+The depth pass can only test against the light's whole frustum, not each
+cascade's part of it.
+
+With twoPhase set, the lit pass is also culled against what hides it, in
+two phases (see HiZCulling.h). Every object remembers whether it was
+visible last frame, in a flag kept on the GPU for its scene slot. The
+first phase only draws the objects which were visible last frame. Their
+depth makes the Hi-Z pyramid, and the second phase tests every object in
+the camera's frustum against it: the ones which are visible but weren't
+drawn yet (because they were just revealed) get their own commands, and
+every object's flag is updated for the next frame.
+
+Since the CPU never sees the results, check() reads them back and compares
+them with what the CPU culling finds for the same spheres and matrices
+(see --gpu-culling-check in main.cpp). It waits for the GPU, so it is only
+for testing, on any GL 4.3 implementation including software ones.
+*/
+
+#ifndef _GPU_CULLING_H
+#define _GPU_CULLING_H
+
+#include "GLIncludes.h"
+#include "FrustumCulling.h"
+#include "Scene.h"
+
+// Whether to cull on the GPU, unless it is switched at runtime (see --gpu-culling in main.cpp).
+#ifndef GPU_CULLING
+#define GPU_CULLING 0
+#endif
+
+// Objects culled by one work group.
+#define CULL_GROUP_SIZE 64
+
+// Binding points of the compute shader's blocks. They are set in the shader itself, and come after the frameRing's.
+#define CULL_BOUNDS_BINDING 3
+#define CULL_MESHES_BINDING 4
+#define CULL_COMMANDS_BINDING 5
+#define CULL_IDS_BINDING 6
+#define CULL_VISIBILITY_BINDING 7
+
+// The texture unit the second phase reads the Hi-Z pyramid from (see HiZCulling.h).
+#define HIZ_TEXTURE_UNIT 4
+
+// Spheres closer than this to one of the planes are left out of check(), since the GPU may round them to the other side.
+#define CULL_CHECK_EPSILON 0.001f
+
+// Which cull the compute shader runs: the only one, or one of the two phases of the Hi-Z culling.
+#define CULL_SINGLE_PHASE 0
+#define CULL_FIRST_PHASE 1
+#define CULL_SECOND_PHASE 2
+
+// A mesh, as the compute shader sees it. Follows the std430 rules.
+struct MeshDraw
+{
+	GLuint count;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint firstInstance;
+	GLuint staticCount;
+	GLuint dynamicCount;
+	GLuint pad[2];
+};
+
+struct GpuCulling
+{
+	bool enabled = GPU_CULLING != 0;
+
+	// Whether the lit pass is culled in two phases, against the Hi-Z pyramid. Set by the HiZCulling.
+	bool twoPhase = false;
+
+	GLuint program = 0;
+	GLuint boundsBuffer;
+	GLuint meshBuffer;
+	GLuint commandBuffer;
+	GLuint idBuffer;		// The visible ids of the lit pass, then at MAX_OBJECTS those of the depth pass, then at 2 * MAX_OBJECTS the revealed ones
+	GLuint litVao;
+	GLuint litDepthVao;		// Reads the lit pass' ids, but only the positions
+	GLuint casterVao;
+	GLuint revealedVao;
+
+	// The scene slot of every object in the frame's object array, followed by the visibility flag of every slot.
+	// The flags are kept from frame to frame. visibilitySlots is how many there is room for.
+	GLuint visibilityBuffer;
+	int visibilitySlots = 0;
+
+	GLint uni_ObjectCount;
+	GLint uni_MeshCount;
+	GLint uni_CameraPlanes;
+	GLint uni_LightPlanes;
+	GLint uni_Phase;
+	GLint uni_CameraPV;
+	GLint uni_HiZLevels;
+	GLint uni_HiZSize;
+
+	// Filled every frame and uploaded, reused.
+	std::vector<MeshDraw> meshDraws;
+	std::vector<DrawCommand> commands;
+	int meshCount = 0;
+
+	// Statistics of the last frame.
+	int objectsTested = 0;
+	int groups = 0;
+
+	// The matrices of the last cull, for check().
+	glm::mat4 culledCameraPV;
+	glm::mat4 culledLightPV;
+
+	// The visible ids of the last cull, read back by readBack() along with the commands.
+	std::vector<GLuint> visibleIDs;
+
+	//Requests the compute program without waiting for it, so it can compile along with the others. init does it if it wasn't done before.
+	void requestPrograms()
+	{
+		std::string defines = "#define CULL_GROUP_SIZE " + std::to_string(CULL_GROUP_SIZE) + "\n"
+			"#define MAX_OBJECTS " + std::to_string(MAX_OBJECTS) + "u\n"
+			"#define HIZ_TEXTURE_UNIT " + std::to_string(HIZ_TEXTURE_UNIT) + "\n";
+		program = programCache.requestCompute("gpu culling", addDefines(readShader("CullCompute.glsl"), defines));
+	}
+
+	//Gets the compute shader's uniforms and creates the buffers and vaos. The registry has to have its meshes already.
+	void init(MeshRegistry &registry)
+	{
+		if (program == 0)
+			requestPrograms();
+
+		uni_ObjectCount = glGetUniformLocation(program, "ObjectCount");
+		uni_MeshCount = glGetUniformLocation(program, "MeshCount");
+		uni_CameraPlanes = glGetUniformLocation(program, "CameraPlanes");
+		uni_LightPlanes = glGetUniformLocation(program, "LightPlanes");
+		uni_Phase = glGetUniformLocation(program, "Phase");
+		uni_CameraPV = glGetUniformLocation(program, "CameraPV");
+		uni_HiZLevels = glGetUniformLocation(program, "HiZLevels");
+		uni_HiZSize = glGetUniformLocation(program, "HiZSize");
+
+		glGenBuffers(1, &boundsBuffer);
+		glGenBuffers(1, &meshBuffer);
+		glGenBuffers(1, &commandBuffer);
+		glGenBuffers(1, &idBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, idBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * MAX_OBJECTS * 3, nullptr, GL_DYNAMIC_COPY);
+		// Until the first phase uploads the slots, the block still needs a buffer with something in it.
+		std::vector<GLuint> cleared(MAX_OBJECTS, 0);
+		glGenBuffers(1, &visibilityBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibilityBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * cleared.size(), &cleared[0], GL_DYNAMIC_COPY);
+
+		glGenVertexArrays(1, &litVao);
+		registry.initVertexVao(litVao);
+		registry.setObjectIDPointer(idBuffer);
+
+		glGenVertexArrays(1, &litDepthVao);
+		registry.initDepthVao(litDepthVao);
+		registry.setObjectIDPointer(idBuffer);
+
+		glGenVertexArrays(1, &casterVao);
+		registry.initDepthVao(casterVao);
+		registry.setObjectIDPointer(idBuffer, sizeof(GLuint) * MAX_OBJECTS);
+
+		glGenVertexArrays(1, &revealedVao);
+		registry.initVertexVao(revealedVao);
+		registry.setObjectIDPointer(idBuffer, sizeof(GLuint) * MAX_OBJECTS * 2);
+		glBindVertexArray(0);
+	}
+
+	//Uploads the scene slot of every object in the frame's object array, in front of the visibility flags.
+	//If there are more slots than flags, the flags are made again, all cleared. That only makes the next frame draw everything in the second phase.
+	void uploadSlots(const Scene &scene)
+	{
+		int slotCount = scene.entries.size();
+		if (slotCount > visibilitySlots)
+		{
+			visibilitySlots = std::max(slotCount, visibilitySlots * 2);
+			std::vector<GLuint> cleared(MAX_OBJECTS + visibilitySlots, 0);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibilityBuffer);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * cleared.size(), &cleared[0], GL_DYNAMIC_COPY);
+		}
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibilityBuffer);
+		if (!scene.objectSlots.empty())
+			glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint) * scene.objectSlots.size(), &scene.objectSlots[0]);
+	}
+
+	//Uploads this frame's bounds and empty commands, and runs the compute shader over them.
+	//scene.objectBounds and the meshes' ranges in the object array have to be from this frame.
+	void cull(MeshRegistry &registry, const Scene &scene, const glm::mat4 &cameraPV, const glm::mat4 &lightPV)
+	{
+		PROFILE_ZONE("gpuCulling.cull");
+		meshCount = registry.meshes.size();
+		objectsTested = scene.objectBounds.size();
+		groups = 0;
+		culledCameraPV = cameraPV;
+		culledLightPV = lightPV;
+		if (meshCount == 0)
+			return;
+
+		// Lit commands first, then a static and a dynamic one per mesh, then the revealed ones. The compute shader fills in the instance counts.
+		meshDraws.resize(meshCount);
+		commands.resize(meshCount * 4);
+		for (int m = 0; m < meshCount; m++)
+		{
+			Mesh &mesh = registry.meshes[m];
+			MeshDraw &draw = meshDraws[m];
+			draw.count = mesh.base.numberOfIndices;
+			draw.firstIndex = mesh.base.firstIndex;
+			draw.baseVertex = mesh.base.baseVertex;
+			draw.firstInstance = mesh.firstInstance;
+			draw.staticCount = mesh.staticCount;
+			draw.dynamicCount = mesh.dynamicCount;
+
+			commands[m] = mesh.base.command(0, mesh.firstInstance);
+			commands[meshCount + m * 2] = mesh.base.command(0, mesh.firstInstance);
+			commands[meshCount + m * 2 + 1] = mesh.base.command(0, mesh.firstInstance + mesh.staticCount);
+			commands[meshCount * 3 + m] = mesh.base.command(0, mesh.firstInstance);
+		}
+
+		// glBufferData gives the buffers new storage each frame, so the GPU can still be reading last frame's.
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, boundsBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(glm::vec4) * std::max(objectsTested, 1),
+			objectsTested > 0 ? &scene.objectBounds[0] : nullptr, GL_STREAM_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, meshBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(MeshDraw) * meshCount, &meshDraws[0], GL_STREAM_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(DrawCommand) * commands.size(), &commands[0], GL_STREAM_DRAW);
+
+		if (twoPhase)
+			uploadSlots(scene);
+
+		if (objectsTested == 0)
+			return;
+
+		Frustum camera(cameraPV), light(lightPV);
+		glm::vec4 lightPlanes[5] = { light.planes[0], light.planes[1], light.planes[2], light.planes[3], light.planes[5] };
+
+		glUseProgram(program);
+		glUniform1ui(uni_ObjectCount, objectsTested);
+		glUniform1ui(uni_MeshCount, meshCount);
+		glUniform4fv(uni_CameraPlanes, 6, glm::value_ptr(camera.planes[0]));
+		glUniform4fv(uni_LightPlanes, 5, glm::value_ptr(lightPlanes[0]));
+		dispatch(twoPhase ? CULL_FIRST_PHASE : CULL_SINGLE_PHASE);
+	}
+
+	//Runs the second phase: tests the objects in the camera's frustum against the Hi-Z pyramid, and writes the commands
+	//of those which are visible but weren't drawn by the first phase. Call after cull, once the pyramid is built from the first phase.
+	//The pyramid has to be bound to HIZ_TEXTURE_UNIT. Its level 0 is half of size, the size of the depth it was built from.
+	void cullRevealed(const glm::mat4 &cameraPV, int levels, int size)
+	{
+		if (objectsTested == 0)
+			return;
+
+		glUseProgram(program);
+		glUniformMatrix4fv(uni_CameraPV, 1, GL_FALSE, glm::value_ptr(cameraPV));
+		glUniform1i(uni_HiZLevels, levels);
+		glUniform1f(uni_HiZSize, (float)size);
+		dispatch(CULL_SECOND_PHASE);
+	}
+
+	void dispatch(int phase)
+	{
+		glUniform1ui(uni_Phase, phase);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_BOUNDS_BINDING, boundsBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_MESHES_BINDING, meshBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_COMMANDS_BINDING, commandBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_IDS_BINDING, idBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_VISIBILITY_BINDING, visibilityBuffer);
+
+		groups = (objectsTested + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE;
+		glDispatchCompute(groups, 1, 1);
+
+		// The draws read the commands as indirect arguments, and the ids as a vertex attribute. The second phase reads the flags the first one left.
+		glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+
+	//Draws the objects the camera can see, with whichever program is currently bound. With twoPhase, those of both phases.
+	void drawLit(MeshRegistry &registry)
+	{
+		registry.setConstantColor();
+		submit(registry, litVao, 0, meshCount, 0);
+		if (twoPhase)
+			submit(registry, revealedVao, meshCount * 3, meshCount, 0);
+	}
+
+	//Draws the positions of the objects the first phase found, for the Hi-Z pyramid.
+	void drawLitDepth(MeshRegistry &registry)
+	{
+		submit(registry, litDepthVao, 0, meshCount, 0);
+	}
+
+	//Reads back the commands and the visible ids the compute shader wrote in the last cull, into commands and visibleIDs.
+	//It waits for the GPU, so it is only for statistics and checks.
+	void readBack()
+	{
+		if (meshCount == 0)
+			return;
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(DrawCommand) * commands.size(), &commands[0]);
+		visibleIDs.resize(MAX_OBJECTS * 3);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, idBuffer);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint) * visibleIDs.size(), &visibleIDs[0]);
+	}
+
+	//Reads back how many objects the lit pass drew in each phase of the last cull, and how many caster draws the depth pass made.
+	//It waits for the GPU, so it is only for statistics.
+	void readCounts(int &firstPhase, int &revealed, int &casters)
+	{
+		firstPhase = revealed = casters = 0;
+		readBack();
+		for (int m = 0; m < meshCount; m++)
+		{
+			firstPhase += commands[m].instanceCount;
+			casters += commands[meshCount + m * 2].instanceCount + commands[meshCount + m * 2 + 1].instanceCount;
+			revealed += commands[meshCount * 3 + m].instanceCount;
+		}
+	}
+
+	//Marks the objects in count of the lists of visible ids, which start at offset and are filled by the commands from first on.
+	//stride is how many commands apart they are, and dynamicCasters says the lists start at the meshes' dynamic objects.
+	void markDrawn(std::vector<bool> &drawn, int first, int count, int stride, int offset, bool dynamicCasters) const
+	{
+		for (int m = 0; m < count; m++)
+		{
+			const DrawCommand &command = commands[first + m * stride];
+			int start = offset + meshDraws[m].firstInstance + (dynamicCasters ? meshDraws[m].staticCount : 0);
+			for (GLuint k = 0; k < command.instanceCount && start + k < visibleIDs.size(); k++)
+				if (visibleIDs[start + k] < drawn.size())
+					drawn[visibleIDs[start + k]] = true;
+		}
+	}
+
+	//Compares the last cull with what Frustum::cullSpheres finds for the same spheres and matrices on the CPU, and returns how
+	//many objects the two disagree on. With twoPhase the lit pass also leaves out what the Hi-Z pyramid hides, so for it only
+	//the objects drawn outside the camera's frustum count. It waits for the GPU.
+	int check(const Scene &scene)
+	{
+		readBack();
+		const std::vector<glm::vec4> &spheres = scene.objectBounds;
+		if (meshCount == 0 || (int)spheres.size() != objectsTested)
+			return 0;
+
+		std::vector<bool> litDrawn(spheres.size(), false), casterDrawn(spheres.size(), false);
+		markDrawn(litDrawn, 0, meshCount, 1, 0, false);
+		if (twoPhase)
+			markDrawn(litDrawn, meshCount * 3, meshCount, 1, MAX_OBJECTS * 2, false);
+		markDrawn(casterDrawn, meshCount, meshCount, 2, MAX_OBJECTS, false);
+		markDrawn(casterDrawn, meshCount + 1, meshCount, 2, MAX_OBJECTS, true);
+
+		// The CPU's answer, and whether it stays the same with the spheres a little bigger and a little smaller.
+		std::vector<glm::vec4> grown(spheres), shrunk(spheres);
+		for (unsigned int i = 0; i < spheres.size(); i++)
+		{
+			grown[i].w += CULL_CHECK_EPSILON;
+			shrunk[i].w -= CULL_CHECK_EPSILON;
+		}
+		Frustum camera(culledCameraPV), light(culledLightPV);
+		std::vector<bool> inCamera, inCameraGrown, inCameraShrunk, inLight, inLightGrown, inLightShrunk;
+		camera.cullSpheres(spheres, inCamera);
+		camera.cullSpheres(grown, inCameraGrown);
+		camera.cullSpheres(shrunk, inCameraShrunk);
+		light.cullSpheres(spheres, inLight, FRUSTUM_NO_NEAR_PLANE);
+		light.cullSpheres(grown, inLightGrown, FRUSTUM_NO_NEAR_PLANE);
+		light.cullSpheres(shrunk, inLightShrunk, FRUSTUM_NO_NEAR_PLANE);
+
+		int mismatches = 0;
+		for (unsigned int i = 0; i < spheres.size(); i++)
+		{
+			if (inCameraGrown[i] == inCameraShrunk[i])
+				mismatches += twoPhase ? (litDrawn[i] && !inCamera[i]) : (litDrawn[i] != inCamera[i]);
+			if (inLightGrown[i] == inLightShrunk[i])
+				mismatches += casterDrawn[i] != inLight[i];
+		}
+		return mismatches;
+	}
+
+	//Draws the given layer of the casters inside the light's frustum, with whichever program is currently bound.
+	void drawCasters(MeshRegistry &registry, CasterLayer layer)
+	{
+		if (layer == ALL_CASTERS)
+			submit(registry, casterVao, meshCount, meshCount * 2, 0);
+		else
+		{
+			// Every other command, starting with the static or the dynamic one of the first mesh.
+			int first = meshCount + (layer == DYNAMIC_CASTERS ? 1 : 0);
+			submit(registry, casterVao, first, meshCount, sizeof(DrawCommand) * 2);
+		}
+	}
+
+	//Draws count of the commands the compute shader wrote, from the given one on, stride bytes apart (0 if they are packed).
+	void submit(MeshRegistry &registry, GLuint vertexArray, int first, int count, GLsizei stride)
+	{
+		if (count == 0)
+			return;
+
+		glBindVertexArray(vertexArray);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(sizeof(DrawCommand) * first), count, stride);
+		registry.drawCalls++;
+		registry.commandsDrawn += count;
+	}
+
+}gpuCulling;
+
+#endif _GPU_CULLING_H
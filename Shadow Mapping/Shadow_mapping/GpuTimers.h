@@ -0,0 +1,309 @@
+/*
+Title: Shadow mapping (Hard Shadows)
+File Name: GpuTimers.h
+Copyright  2015
+Original authors: Srinivasan Thiagarajan
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+This file contains the GPU timers: how long each pass of a frame took on
+the GPU, measured with timestamp queries.
+
+Every named scope (a pass, or a part of one) writes a GL_TIMESTAMP query
+when it begins and another when it ends, with glQueryCounter. Unlike
+GL_TIME_ELAPSED queries, timestamps can be nested, so a pass and the parts
+inside it can all be timed in the same frame.
+
+The GPU runs a frame or two behind the CPU, so a query's result isn't
+there right after the frame is submitted, and asking for it would make the
+CPU wait until it is. Instead, the queries of a frame are only read
+GPU_TIMER_FRAMES frames later, when the same set of queries is about to be
+used again. By then they are almost always done. If they aren't, the
+frame's results are thrown away (and counted in dropped) rather than
+waited for.
+
+Every frame which was read becomes a record: the frame's number, and the
+start and duration of every scope in milliseconds, relative to the start
+of the frame. The records can be written out as CSV or JSON.
+*/
+
+#ifndef _GPU_TIMERS_H
+#define _GPU_TIMERS_H
+
+#include "GLIncludes.h"
+#include <fstream>
+
+// Whether the timers are on, unless they are switched at runtime.
+#ifndef GPU_TIMERS
+#define GPU_TIMERS 1
+#endif
+
+// Number of frames whose queries are in flight. A frame's results are read this many frames later.
+#define GPU_TIMER_FRAMES 4
+// Maximum number of frame records kept. The oldest ones are thrown away after that.
+#define GPU_TIMER_HISTORY 10000
+
+// One timed scope of a frame.
+struct GpuTimerScope
+{
+	std::string name;
+	int depth;			// 0 for the whole frame, 1 for the scopes inside it, and so on
+	double startMs;		// From the start of the frame
+	double durationMs;
+};
+
+// Everything timed in one frame.
+struct GpuTimerRecord
+{
+	long long frame;
+	std::vector<GpuTimerScope> scopes;
+};
+
+struct GpuTimers
+{
+	bool enabled = GPU_TIMERS != 0;
+
+	// The queries and scopes of one frame in flight. Scope i begins with query 2 * i and ends with query 2 * i + 1.
+	struct FrameQueries
+	{
+		std::vector<GLuint> queries;
+		std::vector<std::string> names;
+		std::vector<int> depths;
+		long long frame;
+		bool pending = false;
+	};
+
+	FrameQueries frames[GPU_TIMER_FRAMES];
+	int current = 0;
+	long long frame = 0;
+	bool inFrame = false;
+
+	// The scopes which have begun and not ended yet, innermost last.
+	std::vector<int> open;
+
+	std::vector<GpuTimerRecord> records;
+	int dropped = 0;
+
+	//Starts the frame. Reads the results of the frame which used this set of queries before, if they are ready.
+	void beginFrame()
+	{
+		if (!enabled)
+			return;
+
+		current = frame % GPU_TIMER_FRAMES;
+		FrameQueries &queries = frames[current];
+		if (queries.pending)
+			collect(queries, false);
+
+		queries.names.clear();
+		queries.depths.clear();
+		queries.frame = frame;
+		open.clear();
+		inFrame = true;
+		begin("frame");
+	}
+
+	//Ends the frame, and all the scopes still open in it.
+	void endFrame()
+	{
+		if (!inFrame)
+			return;
+
+		while (!open.empty())
+			end();
+		frames[current].pending = true;
+		inFrame = false;
+		frame++;
+	}
+
+	//Begins a scope with the given name, inside the scopes already open.
+	void begin(const char* name)
+	{
+		if (!inFrame)
+			return;
+
+		FrameQueries &queries = frames[current];
+		int scope = queries.names.size();
+		if ((int)queries.queries.size() < scope * 2 + 2)
+		{
+			int first = queries.queries.size();
+			queries.queries.resize(scope * 2 + 2);
+			glGenQueries(queries.queries.size() - first, &queries.queries[first]);
+		}
+
+		glQueryCounter(queries.queries[scope * 2], GL_TIMESTAMP);
+		queries.names.push_back(name);
+		queries.depths.push_back(open.size());
+		open.push_back(scope);
+	}
+
+	//Ends the innermost open scope.
+	void end()
+	{
+		if (!inFrame || open.empty())
+			return;
+
+		glQueryCounter(frames[current].queries[open.back() * 2 + 1], GL_TIMESTAMP);
+		open.pop_back();
+	}
+
+	//Turns the frame's queries into a record. Without wait, the record is only made if the results are all there.
+	void collect(FrameQueries &queries, bool wait)
+	{
+		queries.pending = false;
+		if (queries.names.empty())
+			return;
+
+		// The frame's scope ends last, so once its end is there, so is everything else.
+		if (!wait)
+		{
+			GLuint available = 0;
+			glGetQueryObjectuiv(queries.queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+			{
+				dropped++;
+				return;
+			}
+		}
+
+		GpuTimerRecord record;
+		record.frame = queries.frame;
+		GLuint64 frameStart = 0;
+		for (unsigned int i = 0; i < queries.names.size(); i++)
+		{
+			GLuint64 start, stop;
+			glGetQueryObjectui64v(queries.queries[i * 2], GL_QUERY_RESULT, &start);
+			glGetQueryObjectui64v(queries.queries[i * 2 + 1], GL_QUERY_RESULT, &stop);
+			if (i == 0)
+				frameStart = start;
+
+			GpuTimerScope scope;
+			scope.name = queries.names[i];
+			scope.depth = queries.depths[i];
+			scope.startMs = (double)(GLint64)(start - frameStart) * 1e-6;
+			scope.durationMs = (double)(GLint64)(stop - start) * 1e-6;
+			record.scopes.push_back(scope);
+		}
+
+		if (records.size() >= GPU_TIMER_HISTORY)
+			records.erase(records.begin());
+		records.push_back(record);
+	}
+
+	//Reads the results of every frame still in flight, waiting for them. Call once rendering is over, before looking at the records.
+	void flush()
+	{
+		for (long long f = std::max(frame - GPU_TIMER_FRAMES, 0LL); f < frame; f++)
+		{
+			FrameQueries &queries = frames[f % GPU_TIMER_FRAMES];
+			if (queries.pending)
+				collect(queries, true);
+		}
+	}
+
+	//Writes one line per scope of every record: frame, scope, depth, start and duration in milliseconds.
+	void writeCsv(std::ostream &out)
+	{
+		out << "frame,scope,depth,start_ms,duration_ms\n";
+		for (unsigned int r = 0; r < records.size(); r++)
+			for (unsigned int s = 0; s < records[r].scopes.size(); s++)
+			{
+				const GpuTimerScope &scope = records[r].scopes[s];
+				out << records[r].frame << "," << scope.name << "," << scope.depth << "," << scope.startMs << "," << scope.durationMs << "\n";
+			}
+	}
+
+	//Writes the records as a JSON array, one object per frame with an array of its scopes.
+	void writeJson(std::ostream &out)
+	{
+		out << "[\n";
+		for (unsigned int r = 0; r < records.size(); r++)
+		{
+			out << "  {\"frame\": " << records[r].frame << ", \"scopes\": [";
+			for (unsigned int s = 0; s < records[r].scopes.size(); s++)
+			{
+				const GpuTimerScope &scope = records[r].scopes[s];
+				out << (s > 0 ? ", " : "") << "{\"name\": \"" << scope.name << "\", \"depth\": " << scope.depth
+					<< ", \"start_ms\": " << scope.startMs << ", \"duration_ms\": " << scope.durationMs << "}";
+			}
+			out << "]}" << (r + 1 < records.size() ? "," : "") << "\n";
+		}
+		out << "]\n";
+	}
+
+	//Writes the records to the file, as JSON if its name ends in .json and as CSV otherwise. Returns whether the file could be written.
+	bool write(const std::string &fileName)
+	{
+		std::ofstream out(fileName.c_str());
+		if (!out)
+			return false;
+
+		bool json = fileName.size() >= 5 && fileName.compare(fileName.size() - 5, 5, ".json") == 0;
+		if (json)
+			writeJson(out);
+		else
+			writeCsv(out);
+		return true;
+	}
+
+	//Prints the average duration of every scope over all the records, in the order they first appear.
+	void printSummary(std::ostream &out)
+	{
+		std::vector<std::string> names;
+		std::vector<int> depths;
+		std::vector<double> totals;
+		std::vector<int> counts;
+		for (unsigned int r = 0; r < records.size(); r++)
+			for (unsigned int s = 0; s < records[r].scopes.size(); s++)
+			{
+				const GpuTimerScope &scope = records[r].scopes[s];
+				unsigned int i = std::find(names.begin(), names.end(), scope.name) - names.begin();
+				if (i == names.size())
+				{
+					names.push_back(scope.name);
+					depths.push_back(scope.depth);
+					totals.push_back(0.0);
+					counts.push_back(0);
+				}
+				totals[i] += scope.durationMs;
+				counts[i]++;
+			}
+
+		out << "gpu timers: " << records.size() << " frames read, " << dropped << " dropped because they weren't ready\n";
+		for (unsigned int i = 0; i < names.size(); i++)
+			out << "  " << std::string(depths[i] * 2, ' ') << names[i] << ": avg " << totals[i] / counts[i] << " ms in " << counts[i] << " frames\n";
+	}
+
+}gpuTimers;
+
+// Times the enclosing block: begins a scope when it is made, and ends it when it goes out of scope.
+struct GpuTimed
+{
+	GpuTimed(const char* name)
+	{
+		gpuTimers.begin(name);
+	}
+
+	~GpuTimed()
+	{
+		gpuTimers.end();
+	}
+};
+
+#endif _GPU_TIMERS_H
@@ -0,0 +1,141 @@
+/*
+Title: Shadow mapping (Hard Shadows)
+File Name: Headless.h
+Copyright  2015
+Original authors: Srinivasan Thiagarajan
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+This file holds everything needed to run the shadow mapping example
+without a window. Build with HEADLESS defined (e.g. -DHEADLESS) and the
+program creates an EGL surfaceless context instead of a GLFW window, so it
+runs on machines with no display, including software implementations such
+as Mesa llvmpipe.
+
+Since there is no window, there is no default framebuffer either. The lit
+pass renders into an offscreen FBO (sceneFbo) which has the same size as
+the window would have had. In a normal build sceneFbo stays 0, which is
+the window's back buffer.
+
+GLEW has to be able to load its function pointers for an EGL context. A
+GLEW built with GLEW_EGL does this, and so does a GLX build running on
+libglvnd. glewInit() may still report that there is no GLX display; the
+entry points are loaded regardless.
+*/
+
+#ifndef _HEADLESS_H
+#define _HEADLESS_H
+
+#include "GLIncludes.h"
+
+//Handle to the FBO the lit pass renders into. 0 is the window's back buffer.
+GLuint sceneFbo = 0;
+
+#ifdef HEADLESS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+//Handles to the EGL objects which replace the GLFW window.
+EGLDisplay eglDisplay = EGL_NO_DISPLAY;
+EGLContext eglContext = EGL_NO_CONTEXT;
+
+//Handles to the color and depth attachments of sceneFbo.
+GLuint sceneColor;
+GLuint sceneDepth;
+
+//This function creates a OpenGL 4.3 core context which isn't attached to any surface, and makes it current.
+bool createHeadlessContext()
+{
+	// The surfaceless platform lets us create a display without talking to a window system at all.
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (getPlatformDisplay != nullptr)
+		eglDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+	if (eglDisplay == EGL_NO_DISPLAY)
+		eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+	EGLint major, minor;
+	if (eglDisplay == EGL_NO_DISPLAY || !eglInitialize(eglDisplay, &major, &minor))
+	{
+		std::cout << "Could not initialize an EGL display. \n";
+		return false;
+	}
+
+	EGLint configAttribs[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+	EGLConfig config;
+	EGLint numConfigs = 0;
+	eglChooseConfig(eglDisplay, configAttribs, &config, 1, &numConfigs);
+	// We never create a surface, so a context without a config is fine as well.
+	if (numConfigs == 0)
+		config = (EGLConfig)0;
+
+	eglBindAPI(EGL_OPENGL_API);
+
+	EGLint contextAttribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 4,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE };
+	eglContext = eglCreateContext(eglDisplay, config, EGL_NO_CONTEXT, contextAttribs);
+
+	if (eglContext == EGL_NO_CONTEXT || !eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, eglContext))
+	{
+		std::cout << "Could not create an OpenGL 4.3 context. \n";
+		return false;
+	}
+
+	return true;
+}
+
+//This function creates the offscreen FBO which stands in for the window's back buffer.
+void createOffscreenTarget(int width, int height)
+{
+	glGenFramebuffers(1, &sceneFbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, sceneFbo);
+
+	glGenRenderbuffers(1, &sceneColor);
+	glBindRenderbuffer(GL_RENDERBUFFER, sceneColor);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, sceneColor);
+
+	glGenRenderbuffers(1, &sceneDepth);
+	glBindRenderbuffer(GL_RENDERBUFFER, sceneDepth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, sceneDepth);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		std::cout << "Offscreen frame buffer not created. \n" << glCheckFramebufferStatus(GL_FRAMEBUFFER);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+//Releases the offscreen target and the EGL context.
+void destroyHeadlessContext()
+{
+	glDeleteRenderbuffers(1, &sceneColor);
+	glDeleteRenderbuffers(1, &sceneDepth);
+	glDeleteFramebuffers(1, &sceneFbo);
+
+	eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	eglDestroyContext(eglDisplay, eglContext);
+	eglTerminate(eglDisplay);
+}
+
+#endif
+
+#endif _HEADLESS_H
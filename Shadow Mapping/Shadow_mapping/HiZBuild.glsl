@@ -0,0 +1,67 @@
+/*
+Title: Shadow mapping (Hard Shadows)
+File Name: HiZBuild.glsl
+Copyright  2015
+Original authors: Srinivasan Thiagarajan
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+This compute shader builds one level of the Hi-Z pyramid (see
+HiZCulling.h). Each texel gets the farthest of the 2 x 2 depths below it.
+
+With FROM_DEPTH defined it builds level 0, reading the pre-pass' depth
+texture. Otherwise it reads the level above, bound as an image.
+
+Each invocation writes one texel.
+*/
+
+#version 430 core
+
+layout(local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+
+#ifdef FROM_DEPTH
+layout(binding = HIZ_TEXTURE_UNIT) uniform sampler2D Depth;
+#else
+layout(binding = 0, r32f) readonly uniform image2D Input;
+#endif
+
+layout(binding = 1, r32f) writeonly uniform image2D Output;
+
+float fetch(ivec2 texel)
+{
+#ifdef FROM_DEPTH
+	return texelFetch(Depth, texel, 0).r;
+#else
+	return imageLoad(Input, texel).r;
+#endif
+}
+
+void main(void)
+{
+	ivec2 size = imageSize(Output);
+	ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+	if (texel.x >= size.x || texel.y >= size.y)
+		return;
+
+	// The sizes are powers of two, so the 2 x 2 texels below are always there.
+	ivec2 source = texel * 2;
+	float farthest = max(max(fetch(source), fetch(source + ivec2(1, 0))), max(fetch(source + ivec2(0, 1)), fetch(source + ivec2(1, 1))));
+
+	imageStore(Output, texel, vec4(farthest));
+}
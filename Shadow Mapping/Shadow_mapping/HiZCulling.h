@@ -0,0 +1,175 @@
+/*
+Title: Shadow mapping (Hard Shadows)
+File Name: HiZCulling.h
+Copyright  2015
+Original authors: Srinivasan Thiagarajan
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+This file contains the Hi-Z occlusion culling of the lit pass: objects
+hidden behind nearer geometry aren't drawn.
+
+The GPU culling (see GpuCulling.h) runs in two phases for it. The first
+phase draws, into a small depth texture of our own, the objects which were
+visible last frame. They are usually most of what is visible now, so their
+depth is a good stand in for the frame's depth, and it is there before the
+lit pass has drawn anything. This pre-pass only writes depth, at a lower
+resolution than the screen, so it is cheap.
+
+From that depth a pyramid is built, like mip levels, except each texel
+holds the farthest depth below it instead of the average. A bounding
+sphere can then be tested against any part of the screen with 4 lookups,
+in the level where its rectangle covers 2 x 2 texels: if its nearest point
+is behind all of them, nothing of it can be seen.
+
+The second phase tests every object in the camera's frustum against the
+pyramid. Objects which are visible but weren't in the first phase were
+just revealed (by the camera or something else moving), and are drawn by
+the lit pass along with the first phase's. Objects which turned out to be
+hidden are left out of the next frame's first phase. Drawing last frame's
+visible objects is never wrong, since they are drawn anyway if they are
+still visible, and are only kept out of the pre-pass once they are not.
+
+References:
+Greene, Kass and Miller, Hierarchical Z-Buffer Visibility
+Haar and Aaltonen, GPU-Driven Rendering Pipelines
+*/
+
+#ifndef _HIZ_CULLING_H
+#define _HIZ_CULLING_H
+
+#include "GLIncludes.h"
+#include "GpuCulling.h"
+
+// Whether to cull the lit pass against the Hi-Z pyramid, unless it is switched at runtime (see --hiz-culling in main.cpp).
+// It needs the GPU culling.
+#ifndef HIZ_CULLING
+#define HIZ_CULLING 0
+#endif
+
+// Size of the pre-pass' depth texture. A power of two, so every level of the pyramid is exactly half of the one above.
+#define HIZ_DEPTH_SIZE 512
+
+struct HiZCulling
+{
+	bool enabled = HIZ_CULLING != 0;
+
+	GLuint depthTex = 0;		// The pre-pass' depth
+	GLuint pyramidTex = 0;		// Level n is HIZ_DEPTH_SIZE / 2^(n + 1) texels wide
+	GLuint fbo = 0;
+	GLuint program = 0;			// The pre-pass, drawing depth only
+	GLuint fromDepthProgram = 0;
+	GLuint reduceProgram = 0;
+	GLint uni_LightPV;
+	int levels;
+
+	void init()
+	{
+		glGenTextures(1, &depthTex);
+		glBindTexture(GL_TEXTURE_2D, depthTex);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, HIZ_DEPTH_SIZE, HIZ_DEPTH_SIZE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+		levels = 0;
+		while ((HIZ_DEPTH_SIZE >> (levels + 1)) > 0)
+			levels++;
+
+		glGenTextures(1, &pyramidTex);
+		glBindTexture(GL_TEXTURE_2D, pyramidTex);
+		glTexStorage2D(GL_TEXTURE_2D, levels, GL_R32F, HIZ_DEPTH_SIZE / 2, HIZ_DEPTH_SIZE / 2);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+
+		glGenFramebuffers(1, &fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTex, 0);
+		GLenum drawbuf[] = { GL_NONE };
+		glDrawBuffers(1, drawbuf);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		if (program == 0)
+			requestPrograms();
+		uni_LightPV = glGetUniformLocation(program, "LightPV");
+	}
+
+	//Requests the programs without waiting for them, so they can compile along with the others. init does it if it wasn't done before.
+	void requestPrograms()
+	{
+		// The depth pass' shaders, with the camera's matrix in the uniform meant for a spot light's.
+		std::string defines = "#define NUM_CASCADES " + std::to_string(NUM_CASCADES) + "\n#define SPOT_LIGHT_PV\n";
+		program = programCache.request("hi-z depth", addDefines(readShader("VertexShader.glsl"), defines), readShader("FragmentShader.glsl"));
+
+		std::string unit = "#define HIZ_TEXTURE_UNIT " + std::to_string(HIZ_TEXTURE_UNIT) + "\n";
+		fromDepthProgram = requestBuildProgram("hi-z from depth", unit + "#define FROM_DEPTH\n");
+		reduceProgram = requestBuildProgram("hi-z reduce", unit);
+	}
+
+	//Requests HiZBuild.glsl as a compute program with the given defines.
+	GLuint requestBuildProgram(const std::string &name, const std::string &defines)
+	{
+		return programCache.requestCompute(name, addDefines(readShader("HiZBuild.glsl"), defines));
+	}
+
+	//Draws the first phase's objects into the depth texture, builds the pyramid from it, and runs the culling's second phase.
+	//The culling's first phase has to have run, and the frameRing's objects have to be bound.
+	void update(MeshRegistry &registry, GpuCulling &culling, const glm::mat4 &cameraPV)
+	{
+		PROFILE_ZONE("hiZCulling.update");
+		glUseProgram(program);
+		glUniformMatrix4fv(uni_LightPV, 1, GL_FALSE, glm::value_ptr(cameraPV));
+
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glViewport(0, 0, HIZ_DEPTH_SIZE, HIZ_DEPTH_SIZE);
+		glCullFace(GL_BACK);
+		glClear(GL_DEPTH_BUFFER_BIT);
+		culling.drawLitDepth(registry);
+
+		// Level 0 from the depth, then every level from the one above.
+		glActiveTexture(GL_TEXTURE0 + HIZ_TEXTURE_UNIT);
+		glBindTexture(GL_TEXTURE_2D, depthTex);
+		glUseProgram(fromDepthProgram);
+		glBindImageTexture(1, pyramidTex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+		dispatch(HIZ_DEPTH_SIZE / 2);
+
+		glUseProgram(reduceProgram);
+		for (int level = 1; level < levels; level++)
+		{
+			glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+			glBindImageTexture(0, pyramidTex, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+			glBindImageTexture(1, pyramidTex, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+			dispatch(HIZ_DEPTH_SIZE >> (level + 1));
+		}
+
+		// The second phase reads the pyramid with texelFetch.
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+		glBindTexture(GL_TEXTURE_2D, pyramidTex);
+		culling.cullRevealed(cameraPV, levels, HIZ_DEPTH_SIZE);
+	}
+
+	//Runs the bound build program over a level of the given size.
+	void dispatch(int size)
+	{
+		GLuint groups = (size + 7) / 8;
+		glDispatchCompute(groups, groups, 1);
+	}
+
+}hiZCulling;
+
+#endif _HIZ_CULLING_H
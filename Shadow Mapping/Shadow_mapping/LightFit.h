@@ -0,0 +1,234 @@
+/*
+Title: Shadow mapping (Hard Shadows)
+File Name: LightFit.h
+Copyright  2015
+Original authors: Srinivasan Thiagarajan
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+This file fits the light's projection to the part of the scene which is
+actually on screen.
+
+A fixed projection has to cover everything the light could ever shine on,
+so most of the shadow map's texels (and most of its depth range) end up on
+things the camera doesn't see. Instead, every time the light, the camera
+or the scene changes, we work out what really needs shadows:
+
+- Receivers: the part of every object's bounding box which lies inside the
+  camera frustum, up to SHADOW_DISTANCE. The corners of that intersection
+  are found by clipping the faces of the frustum against the box and the
+  faces of the box against the frustum.
+- Casters: every object whose bounding sphere is inside the light frustum
+  which covers those receivers. How close it gets to the light is taken
+  from its sphere or its box, whichever is tighter. Since the light is a point, any ray from
+  it to a receiver stays inside that frustum, so nothing outside of it can
+  cast a shadow we see.
+
+The light keeps looking where it looked before. Only the sides of its
+frustum are moved in (with glm::frustum, so it can be off center), the
+near plane is pushed out to the closest caster, and the far plane is
+pulled in to the furthest receiver.
+
+If there is nothing to fit to, or the receivers reach behind the light,
+the light falls back to its default projection.
+*/
+
+#ifndef _LIGHT_FIT_H
+#define _LIGHT_FIT_H
+
+#include "GLIncludes.h"
+
+// The light's near plane is never closer than this.
+#define LIGHT_MIN_NEAR 0.1f
+// How much the fitted frustum is widened on every side, as a fraction of its size, so nothing sits right on its edge.
+#define LIGHT_FIT_MARGIN 0.02f
+
+//Fills corners with the 8 corners of the camera frustum, cut off at maxDepth (in view space) if the far plane is further away.
+//Bit 0 and 1 of the index pick the right and top side, bit 2 picks the far plane.
+void cameraFrustumCorners(const glm::mat4 &cameraView, const glm::mat4 &cameraPV, float maxDepth, glm::vec3 corners[8])
+{
+	glm::mat4 inverse = glm::inverse(cameraPV);
+	for (int i = 0; i < 8; i++)
+	{
+		glm::vec4 p = inverse * glm::vec4((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f, (i & 4) ? 1.0f : -1.0f, 1.0f);
+		corners[i] = glm::vec3(p) / p.w;
+	}
+
+	float nearDepth = -(cameraView * glm::vec4(corners[0], 1.0f)).z;
+	float farDepth = -(cameraView * glm::vec4(corners[4], 1.0f)).z;
+	if (farDepth <= maxDepth)
+		return;
+
+	// Points on a ray from the eye move linearly in view space depth.
+	float t = (maxDepth - nearDepth) / (farDepth - nearDepth);
+	for (int i = 0; i < 4; i++)
+		corners[i + 4] = corners[i] + (corners[i + 4] - corners[i]) * t;
+}
+
+//Returns the 4 corners of face f (0 to 5) of a box-like shape whose corners are indexed like BoundingBox::corner, in order around the face.
+void hexahedronFace(const glm::vec3 corners[8], int f, glm::vec3 face[4])
+{
+	// Faces 0 and 1 are the min and max x side, 2 and 3 y, 4 and 5 z. The other two axes walk around the face.
+	int axis = f / 2;
+	int side = (f % 2) << axis;
+	int a = 1 << ((axis + 1) % 3);
+	int b = 1 << ((axis + 2) % 3);
+	face[0] = corners[side];
+	face[1] = corners[side | a];
+	face[2] = corners[side | a | b];
+	face[3] = corners[side | b];
+}
+
+//Fills planes with the 6 planes around a box-like shape, as (normal, distance) with the normal pointing inside.
+void hexahedronPlanes(const glm::vec3 corners[8], glm::vec4 planes[6])
+{
+	glm::vec3 center(0.0f);
+	for (int i = 0; i < 8; i++)
+		center += corners[i] * 0.125f;
+
+	for (int f = 0; f < 6; f++)
+	{
+		glm::vec3 face[4];
+		hexahedronFace(corners, f, face);
+		glm::vec3 normal = glm::normalize(glm::cross(face[2] - face[0], face[3] - face[1]));
+		if (glm::dot(normal, center - face[0]) < 0.0f)
+			normal = -normal;
+		planes[f] = glm::vec4(normal, -glm::dot(normal, face[0]));
+	}
+}
+
+//Cuts away the part of the convex polygon on the outside of the plane.
+void clipPolygon(std::vector<glm::vec3> &polygon, const glm::vec4 &plane)
+{
+	std::vector<glm::vec3> clipped;
+	for (unsigned int i = 0; i < polygon.size(); i++)
+	{
+		const glm::vec3 &a = polygon[i];
+		const glm::vec3 &b = polygon[(i + 1) % polygon.size()];
+		float da = glm::dot(glm::vec3(plane), a) + plane.w;
+		float db = glm::dot(glm::vec3(plane), b) + plane.w;
+
+		if (da >= 0.0f)
+			clipped.push_back(a);
+		// The edge crosses the plane, so it is cut where it does.
+		if ((da >= 0.0f) != (db >= 0.0f))
+			clipped.push_back(a + (b - a) * (da / (da - db)));
+	}
+	polygon.swap(clipped);
+}
+
+//Adds the corners of the intersection of the frustum (given by its corners and planes) and the box to points.
+void intersectFrustumBox(const glm::vec3 frustum[8], const glm::vec4 frustumPlanes[6], const BoundingBox &box, std::vector<glm::vec3> &points)
+{
+	// A flat box (like the one around the plane) would make its planes cut each other's points off, so it gets a little thickness.
+	BoundingBox padded(box.min - glm::vec3(1e-3f), box.max + glm::vec3(1e-3f));
+	glm::vec3 boxCorners[8];
+	for (int i = 0; i < 8; i++)
+		boxCorners[i] = padded.corner(i);
+
+	glm::vec4 boxPlanes[6] = {
+		glm::vec4(1.0f, 0.0f, 0.0f, -padded.min.x), glm::vec4(-1.0f, 0.0f, 0.0f, padded.max.x),
+		glm::vec4(0.0f, 1.0f, 0.0f, -padded.min.y), glm::vec4(0.0f, -1.0f, 0.0f, padded.max.y),
+		glm::vec4(0.0f, 0.0f, 1.0f, -padded.min.z), glm::vec4(0.0f, 0.0f, -1.0f, padded.max.z) };
+
+	// Every corner of the intersection lies on a face of one of the two shapes, inside the other one.
+	for (int shape = 0; shape < 2; shape++)
+	{
+		const glm::vec3* corners = (shape == 0) ? frustum : boxCorners;
+		const glm::vec4* planes = (shape == 0) ? boxPlanes : frustumPlanes;
+
+		for (int f = 0; f < 6; f++)
+		{
+			glm::vec3 face[4];
+			hexahedronFace(corners, f, face);
+			std::vector<glm::vec3> polygon(face, face + 4);
+			for (int p = 0; p < 6 && !polygon.empty(); p++)
+				clipPolygon(polygon, planes[p]);
+			points.insert(points.end(), polygon.begin(), polygon.end());
+		}
+	}
+}
+
+//Fits a perspective projection, looking down the light view's -z axis, around the receiver points and the casters which can shadow them.
+//Casters are given by their bounding spheres and boxes in world space. Returns false, leaving projection alone, if it can't be fitted.
+bool fitLightProjection(const glm::mat4 &lightView, const std::vector<glm::vec3> &receivers,
+	const std::vector<glm::vec4> &casters, const std::vector<BoundingBox> &casterBoxes, glm::mat4 &projection)
+{
+	if (receivers.empty())
+		return false;
+
+	// The receivers' extent on the plane one unit in front of the light, and their depth range.
+	glm::vec2 tanMin(1e9f), tanMax(-1e9f);
+	float nearPlane = 1e9f, farPlane = 0.0f;
+	for (unsigned int i = 0; i < receivers.size(); i++)
+	{
+		glm::vec3 p = glm::vec3(lightView * glm::vec4(receivers[i], 1.0f));
+		float depth = -p.z;
+		if (depth < LIGHT_MIN_NEAR)
+			return false;
+
+		tanMin = glm::min(tanMin, glm::vec2(p) / depth);
+		tanMax = glm::max(tanMax, glm::vec2(p) / depth);
+		nearPlane = std::min(nearPlane, depth);
+		farPlane = std::max(farPlane, depth);
+	}
+
+	glm::vec2 margin = (tanMax - tanMin) * LIGHT_FIT_MARGIN + 1e-4f;
+	tanMin -= margin;
+	tanMax += margin;
+	farPlane *= 1.0f + LIGHT_FIT_MARGIN;
+
+	// Pull the near plane in to the closest caster inside the frustum.
+	glm::vec2 angleMin(atanf(tanMin.x), atanf(tanMin.y));
+	glm::vec2 angleMax(atanf(tanMax.x), atanf(tanMax.y));
+	for (unsigned int i = 0; i < casters.size(); i++)
+	{
+		glm::vec3 center = glm::vec3(lightView * glm::vec4(glm::vec3(casters[i]), 1.0f));
+		float radius = casters[i].w;
+
+		// Entirely behind the light.
+		if (center.z - radius >= 0.0f)
+			continue;
+
+		// A caster reaching past the light's plane can't be bounded by angles, so it just counts as inside.
+		if (-center.z > radius)
+		{
+			// The angles the sphere covers around the light, on the xz and yz planes.
+			float halfAngle = asinf(std::min(radius / glm::length(center), 1.0f));
+			glm::vec2 angle(atan2f(center.x, -center.z), atan2f(center.y, -center.z));
+			if (angle.x - halfAngle > angleMax.x || angle.x + halfAngle < angleMin.x
+				|| angle.y - halfAngle > angleMax.y || angle.y + halfAngle < angleMin.y)
+				continue;
+		}
+
+		// Both the sphere and the box are around the caster, so the caster is at least as far away as the further of their closest points.
+		// The box is much tighter for flat casters like the plane, whose sphere can even contain the light.
+		float boxDepth = 1e9f;
+		for (int c = 0; c < 8; c++)
+			boxDepth = std::min(boxDepth, -(lightView * glm::vec4(casterBoxes[i].corner(c), 1.0f)).z);
+
+		nearPlane = std::min(nearPlane, std::max(-center.z - radius, boxDepth));
+	}
+	nearPlane = std::max(nearPlane * (1.0f - LIGHT_FIT_MARGIN), LIGHT_MIN_NEAR);
+
+	projection = glm::frustum(tanMin.x * nearPlane, tanMax.x * nearPlane, tanMin.y * nearPlane, tanMax.y * nearPlane, nearPlane, farPlane);
+	return true;
+}
+
+#endif _LIGHT_FIT_H
@@ -51,18 +51,142 @@ OpenGL 4 Shading language Cookbook
 
 layout(location = 0) out vec4 Color; // Establishes the variable we will pass out of this shader.
 
-layout (binding = 0) uniform sampler2DShadow ShadowMap;
+layout (binding = 0) uniform sampler2DArrayShadow ShadowMap;	// One layer per cascade
+#if SHADOW_MOMENTS
+layout (binding = 1) uniform sampler2DArray MomentMap;		// The blurred moments of the same layers, see MomentShadows.h
+#endif
+layout (binding = 3) uniform sampler2DShadow ShadowAtlas;		// The shadows of all the spot lights, see ShadowAtlas.h
+#ifdef POINT_SHADOWS
+layout (binding = 2) uniform samplerCubeShadow PointShadowMap;	// Distance to the light over the far plane, in every direction, see PointShadows.h
+#endif
  
 in vec3 Position;
 in vec3 Normal;
 in vec4 Albedo;
-in vec4 ShadowCoord;
+in vec3 WorldPosition;
 
-uniform struct PointLight
+// Same block as in LightVertexShader.glsl, we need the light and the cascades from it.
+layout(std140) uniform FrameConstants
+{
+	mat4 PV;
+	mat4 ViewMatrix;
+	mat4 CascadePV[NUM_CASCADES];
+	vec4 CascadeSplits;
+	vec4 LightPosition;
+	vec4 LightIntensity;
+};
+
+// The spot lights which can be seen this frame. See SpotLightData in FrameRing.h for the C++ side.
+struct SpotLight
+{
+	vec4 positionRange;		// Position, and the distance at which the light fades out
+	vec4 directionCos;		// Direction, and the cosine of half the cone's angle
+	vec4 color;				// Intensity, w is 1 if the light has a tile in the atlas
+	mat4 shadowMatrix;		// World space to the light's tile in the atlas
+};
+
+layout(std430) readonly buffer SpotLights
+{
+	uvec4 SpotLightCount;	// Only x is used
+	SpotLight spotLights[];
+};
+
+struct PointLight
 {
 	vec3 position;
 	vec3 Intensity;
-}pointLight;
+};
+
+PointLight pointLight;
+
+// The filter kernels, see ShadowFilter.h. PCF_KERNEL and its settings are added by the program when it compiles this shader.
+#define PCF_NONE 0
+#define PCF_HARDWARE 1
+#define PCF_GRID 2
+#define PCF_POISSON 3
+
+#ifndef PCF_KERNEL
+#define PCF_KERNEL PCF_NONE
+#endif
+
+#ifndef SHADOW_MOMENTS
+#define SHADOW_MOMENTS 0
+#endif
+
+#if PCF_KERNEL == PCF_POISSON
+// 16 points spread over the unit disk, no two of them too close to each other.
+const vec2 PoissonDisk[16] = vec2[](
+	vec2(-0.94201624, -0.39906216), vec2(0.94558609, -0.76890725),
+	vec2(-0.09418410, -0.92938870), vec2(0.34495938, 0.29387760),
+	vec2(-0.91588581, 0.45771432), vec2(-0.81544232, -0.87912464),
+	vec2(-0.38277543, 0.27676845), vec2(0.97484398, 0.75648379),
+	vec2(0.44323325, -0.97511554), vec2(0.53742981, -0.47373420),
+	vec2(-0.26496911, -0.41893023), vec2(0.79197514, 0.19090188),
+	vec2(-0.24188840, 0.99706507), vec2(-0.81409955, 0.91437590),
+	vec2(0.19984126, 0.78641367), vec2(0.14383161, -0.14100790));
+#endif
+
+// Compares depth against the shadow map around uv in the given layer, and returns how much of the area around it is lit.
+float filterShadow(vec2 uv, float layer, float depth)
+{
+	// Every lookup takes the layer in the third component and the depth to compare against in the fourth.
+#if PCF_KERNEL == PCF_GRID
+	vec2 texel = 1.0f / vec2(textureSize(ShadowMap, 0).xy);
+	float lit = 0.0f;
+	// The loop counts are constants, so the compiler unrolls them.
+	for (int y = 0; y < PCF_GRID_SIZE; y++)
+	{
+		for (int x = 0; x < PCF_GRID_SIZE; x++)
+		{
+			vec2 offset = vec2(x, y) - 0.5f * float(PCF_GRID_SIZE - 1);
+			lit += texture(ShadowMap, vec4(uv + offset * texel, layer, depth));
+		}
+	}
+	return lit / float(PCF_GRID_SIZE * PCF_GRID_SIZE);
+#elif PCF_KERNEL == PCF_POISSON
+	vec2 texel = 1.0f / vec2(textureSize(ShadowMap, 0).xy);
+	// A different rotation of the disk for every pixel, from a hash of its position.
+	float angle = 6.2831853f * fract(sin(dot(gl_FragCoord.xy, vec2(12.9898f, 78.233f))) * 43758.5453f);
+	mat2 rotation = mat2(cos(angle), sin(angle), -sin(angle), cos(angle));
+	float lit = 0.0f;
+	for (int i = 0; i < PCF_POISSON_TAPS; i++)
+		lit += texture(ShadowMap, vec4(uv + rotation * PoissonDisk[i] * PCF_RADIUS * texel, layer, depth));
+	return lit / float(PCF_POISSON_TAPS);
+#else
+	// With PCF_HARDWARE the texture is filtered linearly, so this one lookup already blends 4 comparisons.
+	return texture(ShadowMap, vec4(uv, layer, depth));
+#endif
+}
+
+// Adds up the light of every spot light reaching the fragment, each one shadowed with its tile of the atlas.
+// This is done in world space, since that's where the lights are.
+vec3 spotLighting(vec3 worldNormal, vec3 diff)
+{
+	vec3 total = vec3(0.0f);
+	for (uint i = 0u; i < SpotLightCount.x; i++)
+	{
+		vec3 toLight = spotLights[i].positionRange.xyz - WorldPosition;
+		float distance = length(toLight);
+		vec3 s = toLight / distance;
+		float cosAngle = dot(-s, spotLights[i].directionCos.xyz);
+		if (distance > spotLights[i].positionRange.w || cosAngle < spotLights[i].directionCos.w)
+			continue;
+
+		// Fade out towards the edge of the cone and the end of the range.
+		float cone = smoothstep(spotLights[i].directionCos.w, mix(spotLights[i].directionCos.w, 1.0f, 0.2f), cosAngle);
+		float falloff = 1.0f - distance / spotLights[i].positionRange.w;
+
+		float lit = 1.0f;
+		if (spotLights[i].color.w > 0.0f)
+		{
+			vec4 coord = spotLights[i].shadowMatrix * vec4(WorldPosition, 1.0f);
+			lit = texture(ShadowAtlas, coord.xyz / coord.w);
+		}
+
+		total += spotLights[i].color.rgb * diff * max(dot(s, worldNormal), 0.0f) * cone * falloff * falloff * lit;
+	}
+	return total;
+}
 
 // calculate the light's component in coloring the fragment
 vec3 diffuseModel (vec3 pos, vec3 norm, vec3 diff)
@@ -74,14 +198,84 @@ vec3 diffuseModel (vec3 pos, vec3 norm, vec3 diff)
 	return diffuse;
 }
 
+#if SHADOW_MOMENTS
+// Chebyshev's upper bound on the part of the filtered area which is at least as far away as depth, from its first two moments.
+float chebyshev(vec2 moments, float depth, float minVariance)
+{
+	if (depth <= moments.x)
+		return 1.0f;
+
+	float variance = max(moments.y - moments.x * moments.x, minVariance);
+	float d = depth - moments.x;
+	float lit = variance / (variance + d * d);
+
+	// The bound is loose where shadows overlap, which shows up as light leaking. Cutting off the low end hides most of it.
+	return clamp((lit - VSM_LIGHT_BLEED_REDUCTION) / (1.0f - VSM_LIGHT_BLEED_REDUCTION), 0.0f, 1.0f);
+}
+
+// Same as filterShadow, using the moment map. It has already been blurred, so one trilinear lookup is enough.
+float momentShadow(vec2 uv, float layer, float depth)
+{
+	vec4 moments = texture(MomentMap, vec3(uv, layer));
+#if SHADOW_MOMENTS == 2
+	// Warp the depth the same way MomentBlur.glsl did, and take the darker of the two bounds.
+	float warped = depth * 2.0f - 1.0f;
+	float positive = exp(EVSM_POSITIVE_EXPONENT * warped);
+	float negative = -exp(-EVSM_NEGATIVE_EXPONENT * warped);
+	// The minimum variance has to grow with the warp's slope, or it would mean nothing after warping.
+	float positiveMin = VSM_MIN_VARIANCE * EVSM_POSITIVE_EXPONENT * positive * EVSM_POSITIVE_EXPONENT * positive;
+	float negativeMin = VSM_MIN_VARIANCE * EVSM_NEGATIVE_EXPONENT * negative * EVSM_NEGATIVE_EXPONENT * negative;
+	return min(chebyshev(moments.xy, positive, positiveMin), chebyshev(moments.zw, negative, negativeMin));
+#else
+	return chebyshev(moments.xy, depth, VSM_MIN_VARIANCE);
+#endif
+}
+#endif
+
+// Looks the fragment up in the first cascade which reaches as far as the fragment, and returns 1 if it is lit and 0 if it is in shadow.
+float shadowFactor()
+{
+#ifdef POINT_SHADOWS
+	// The cube map is looked up by the direction from the light, and stores the distance divided by the far plane in LightPosition.w.
+	vec3 fromLight = WorldPosition - LightPosition.xyz;
+	return texture(PointShadowMap, vec4(fromLight, length(fromLight) / LightPosition.w - POINT_SHADOW_BIAS));
+#endif
+
+	// Position is in view space, where the camera looks down -z.
+	float depth = -Position.z;
+	int cascade = 0;
+	while (cascade < NUM_CASCADES && depth > CascadeSplits[cascade])
+		cascade++;
+
+	// Beyond the last cascade there is no shadow map, so everything is lit.
+	if (cascade == NUM_CASCADES)
+		return 1.0f;
+
+	// Same as the bias matrix: clip coordinates (-1 to 1) to texture coordinates (0 to 1).
+	vec4 coord = CascadePV[cascade] * vec4(WorldPosition, 1.0f);
+	coord.xyz = coord.xyz / coord.w * 0.5f + 0.5f;
+
+#if SHADOW_MOMENTS
+	return momentShadow(coord.xy, float(cascade), coord.z);
+#else
+	return filterShadow(coord.xy, float(cascade), coord.z);
+#endif
+}
+
 void main(void)
 {
+	pointLight = PointLight(LightPosition.xyz, LightIntensity.xyz);
+
 	//Set the ambient light value. Models in shadow would be only lit by ambient light
 	vec3 Ambient = Albedo.xyz * 0.2f;
 	//We had set the texture properties to compare_to_ref
 	// So when we sample the texture, it compare it with the current depth value and returns
 	// 1 if the point is closer than the one on the texture, else it returns 0.
-	float shadow = textureProj(ShadowMap, ShadowCoord);
+	// The filter averages several of these, so at the edge of a shadow we get values in between.
+	float shadow = shadowFactor();
+
+	// Normal is in view space. The view matrix is a rotation, so its transpose turns it back.
+	vec3 spots = spotLighting(normalize(transpose(mat3(ViewMatrix)) * Normal), Albedo.xyz);
 
-	Color = vec4((diffuseModel(Position, Normal, Albedo.xyz) * shadow) + Ambient, 1.0f);
+	Color = vec4((diffuseModel(Position, Normal, Albedo.xyz) * shadow) + spots + Ambient, 1.0f);
 }
\ No newline at end of file
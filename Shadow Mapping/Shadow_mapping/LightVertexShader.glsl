@@ -50,27 +50,70 @@ OpenGL 4 Shading language Cookbook
 #version 430 core // Identifies the version of the shader, this line must be on a separate line from the rest of the shader code
  
 layout(location = 0) in vec3 in_position;	// Get in a vec3 for position
+#ifdef OCTAHEDRAL_NORMALS
+layout(location = 1) in vec2 in_normal;		// Octahedral encoded normal, see VertexPacking.h
+#else
 layout(location = 1) in vec3 in_normal;
+#endif
 layout(location = 2) in vec4 in_color;		// Get in a vec4 for color
+layout(location = 3) in uint in_objectID;	// Index of the object being drawn, read once per instance
 
 out vec3 Position;
 out vec3 Normal;
 out vec4 Albedo;
-out vec4 ShadowCoord;
+out vec3 WorldPosition;
 
-uniform mat4 MVP;
-uniform mat4 ModelViewMatrix;
-uniform mat3 NormalMatrix;
-uniform mat4 ShadowMatrix;
+// Filled once per frame from the frameRing. See FrameConstants in FrameRing.h for the C++ side.
+layout(std140) uniform FrameConstants
+{
+	mat4 PV;
+	mat4 ViewMatrix;
+	mat4 CascadePV[NUM_CASCADES];	// Light projection * light view, cropped to each cascade
+	vec4 CascadeSplits;				// View space depth at which each cascade ends
+	vec4 LightPosition;
+	vec4 LightIntensity;
+};
+
+struct Object
+{
+	mat4 model;
+	mat4 normalMatrix;		// Inverse transpose of the model matrix, only the upper 3x3 is used
+	vec4 color;				// The material's color
+};
+
+// Every object drawn this frame. in_objectID picks ours.
+layout(std430) readonly buffer Objects
+{
+	Object objects[];
+};
+
+#ifdef OCTAHEDRAL_NORMALS
+// Unfolds the square back onto the octahedron, and the octahedron back onto the unit sphere.
+vec3 decodeNormal(vec2 e)
+{
+	vec3 n = vec3(e, 1.0f - abs(e.x) - abs(e.y));
+	if (n.z < 0.0f)
+		n.xy = (1.0f - abs(n.yx)) * vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+	return normalize(n);
+}
+#else
+vec3 decodeNormal(vec3 n)
+{
+	return n;
+}
+#endif
 
 void main(void)
 {
+	vec4 worldPosition = objects[in_objectID].model * vec4(in_position, 1.0f);
+
 	// Forward data to fragment shader
-	Position = (ModelViewMatrix * vec4(in_position,1.0f)).xyz;
-	Normal = NormalMatrix * in_normal;
-	Albedo = in_color;
-	// Convert the coordinates from model space to clip coordinates from the perspective of the light source.
-	ShadowCoord = ShadowMatrix * vec4(in_position, 1.0f);
+	Position = (ViewMatrix * worldPosition).xyz;
+	// The view matrix is only a rotation and translation, so its upper 3x3 is its own inverse transpose.
+	Normal = mat3(ViewMatrix) * mat3(objects[in_objectID].normalMatrix) * decodeNormal(in_normal);
+	Albedo = in_color * objects[in_objectID].color;
+	// The fragment shader picks the cascade, and converts this to the light's clip coordinates with its matrix.
+	WorldPosition = worldPosition.xyz;
 
-	gl_Position = MVP * vec4(in_position, 1.0f);
+	gl_Position = PV * worldPosition;
 }
\ No newline at end of file
@@ -0,0 +1,100 @@
+/*
+Title: Shadow mapping (Hard Shadows)
+File Name: MomentBlur.glsl
+Copyright  2015
+Original authors: Srinivasan Thiagarajan
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+This compute shader turns the shadow map's depth into moments and blurs
+them, one direction per dispatch (see MomentShadows.h).
+
+With FROM_DEPTH defined it runs the first, horizontal, pass: every tap reads
+a depth from the depth texture, converts it to its moments and adds them
+up with a gaussian weight. The moments have to be computed before they are
+averaged; the average of depths would just be a blurry depth.
+
+Without FROM_DEPTH it runs the second, vertical, pass over the result of
+the first, and writes the final moment map.
+
+Each invocation handles one texel of one layer (cascade).
+*/
+
+#version 430 core
+
+layout(local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+
+#ifdef FROM_DEPTH
+// The depth texture, bound through a sampler object which turns off the depth comparison.
+layout(binding = 0) uniform sampler2DArray DepthMap;
+#else
+layout(binding = 0, rgba32f) readonly uniform image2DArray Input;
+#endif
+
+layout(binding = 1, rgba32f) writeonly uniform image2DArray Output;
+
+// (1, 0) for the horizontal pass, (0, 1) for the vertical one.
+uniform ivec2 Direction;
+
+// The moments of a depth between 0 and 1.
+vec4 computeMoments(float depth)
+{
+#if SHADOW_MOMENTS == 2
+	// EVSM: warp the depth to -1 to 1, then exponentially, once growing and once shrinking with depth.
+	float warped = depth * 2.0f - 1.0f;
+	float positive = exp(EVSM_POSITIVE_EXPONENT * warped);
+	float negative = -exp(-EVSM_NEGATIVE_EXPONENT * warped);
+	return vec4(positive, positive * positive, negative, negative * negative);
+#else
+	// VSM: the mean and the mean of the square. The variance is the difference of the second and the square of the first.
+	return vec4(depth, depth * depth, 0.0f, 0.0f);
+#endif
+}
+
+vec4 fetch(ivec3 texel)
+{
+#ifdef FROM_DEPTH
+	return computeMoments(texelFetch(DepthMap, texel, 0).r);
+#else
+	return imageLoad(Input, texel);
+#endif
+}
+
+void main(void)
+{
+	ivec3 size = imageSize(Output);
+	ivec3 texel = ivec3(gl_GlobalInvocationID);
+	if (texel.x >= size.x || texel.y >= size.y)
+		return;
+
+	// Gaussian weights, with the radius at about 2 standard deviations.
+	float sigma = max(float(MOMENT_BLUR_RADIUS) * 0.5f, 0.5f);
+	vec4 sum = vec4(0.0f);
+	float weights = 0.0f;
+	for (int i = -MOMENT_BLUR_RADIUS; i <= MOMENT_BLUR_RADIUS; i++)
+	{
+		// Texels past the edge repeat the one on the edge.
+		ivec2 xy = clamp(texel.xy + Direction * i, ivec2(0), size.xy - 1);
+		float weight = exp(-float(i * i) / (2.0f * sigma * sigma));
+		sum += fetch(ivec3(xy, texel.z)) * weight;
+		weights += weight;
+	}
+
+	imageStore(Output, texel, sum / weights);
+}
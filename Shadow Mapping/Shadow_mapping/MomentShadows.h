@@ -0,0 +1,223 @@
+/*
+Title: Shadow mapping (Hard Shadows)
+File Name: MomentShadows.h
+Copyright  2015
+Original authors: Srinivasan Thiagarajan
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+This file contains the moment shadow map, used by the VSM and EVSM
+filters (see ShadowFilter.h).
+
+A depth shadow map can't be blurred or mipmapped: an average of depths
+says nothing about how much of the area is in front of a fragment. Variance
+shadow maps store the moments of the depth (the depth and its square)
+instead, and those can be averaged. From the averaged moments, the lit pass
+gets the mean and the variance of the depths around the fragment, and
+Chebyshev's inequality gives an upper bound of how much of that area is
+lit. So a single filtered lookup gives a soft shadow, and the filtering
+happens once per shadow map texel instead of once per shaded fragment.
+
+The depth pass (and the shadow map cache) stay as they are. Whenever the
+shadow map changed, update() runs MomentBlur.glsl twice:
+
+1. Horizontally: read the depth, convert it to moments, blur, and write
+   into blurTex.
+2. Vertically: blur blurTex into momentTex.
+
+Then the mip levels of momentTex are generated, so the lit pass can use
+trilinear filtering on distant receivers.
+
+References:
+Donnelly and Lauritzen, Variance Shadow Maps
+Lauritzen and McCool, Layered Variance Shadow Maps
+*/
+
+#ifndef _MOMENT_SHADOWS_H
+#define _MOMENT_SHADOWS_H
+
+#include "GLIncludes.h"
+#include "ShadowFilter.h"
+
+// The texture unit the lit pass reads the moments from. Unit 0 has the depth texture.
+#define MOMENT_TEXTURE_UNIT 1
+
+struct MomentShadowMap
+{
+	GLuint momentTex = 0;		// The blurred moments, one layer per cascade, with mip levels
+	GLuint blurTex = 0;			// The result of the horizontal pass
+	GLuint depthSampler = 0;	// Reads the depth texture as plain values, without comparing
+	GLuint horizontalProgram = 0;
+	GLuint verticalProgram = 0;
+	GLint uni_HorizontalDirection;
+	GLint uni_VerticalDirection;
+
+	ShadowMoments moments = MOMENTS_NONE;
+	int size;
+	int layers;
+
+	// Programs requested for a filter which isn't in use yet (see requestPrograms), and the defines they were made with.
+	GLuint requestedHorizontal = 0;
+	GLuint requestedVertical = 0;
+	std::string requestedDefines;
+
+	//Requests MomentBlur.glsl as a compute program with the given defines.
+	GLuint requestBlurProgram(const std::string &name, const std::string &defines)
+	{
+		return programCache.requestCompute(name, addDefines(readShader("MomentBlur.glsl"), defines));
+	}
+
+	//Requests the programs for the filter's moments without waiting for them, so they can compile while the
+	//current filter is still in use. init uses them once it is called for the same moments.
+	void requestPrograms(const ShadowFilter &filter)
+	{
+		releaseRequested();
+		if (filter.moments == MOMENTS_NONE)
+			return;
+
+		requestedDefines = filter.momentDefines();
+		requestedHorizontal = requestBlurProgram("moment blur horizontal", "#define FROM_DEPTH\n" + requestedDefines);
+		requestedVertical = requestBlurProgram("moment blur vertical", requestedDefines);
+	}
+
+	//Returns whether the requested programs are ready (or there are none).
+	bool programsReady()
+	{
+		return programCache.ready(requestedHorizontal) && programCache.ready(requestedVertical);
+	}
+
+	void releaseRequested()
+	{
+		if (requestedHorizontal != 0)
+			programCache.release(requestedHorizontal);
+		if (requestedVertical != 0)
+			programCache.release(requestedVertical);
+		requestedHorizontal = requestedVertical = 0;
+		requestedDefines.clear();
+	}
+
+	//Creates the textures and programs for the given kind of moments. Anything made for a previous kind is released first.
+	void init(int iSize, int iLayers, const ShadowFilter &filter)
+	{
+		destroy();
+		moments = filter.moments;
+		size = iSize;
+		layers = iLayers;
+		if (moments == MOMENTS_NONE)
+			return;
+
+		// As many mip levels as it takes to get down to 1x1.
+		int levels = 1;
+		while ((size >> levels) > 0)
+			levels++;
+
+		glGenTextures(1, &momentTex);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, momentTex);
+		// EVSM's exponentials need the range of 32 bit floats.
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, GL_RGBA32F, size, size, layers);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+
+		// Outside the map everything is lit, so the border holds the moments of the far plane (a depth of 1).
+		glm::vec4 border(1.0f, 1.0f, 0.0f, 0.0f);
+		if (moments == MOMENTS_EVSM)
+			border = glm::vec4(exp(EVSM_POSITIVE_EXPONENT), exp(2.0f * EVSM_POSITIVE_EXPONENT),
+				-exp(-EVSM_NEGATIVE_EXPONENT), exp(-2.0f * EVSM_NEGATIVE_EXPONENT));
+		glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, glm::value_ptr(border));
+
+		glGenTextures(1, &blurTex);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, blurTex);
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGBA32F, size, size, layers);
+
+		glGenSamplers(1, &depthSampler);
+		glSamplerParameteri(depthSampler, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+		glSamplerParameteri(depthSampler, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glSamplerParameteri(depthSampler, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+		// Both are requested before either one's uniform is looked up, so they compile together. If requestPrograms
+		// already asked for them, they may well be done.
+		if (requestedHorizontal == 0 || requestedDefines != filter.momentDefines())
+			requestPrograms(filter);
+		horizontalProgram = requestedHorizontal;
+		verticalProgram = requestedVertical;
+		requestedHorizontal = requestedVertical = 0;
+		requestedDefines.clear();
+		uni_HorizontalDirection = glGetUniformLocation(horizontalProgram, "Direction");
+		uni_VerticalDirection = glGetUniformLocation(verticalProgram, "Direction");
+	}
+
+	//Converts the depth texture into blurred, mipmapped moments. Call whenever the depth texture changed.
+	void update(GLuint depthTex)
+	{
+		if (moments == MOMENTS_NONE)
+			return;
+
+		GLuint groups = (size + 7) / 8;
+
+		glUseProgram(horizontalProgram);
+		glUniform2i(uni_HorizontalDirection, 1, 0);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, depthTex);
+		glBindSampler(0, depthSampler);
+		glBindImageTexture(1, blurTex, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+		glDispatchCompute(groups, groups, layers);
+		glBindSampler(0, 0);
+
+		// The second pass reads what the first one wrote through an image.
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+		glUseProgram(verticalProgram);
+		glUniform2i(uni_VerticalDirection, 0, 1);
+		glBindImageTexture(0, blurTex, 0, GL_TRUE, 0, GL_READ_ONLY, GL_RGBA32F);
+		glBindImageTexture(1, momentTex, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+		glDispatchCompute(groups, groups, layers);
+
+		// The mipmaps and the lit pass read the moments as a texture.
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, momentTex);
+		glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+	}
+
+	//Binds the moments for the lit pass.
+	void bind()
+	{
+		if (moments == MOMENTS_NONE)
+			return;
+
+		glActiveTexture(GL_TEXTURE0 + MOMENT_TEXTURE_UNIT);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, momentTex);
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	void destroy()
+	{
+		glDeleteTextures(1, &momentTex);
+		glDeleteTextures(1, &blurTex);
+		glDeleteSamplers(1, &depthSampler);
+		programCache.release(horizontalProgram);
+		programCache.release(verticalProgram);
+		momentTex = blurTex = depthSampler = horizontalProgram = verticalProgram = 0;
+		moments = MOMENTS_NONE;
+	}
+
+}momentShadowMap;
+
+#endif _MOMENT_SHADOWS_H
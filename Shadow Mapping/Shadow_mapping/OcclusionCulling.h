@@ -0,0 +1,522 @@
+/*
+Title: Shadow mapping (Hard Shadows)
+File Name: OcclusionCulling.h
+Copyright  2015
+Original authors: Srinivasan Thiagarajan
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+This file contains a depth rasterizer which runs on the CPU, used to skip
+objects hidden behind others before anything is sent to the GPU.
+
+A few meshes are marked as occluders: big, solid things which hide a lot.
+Every frame their triangles are drawn from the camera into a small depth
+buffer (OCCLUSION_WIDTH x OCCLUSION_HEIGHT), which only stores the depth
+of the closest occluder in each pixel. Then the bounding sphere of every
+object is projected onto the same buffer. If the sphere's closest point is
+further away than the occluders everywhere it covers, the object can't be
+seen and isn't drawn.
+
+Both steps err on the side of drawing: only pixels which the occluder
+covers completely are written, each one gets the furthest depth the
+triangle has anywhere in the pixel, and triangles crossing the near plane
+are left out. So an object is only culled if it really is hidden.
+
+A pixel whose center is inside a triangle can still stick out of the
+occluder, where its outline crosses the pixel. So the edges on the outline
+(those not shared with another triangle of the occluder facing the same
+way) are moved in by half a pixel, and the pixels right around a vertex on
+the outline aren't written either. The edges between the occluder's own
+triangles are left alone: moving those in as well would leave a line of
+empty pixels across every occluder. What can still slip through is a
+sliver of an occluder thinner than a pixel.
+
+The buffer is split into tiles of OCCLUSION_TILE x OCCLUSION_TILE pixels.
+The triangles are sorted into the tiles they touch (binning), and then the
+tiles are rasterized at the same time on several threads, since no two of
+them write the same pixels. The threads are started once by init() and
+wait for the next frame's tiles in between. Each tile also keeps its furthest depth, so a
+sphere behind it can skip the tile without looking at its pixels.
+
+Inside a tile, 4 pixels are done at once with SSE: the three edge functions
+and the depth are planes in screen space, so each of them is a multiply and
+add for all 4 pixels, and the pixels inside the triangle are picked with a
+mask. Without SSE the same is done one pixel at a time.
+
+None of this uses OpenGL, so it can be run and timed on machines without a
+GPU (see --occlusion-benchmark in main.cpp), and it is tested on its own by
+Tests/OcclusionCullingTest.cpp.
+*/
+
+#ifndef _OCCLUSION_CULLING_H
+#define _OCCLUSION_CULLING_H
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "glm/glm.hpp"
+#include "CpuProfiler.h"
+
+// SSE2 is part of every x86-64 CPU.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OCCLUSION_SSE 1
+#include <emmintrin.h>
+#else
+#define OCCLUSION_SSE 0
+#endif
+
+// Set to 0 to draw every object, hidden or not.
+#ifndef OCCLUSION_CULLING
+#define OCCLUSION_CULLING 1
+#endif
+
+// Size of the depth buffer. Both have to be multiples of the tile size.
+#define OCCLUSION_WIDTH 256
+#define OCCLUSION_HEIGHT 256
+// Size of a tile. A multiple of 4, so each row of a tile is a whole number of SSE groups.
+#define OCCLUSION_TILE 64
+// Triangles with a vertex closer to the camera than this (in clip space w) are left out.
+#define OCCLUSION_NEAR 0.01f
+
+// A triangle set up for rasterizing: three edge functions a * x + b * y + c, which are all >= 0 inside the triangle,
+// the depth plane, the pixels it can cover, and its vertices on the occluder's outline, around which it writes nothing.
+struct OccluderTriangle
+{
+	float edgeA[3], edgeB[3], edgeC[3];
+	float depthA, depthB, depthC;
+	int minX, minY, maxX, maxY;
+	float cornerX[3], cornerY[3];
+	int corners;
+};
+
+struct DepthRasterizer
+{
+	// Closest occluder depth of every pixel, from 0 (near plane) to 1 (far plane), row by row.
+	std::vector<float> depth;
+	// Furthest depth of each tile.
+	std::vector<float> tileMax;
+
+	std::vector<OccluderTriangle> triangles;
+	// Indices into triangles, for each tile.
+	std::vector<std::vector<int>> bins;
+
+	glm::mat4 PV;
+
+	// How many threads rasterize the tiles, and whether they use SSE. Both can be changed to compare them,
+	// but no more threads are used than init() started.
+	int threads;
+	bool simd = OCCLUSION_SSE != 0;
+
+	// The threads which rasterize tiles along with the one calling rasterize(). Worker w does tile w, w + count and so on,
+	// the calling thread being worker 0.
+	std::vector<std::thread> workers;
+	std::mutex poolMutex;
+	std::condition_variable wake, finished;
+	int job = 0;		// Counts the calls to rasterize(), so the workers know there is a new one
+	int jobThreads = 1;	// How many threads share the tiles of the current call
+	int busy = 0;		// Workers which haven't finished the current call
+	bool stopping = false;
+
+	// Statistics of the last frame.
+	int trianglesDrawn;
+	int objectsTested;
+	int objectsOccluded;
+
+	static const int tilesX = OCCLUSION_WIDTH / OCCLUSION_TILE;
+	static const int tilesY = OCCLUSION_HEIGHT / OCCLUSION_TILE;
+
+	DepthRasterizer()
+	{
+		depth.resize(OCCLUSION_WIDTH * OCCLUSION_HEIGHT);
+		tileMax.resize(tilesX * tilesY);
+		bins.resize(tilesX * tilesY);
+		threads = std::max(1, std::min((int)std::thread::hardware_concurrency(), tilesX * tilesY));
+	}
+
+	~DepthRasterizer()
+	{
+		{
+			std::lock_guard<std::mutex> lock(poolMutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (unsigned int w = 0; w < workers.size(); w++)
+			workers[w].join();
+	}
+
+	//Starts the worker threads, one less than threads since the calling thread takes part. Call once.
+	void init()
+	{
+		for (int w = 1; w < threads; w++)
+			workers.push_back(std::thread(&DepthRasterizer::work, this, w));
+	}
+
+	//What a worker thread does: waits for a call to rasterize(), does its share of the tiles, and waits again.
+	void work(int w)
+	{
+		int lastJob = 0;
+		while (true)
+		{
+			int count;
+			{
+				std::unique_lock<std::mutex> lock(poolMutex);
+				wake.wait(lock, [&]() { return stopping || job != lastJob; });
+				if (stopping)
+					return;
+				lastJob = job;
+				count = jobThreads;
+			}
+
+			for (int i = w; w < count && i < tilesX * tilesY; i += count)
+				rasterizeTile(i);
+
+			std::lock_guard<std::mutex> lock(poolMutex);
+			if (--busy == 0)
+				finished.notify_one();
+		}
+	}
+
+	//Starts a new frame, seen through the camera's projection * view.
+	void begin(const glm::mat4 &cameraPV)
+	{
+		PV = cameraPV;
+		triangles.clear();
+		for (unsigned int i = 0; i < bins.size(); i++)
+			bins[i].clear();
+		trianglesDrawn = 0;
+		objectsTested = 0;
+		objectsOccluded = 0;
+	}
+
+	//Transforms a point to clip space, 4 components at once with SSE.
+	static glm::vec4 transform(const glm::mat4 &m, const glm::vec3 &p)
+	{
+#if OCCLUSION_SSE
+		__m128 result = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&m[0][0]), _mm_set1_ps(p.x)), _mm_mul_ps(_mm_loadu_ps(&m[1][0]), _mm_set1_ps(p.y))),
+			_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&m[2][0]), _mm_set1_ps(p.z)), _mm_loadu_ps(&m[3][0])));
+		glm::vec4 out;
+		_mm_storeu_ps(&out[0], result);
+		return out;
+#else
+		return m * glm::vec4(p, 1.0f);
+#endif
+	}
+
+	//Sets up the triangles of an occluder placed with the given model matrix, and sorts them into the tiles they touch.
+	void addOccluder(const std::vector<glm::vec3> &positions, const std::vector<unsigned int> &indices, const glm::mat4 &model)
+	{
+		glm::mat4 matrix = PV * model;
+
+		// Every vertex in screen space (x and y in pixels, z from 0 to 1), or w <= OCCLUSION_NEAR if it's too close.
+		std::vector<glm::vec4> screen(positions.size());
+		for (unsigned int i = 0; i < positions.size(); i++)
+		{
+			glm::vec4 clip = transform(matrix, positions[i]);
+			if (clip.w <= OCCLUSION_NEAR)
+			{
+				screen[i] = glm::vec4(0.0f);
+				continue;
+			}
+			screen[i] = glm::vec4((clip.x / clip.w * 0.5f + 0.5f) * OCCLUSION_WIDTH, (clip.y / clip.w * 0.5f + 0.5f) * OCCLUSION_HEIGHT,
+				clip.z / clip.w * 0.5f + 0.5f, clip.w);
+		}
+
+		// Which way each triangle faces on screen: 1 counter clockwise, -1 clockwise, 0 if it isn't drawn.
+		std::vector<int> facing(indices.size() / 3);
+		for (unsigned int k = 0; k < facing.size(); k++)
+		{
+			const glm::vec4 &v0 = screen[indices[3 * k]], &v1 = screen[indices[3 * k + 1]], &v2 = screen[indices[3 * k + 2]];
+			float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+			if (v0.w <= OCCLUSION_NEAR || v1.w <= OCCLUSION_NEAR || v2.w <= OCCLUSION_NEAR || fabs(area) < 1e-6f)
+				facing[k] = 0;
+			else
+				facing[k] = area > 0.0f ? 1 : -1;
+		}
+
+		// Every edge of every drawn triangle, by its two vertices and the way the triangle faces. An edge which is there
+		// twice is between two triangles facing the same way, and so inside the occluder's outline.
+		std::vector<std::pair<unsigned long long, int>> edges;
+		for (unsigned int k = 0; k < facing.size(); k++)
+			if (facing[k] != 0)
+				for (int e = 0; e < 3; e++)
+					edges.push_back(std::make_pair(edgeKey(indices[3 * k + e], indices[3 * k + (e + 1) % 3]), facing[k]));
+		std::sort(edges.begin(), edges.end());
+		auto onOutline = [&](unsigned int a, unsigned int b, int side)
+		{
+			auto range = std::equal_range(edges.begin(), edges.end(), std::make_pair(edgeKey(a, b), side));
+			return range.second - range.first < 2;
+		};
+
+		std::vector<bool> outlineVertex(positions.size(), false);
+		for (unsigned int k = 0; k < facing.size(); k++)
+		{
+			for (int e = 0; e < 3; e++)
+			{
+				unsigned int a = indices[3 * k + e], b = indices[3 * k + (e + 1) % 3];
+				if (facing[k] != 0 && onOutline(a, b, facing[k]))
+					outlineVertex[a] = outlineVertex[b] = true;
+			}
+		}
+
+		for (unsigned int i = 0; i + 2 < indices.size(); i += 3)
+		{
+			int side = facing[i / 3];
+			if (side == 0)
+				continue;
+
+			// Both windings are drawn, so the triangle is turned around if needed to make the area positive.
+			unsigned int id[3] = { indices[i], indices[i + 1], indices[i + 2] };
+			if (side < 0)
+				std::swap(id[1], id[2]);
+			glm::vec4 v[3] = { screen[id[0]], screen[id[1]], screen[id[2]] };
+			float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[1].y - v[0].y) * (v[2].x - v[0].x);
+
+			OccluderTriangle t;
+			t.minX = std::max(0, (int)floor(std::min(v[0].x, std::min(v[1].x, v[2].x))));
+			t.minY = std::max(0, (int)floor(std::min(v[0].y, std::min(v[1].y, v[2].y))));
+			t.maxX = std::min(OCCLUSION_WIDTH - 1, (int)ceil(std::max(v[0].x, std::max(v[1].x, v[2].x))));
+			t.maxY = std::min(OCCLUSION_HEIGHT - 1, (int)ceil(std::max(v[0].y, std::max(v[1].y, v[2].y))));
+			if (t.minX > t.maxX || t.minY > t.maxY)
+				continue;
+
+			// Edge i goes from vertex i to the next one, and is positive on the side of the third. An edge on the outline is
+			// moved in by half a pixel (along x and y), so it is only positive at the centers of pixels completely inside it.
+			t.corners = 0;
+			for (int e = 0; e < 3; e++)
+			{
+				const glm::vec4 &from = v[e], &to = v[(e + 1) % 3];
+				t.edgeA[e] = from.y - to.y;
+				t.edgeB[e] = to.x - from.x;
+				t.edgeC[e] = -t.edgeA[e] * from.x - t.edgeB[e] * from.y;
+				if (onOutline(id[e], id[(e + 1) % 3], side))
+					t.edgeC[e] -= 0.5f * (fabs(t.edgeA[e]) + fabs(t.edgeB[e]));
+
+				if (outlineVertex[id[e]])
+				{
+					t.cornerX[t.corners] = from.x;
+					t.cornerY[t.corners] = from.y;
+					t.corners++;
+				}
+			}
+
+			// Depth divided by w is linear in screen space, so it is a plane as well.
+			float dzdx = ((v[1].z - v[0].z) * (v[2].y - v[0].y) - (v[2].z - v[0].z) * (v[1].y - v[0].y)) / area;
+			float dzdy = ((v[2].z - v[0].z) * (v[1].x - v[0].x) - (v[1].z - v[0].z) * (v[2].x - v[0].x)) / area;
+			t.depthA = dzdx;
+			t.depthB = dzdy;
+			// Moved back by half a pixel's worth of slope, so the pixel center gets the furthest depth in the pixel.
+			t.depthC = v[0].z - dzdx * v[0].x - dzdy * v[0].y + 0.5f * (fabs(dzdx) + fabs(dzdy));
+
+			int index = triangles.size();
+			triangles.push_back(t);
+			for (int ty = t.minY / OCCLUSION_TILE; ty <= t.maxY / OCCLUSION_TILE; ty++)
+				for (int tx = t.minX / OCCLUSION_TILE; tx <= t.maxX / OCCLUSION_TILE; tx++)
+					bins[ty * tilesX + tx].push_back(index);
+		}
+	}
+
+	//Returns the same number for the edge from a to b as for the edge from b to a.
+	static unsigned long long edgeKey(unsigned int a, unsigned int b)
+	{
+		return ((unsigned long long)std::min(a, b) << 32) | std::max(a, b);
+	}
+
+	//Draws the triangles of one tile, and finds its furthest depth.
+	void rasterizeTile(int tile)
+	{
+		PROFILE_ZONE("rasterizeTile");
+		int tileX = (tile % tilesX) * OCCLUSION_TILE;
+		int tileY = (tile / tilesX) * OCCLUSION_TILE;
+
+		for (int y = tileY; y < tileY + OCCLUSION_TILE; y++)
+			std::fill(depth.begin() + y * OCCLUSION_WIDTH + tileX, depth.begin() + y * OCCLUSION_WIDTH + tileX + OCCLUSION_TILE, 1.0f);
+
+		const std::vector<int> &bin = bins[tile];
+		for (unsigned int i = 0; i < bin.size(); i++)
+		{
+			const OccluderTriangle &t = triangles[bin[i]];
+			// Start at a multiple of 4, so the groups of 4 never cross into the next tile.
+			int x0 = std::max(t.minX, tileX) & ~3;
+			int x1 = std::min(t.maxX, tileX + OCCLUSION_TILE - 1);
+			int y0 = std::max(t.minY, tileY);
+			int y1 = std::min(t.maxY, tileY + OCCLUSION_TILE - 1);
+
+			for (int y = y0; y <= y1; y++)
+			{
+				float py = y + 0.5f;
+				float* row = &depth[y * OCCLUSION_WIDTH];
+
+				// The outline vertices this row passes within a pixel of. The pixels within a pixel of them are left out.
+				float cornerX[3];
+				int corners = 0;
+				for (int c = 0; c < t.corners; c++)
+					if (fabs(py - t.cornerY[c]) < 1.0f)
+						cornerX[corners++] = t.cornerX[c];
+#if OCCLUSION_SSE
+				if (simd)
+				{
+					__m128 centers = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+					__m128 zero = _mm_setzero_ps();
+					// The y part of each plane is the same for the whole row.
+					__m128 a0 = _mm_set1_ps(t.edgeA[0]), a1 = _mm_set1_ps(t.edgeA[1]), a2 = _mm_set1_ps(t.edgeA[2]), az = _mm_set1_ps(t.depthA);
+					__m128 c0 = _mm_set1_ps(t.edgeB[0] * py + t.edgeC[0]), c1 = _mm_set1_ps(t.edgeB[1] * py + t.edgeC[1]);
+					__m128 c2 = _mm_set1_ps(t.edgeB[2] * py + t.edgeC[2]), cz = _mm_set1_ps(t.depthB * py + t.depthC);
+					for (int x = x0; x <= x1; x += 4)
+					{
+						__m128 px = _mm_add_ps(_mm_set1_ps((float)x), centers);
+						__m128 inside = _mm_and_ps(_mm_and_ps(
+							_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a0, px), c0), zero),
+							_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a1, px), c1), zero)),
+							_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a2, px), c2), zero));
+						for (int c = 0; c < corners; c++)
+						{
+							// The distance along x, without its sign bit.
+							__m128 distance = _mm_andnot_ps(_mm_set1_ps(-0.0f), _mm_sub_ps(px, _mm_set1_ps(cornerX[c])));
+							inside = _mm_andnot_ps(_mm_cmplt_ps(distance, _mm_set1_ps(1.0f)), inside);
+						}
+						__m128 old = _mm_loadu_ps(row + x);
+						__m128 z = _mm_min_ps(old, _mm_add_ps(_mm_mul_ps(az, px), cz));
+						// Where inside is all ones take the new depth, elsewhere keep the old one.
+						_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, z), _mm_andnot_ps(inside, old)));
+					}
+					continue;
+				}
+#endif
+				// The y part is added the same way as above, so both paths write exactly the same depths.
+				float c0 = t.edgeB[0] * py + t.edgeC[0], c1 = t.edgeB[1] * py + t.edgeC[1], c2 = t.edgeB[2] * py + t.edgeC[2];
+				float cz = t.depthB * py + t.depthC;
+				for (int x = x0; x <= x1; x++)
+				{
+					float px = x + 0.5f;
+					bool inside = t.edgeA[0] * px + c0 >= 0.0f && t.edgeA[1] * px + c1 >= 0.0f && t.edgeA[2] * px + c2 >= 0.0f;
+					for (int c = 0; c < corners; c++)
+						inside = inside && fabs(px - cornerX[c]) >= 1.0f;
+					if (inside)
+						row[x] = std::min(row[x], t.depthA * px + cz);
+				}
+			}
+		}
+
+		float furthest = 0.0f;
+		for (int y = tileY; y < tileY + OCCLUSION_TILE; y++)
+			for (int x = tileX; x < tileX + OCCLUSION_TILE; x++)
+				furthest = std::max(furthest, depth[y * OCCLUSION_WIDTH + x]);
+		tileMax[tile] = furthest;
+	}
+
+	//Draws all the occluders added since begin(), spreading the tiles over the threads.
+	void rasterize()
+	{
+		PROFILE_ZONE("rasterize");
+		trianglesDrawn = triangles.size();
+		int tiles = tilesX * tilesY;
+		int count = std::max(1, std::min(threads, (int)workers.size() + 1));
+		if (count == 1)
+		{
+			for (int i = 0; i < tiles; i++)
+				rasterizeTile(i);
+			return;
+		}
+
+		// Every worker wakes up, and those past count have nothing to do.
+		{
+			std::lock_guard<std::mutex> lock(poolMutex);
+			jobThreads = count;
+			busy = workers.size();
+			job++;
+		}
+		wake.notify_all();
+
+		for (int i = 0; i < tiles; i += count)
+			rasterizeTile(i);
+
+		std::unique_lock<std::mutex> lock(poolMutex);
+		finished.wait(lock, [&]() { return busy == 0; });
+	}
+
+	//Returns whether the bounding sphere is hidden behind the occluders everywhere it covers.
+	bool occluded(const glm::vec4 &sphere)
+	{
+		objectsTested++;
+
+		// The corners of the cube around the sphere. Its outline on screen and its closest depth contain the sphere's.
+		float minX = 1e9f, minY = 1e9f, maxX = -1e9f, maxY = -1e9f, nearest = 1.0f;
+		for (int i = 0; i < 8; i++)
+		{
+			glm::vec3 corner = glm::vec3(sphere) + sphere.w * glm::vec3((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f, (i & 4) ? 1.0f : -1.0f);
+			glm::vec4 clip = transform(PV, corner);
+			// Too close to the camera to say.
+			if (clip.w <= OCCLUSION_NEAR)
+				return false;
+			float x = (clip.x / clip.w * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+			float y = (clip.y / clip.w * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+			minX = std::min(minX, x);
+			maxX = std::max(maxX, x);
+			minY = std::min(minY, y);
+			maxY = std::max(maxY, y);
+			nearest = std::min(nearest, clip.z / clip.w * 0.5f + 0.5f);
+		}
+
+		// Whether something off screen is visible is up to the frustum, not us.
+		int x0 = std::max(0, (int)floor(minX)), x1 = std::min(OCCLUSION_WIDTH - 1, (int)ceil(maxX));
+		int y0 = std::max(0, (int)floor(minY)), y1 = std::min(OCCLUSION_HEIGHT - 1, (int)ceil(maxY));
+		if (x0 > x1 || y0 > y1)
+			return false;
+
+		for (int ty = y0 / OCCLUSION_TILE; ty <= y1 / OCCLUSION_TILE; ty++)
+		{
+			for (int tx = x0 / OCCLUSION_TILE; tx <= x1 / OCCLUSION_TILE; tx++)
+			{
+				// The whole tile is in front of the sphere.
+				if (nearest > tileMax[ty * tilesX + tx])
+					continue;
+
+				int rx0 = std::max(x0, tx * OCCLUSION_TILE), rx1 = std::min(x1, tx * OCCLUSION_TILE + OCCLUSION_TILE - 1);
+				int ry0 = std::max(y0, ty * OCCLUSION_TILE), ry1 = std::min(y1, ty * OCCLUSION_TILE + OCCLUSION_TILE - 1);
+				for (int y = ry0; y <= ry1; y++)
+				{
+					const float* row = &depth[y * OCCLUSION_WIDTH];
+					int x = rx0;
+#if OCCLUSION_SSE
+					if (simd)
+					{
+						// Any of 4 pixels at least as far as the sphere means it shows through there.
+						__m128 sphereDepth = _mm_set1_ps(nearest);
+						for (; x + 3 <= rx1; x += 4)
+							if (_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(row + x), sphereDepth)) != 0)
+								return false;
+					}
+#endif
+					for (; x <= rx1; x++)
+						if (row[x] >= nearest)
+							return false;
+				}
+			}
+		}
+
+		objectsOccluded++;
+		return true;
+	}
+
+}occlusionCulling;
+
+#endif _OCCLUSION_CULLING_H
@@ -0,0 +1,41 @@
+/*
+Title: Shadow mapping (Hard Shadows)
+File Name: PointShadowFrag.glsl
+Copyright  2015
+Original authors: Srinivasan Thiagarajan
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+This fragment shader writes the point light's cube shadow map. Instead of
+the depth along each face's view direction, it stores the distance to the
+light divided by the far plane. That way the lit pass can compare against
+the same value whichever face it ends up reading.
+*/
+
+#version 430 core
+
+in vec3 WorldPosition;
+
+// xyz is the light's position, w the far plane of the cube map.
+uniform vec4 LightPositionFar;
+
+void main(void)
+{
+	gl_FragDepth = length(WorldPosition - LightPositionFar.xyz) / LightPositionFar.w;
+}
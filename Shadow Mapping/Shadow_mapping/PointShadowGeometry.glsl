@@ -0,0 +1,51 @@
+/*
+Title: Shadow mapping (Hard Shadows)
+File Name: PointShadowGeometry.glsl
+Copyright  2015
+Original authors: Srinivasan Thiagarajan
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+Only used when the driver can't set gl_Layer in the vertex shader. It
+passes every triangle through unchanged, and sends it to the face of the
+cube map PointShadowVertex.glsl picked for it.
+*/
+
+#version 430 core
+
+layout(triangles) in;
+layout(triangle_strip, max_vertices = 3) out;
+
+in vec3 vWorldPosition[];
+flat in int vFace[];
+
+out vec3 WorldPosition;
+
+void main(void)
+{
+	for (int i = 0; i < 3; i++)
+	{
+		gl_Position = gl_in[i].gl_Position;
+		WorldPosition = vWorldPosition[i];
+		// All three vertices come from the same instance, so they agree on the face.
+		gl_Layer = vFace[0];
+		EmitVertex();
+	}
+	EndPrimitive();
+}
@@ -0,0 +1,79 @@
+/*
+Title: Shadow mapping (Hard Shadows)
+File Name: PointShadowVertex.glsl
+Copyright  2015
+Original authors: Srinivasan Thiagarajan
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+This vertex shader renders the point light's cube shadow map (see
+PointShadows.h). Every instance is one object drawn into one face of the
+cube, so a single draw call can fill all six faces.
+
+With VERTEX_LAYER defined, the vertex shader picks the face itself by
+writing gl_Layer (GL_AMD_vertex_shader_layer). Otherwise it hands the face
+on to PointShadowGeometry.glsl, which does it instead.
+*/
+
+#version 430 core
+#ifdef VERTEX_LAYER
+#extension GL_AMD_vertex_shader_layer : require
+#endif
+
+layout(location = 0) in vec3 in_position;
+layout(location = 3) in uint in_objectFace;	// Index of the object * 8 + the face to draw it into, read once per instance
+
+// Projection * view of each face, looking from the light along +x, -x, +y, -y, +z and -z.
+uniform mat4 FacePV[6];
+
+struct Object
+{
+	mat4 model;
+	mat4 normalMatrix;
+	vec4 color;
+};
+
+layout(std430) readonly buffer Objects
+{
+	Object objects[];
+};
+
+#ifdef VERTEX_LAYER
+out vec3 WorldPosition;
+#else
+out vec3 vWorldPosition;
+flat out int vFace;
+#endif
+
+void main(void)
+{
+	uint object = in_objectFace >> 3;
+	int face = int(in_objectFace & 7u);
+
+	vec4 worldPosition = objects[object].model * vec4(in_position, 1.0f);
+	gl_Position = FacePV[face] * worldPosition;
+
+#ifdef VERTEX_LAYER
+	WorldPosition = worldPosition.xyz;
+	gl_Layer = face;
+#else
+	vWorldPosition = worldPosition.xyz;
+	vFace = face;
+#endif
+}
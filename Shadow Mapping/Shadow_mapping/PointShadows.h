@@ -0,0 +1,271 @@
+/*
+Title: Shadow mapping (Hard Shadows)
+File Name: PointShadows.h
+Copyright  2015
+Original authors: Srinivasan Thiagarajan
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+This file contains the cube shadow map of the point light.
+
+The cascades only cover what is below the light, inside one frustum, so a
+caster anywhere else casts nothing. A point light shines in every
+direction, so its shadow map is a cube map: six faces, each a 90 degree
+frustum looking along one axis.
+
+Rendering six faces one after the other takes six passes over the scene.
+Instead, every (object, face) pair which needs drawing is written to a
+buffer, one number per pair, and each mesh draws all of its pairs with one
+instanced draw command, all of them submitted together. The pair buffer is the per-instance attribute, so each
+instance knows which object to draw and into which face, and sends its
+triangles to that layer of the cube map with gl_Layer.
+
+Which pairs get drawn is decided by culling every object's bounding sphere
+against the four side planes of every face, so an object only lands in the
+faces it can actually be seen in.
+
+The six pass way is kept as well, for comparison (see --cube-benchmark in
+main.cpp): it attaches one face at a time and draws that face's pairs.
+*/
+
+#ifndef _POINT_SHADOWS_H
+#define _POINT_SHADOWS_H
+
+#include "GLIncludes.h"
+#include "FrustumCulling.h"
+#include "Scene.h"
+
+// Size of each face of the cube map.
+#define POINT_SHADOW_SIZE 512
+// Near plane of the faces.
+#define POINT_SHADOW_NEAR 0.05f
+// The texture unit the lit pass reads the cube map from.
+#define POINT_SHADOW_TEXTURE_UNIT 2
+
+struct PointShadowMap
+{
+	GLuint cubeTex = 0;
+	GLuint fbo = 0;
+	GLuint program = 0;
+	GLuint pairBuffer = 0;
+	GLint uni_FacePV;
+	GLint uni_LightPositionFar;
+
+	// Whether the vertex shader can set gl_Layer. If not, a geometry shader does it.
+	bool vertexLayer;
+
+	// Draw all faces in one call. Otherwise one pass per face.
+	bool singlePass = true;
+
+	glm::vec3 position;
+	float farPlane = 1.0f;
+	glm::mat4 facePV[6];
+
+	// A vao reading the meshes' shared positions and indices, and the pair buffer.
+	GLuint vao = 0;
+	std::vector<DrawCommand> commands;
+
+	// The (object, face) pairs to draw, ordered by mesh and then by face, and where each mesh's and face's pairs start.
+	std::vector<GLuint> pairs;
+	std::vector<int> faceStart;
+
+	// Statistics of the last render.
+	int pairsDrawn;
+	int drawCalls;
+
+	//Requests the program without waiting for it, so it can compile along with the others. init does it if it wasn't done before.
+	void requestPrograms()
+	{
+		vertexLayer = GLEW_AMD_vertex_shader_layer != 0;
+		std::string defines = vertexLayer ? "#define VERTEX_LAYER\n" : "";
+
+		// Without the extension, a geometry shader sends each triangle to its face instead.
+		std::string geometrySource = vertexLayer ? "" : readShader("PointShadowGeometry.glsl");
+		program = programCache.request("point shadows", addDefines(readShader("PointShadowVertex.glsl"), defines), readShader("PointShadowFrag.glsl"), geometrySource);
+	}
+
+	void init()
+	{
+		glGenTextures(1, &cubeTex);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, cubeTex);
+		glTexStorage2D(GL_TEXTURE_CUBE_MAP, 1, GL_DEPTH_COMPONENT32, POINT_SHADOW_SIZE, POINT_SHADOW_SIZE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_FUNC, GL_LESS);
+
+		glGenFramebuffers(1, &fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		GLenum drawbuf[] = { GL_NONE };
+		glDrawBuffers(1, drawbuf);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		glGenBuffers(1, &pairBuffer);
+
+		if (program == 0)
+			requestPrograms();
+		uni_FacePV = glGetUniformLocation(program, "FacePV");
+		uni_LightPositionFar = glGetUniformLocation(program, "LightPositionFar");
+	}
+
+	//Points the faces at the light's position, and pushes the far plane out to the furthest object.
+	void updateMatrices(const glm::vec3 &lightPosition, const std::vector<glm::vec4> &bounds)
+	{
+		position = lightPosition;
+		farPlane = POINT_SHADOW_NEAR * 2.0f;
+		for (unsigned int i = 0; i < bounds.size(); i++)
+			farPlane = std::max(farPlane, glm::length(glm::vec3(bounds[i]) - position) + bounds[i].w);
+
+		// The directions and up vectors the cube map faces are defined with, in the order of GL_TEXTURE_CUBE_MAP_POSITIVE_X onwards.
+		static const glm::vec3 directions[6] = { glm::vec3(1, 0, 0), glm::vec3(-1, 0, 0), glm::vec3(0, 1, 0), glm::vec3(0, -1, 0), glm::vec3(0, 0, 1), glm::vec3(0, 0, -1) };
+		static const glm::vec3 ups[6] = { glm::vec3(0, -1, 0), glm::vec3(0, -1, 0), glm::vec3(0, 0, 1), glm::vec3(0, 0, -1), glm::vec3(0, -1, 0), glm::vec3(0, -1, 0) };
+
+		// 90 degrees, so the six faces meet exactly.
+		glm::mat4 projection = glm::perspective(1.5707963f, 1.0f, POINT_SHADOW_NEAR, farPlane);
+		for (int f = 0; f < 6; f++)
+			facePV[f] = projection * glm::lookAt(position, position + directions[f], ups[f]);
+	}
+
+	//Returns whether the bounding sphere can be seen in the given face.
+	bool sphereInFace(int face, const glm::vec4 &sphere)
+	{
+		glm::vec3 center = glm::vec3(sphere) - position;
+		if (glm::length(center) - sphere.w > farPlane)
+			return false;
+
+		// The face looks along axis a, and is bounded by the planes at 45 degrees between it and the other two axes.
+		int a = face / 2;
+		float forward = (face % 2 == 0) ? center[a] : -center[a];
+		float b = center[(a + 1) % 3];
+		float c = center[(a + 2) % 3];
+		// The distance of the center from each side plane is (forward -+ b) / sqrt(2), and it's inside if that is at least -radius.
+		float margin = -sphere.w * 1.41421356f;
+		return forward - b >= margin && forward + b >= margin && forward - c >= margin && forward + c >= margin;
+	}
+
+	//Creates the vao on first use: the registry's position stream and index buffer, and the pair buffer as attribute 3.
+	GLuint pairVao(MeshRegistry &registry)
+	{
+		if (vao != 0)
+			return vao;
+
+		glGenVertexArrays(1, &vao);
+		registry.initDepthVao(vao);
+		registry.setObjectIDPointer(pairBuffer);
+		glBindVertexArray(0);
+		return vao;
+	}
+
+	//Draws the pairs from faceStart[m * 6 + firstFace] to faceStart[m * 6 + lastFace] of every mesh m, with one command per mesh.
+	void drawFaces(MeshRegistry &registry, int firstFace, int lastFace)
+	{
+		commands.clear();
+		for (unsigned int m = 0; m < registry.meshes.size(); m++)
+		{
+			int first = faceStart[m * 6 + firstFace], count = faceStart[m * 6 + lastFace] - first;
+			if (count > 0)
+				commands.push_back(registry.meshes[m].base.command(count, first));
+		}
+
+		int calls = registry.drawCalls;
+		registry.submit(pairVao(registry), commands);
+		drawCalls += registry.drawCalls - calls;
+	}
+
+	//Culls every object of the registry against every face, and uploads the pairs which are left.
+	//scene.objectBounds and the meshes' ranges in the object array have to be from this frame.
+	void buildPairs(MeshRegistry &registry, const Scene &scene)
+	{
+		pairs.clear();
+		faceStart.assign(registry.meshes.size() * 6 + 1, 0);
+
+		for (unsigned int m = 0; m < registry.meshes.size(); m++)
+		{
+			Mesh &mesh = registry.meshes[m];
+			for (int f = 0; f < 6; f++)
+			{
+				faceStart[m * 6 + f] = pairs.size();
+				for (int i = mesh.firstInstance; i < mesh.firstInstance + mesh.staticCount + mesh.dynamicCount; i++)
+				{
+					if (sphereInFace(f, scene.objectBounds[i]))
+						pairs.push_back(i * 8 + f);
+					else
+						cullingStats.shadowCulled++;
+					cullingStats.shadowTested++;
+				}
+			}
+		}
+		faceStart[registry.meshes.size() * 6] = pairs.size();
+
+		glBindBuffer(GL_ARRAY_BUFFER, pairBuffer);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(GLuint) * std::max((int)pairs.size(), 1), pairs.empty() ? nullptr : &pairs[0], GL_STREAM_DRAW);
+	}
+
+	//Renders the cube map with the matrices from updateMatrices. The frameRing's objects have to be bound.
+	void render(MeshRegistry &registry, const Scene &scene)
+	{
+		PROFILE_ZONE("pointShadowMap.render");
+		buildPairs(registry, scene);
+
+		glUseProgram(program);
+		glUniformMatrix4fv(uni_FacePV, 6, GL_FALSE, glm::value_ptr(facePV[0]));
+		glUniform4f(uni_LightPositionFar, position.x, position.y, position.z, farPlane);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glViewport(0, 0, POINT_SHADOW_SIZE, POINT_SHADOW_SIZE);
+		// Unlike the cascades, the cube map keeps the faces turned towards the light. The spheres rest on the plane, so
+		// right below them their back faces are about as far from the light as the plane is, and the plane would
+		// come out lit in the middle of their shadows. The lit faces are kept off themselves by POINT_SHADOW_BIAS.
+		glCullFace(GL_BACK);
+
+		pairsDrawn = pairs.size();
+		drawCalls = 0;
+		if (singlePass)
+		{
+			// All six faces are attached, and gl_Layer picks one per instance.
+			glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, cubeTex, 0);
+			glClear(GL_DEPTH_BUFFER_BIT);
+			drawFaces(registry, 0, 6);
+		}
+		else
+		{
+			// One face at a time. The framebuffer isn't layered now, so the gl_Layer the shader writes is ignored.
+			for (int f = 0; f < 6; f++)
+			{
+				glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + f, cubeTex, 0);
+				glClear(GL_DEPTH_BUFFER_BIT);
+				drawFaces(registry, f, f + 1);
+			}
+		}
+	}
+
+	//Binds the cube map for the lit pass.
+	void bind()
+	{
+		glActiveTexture(GL_TEXTURE0 + POINT_SHADOW_TEXTURE_UNIT);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, cubeTex);
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+}pointShadowMap;
+
+#endif _POINT_SHADOWS_H
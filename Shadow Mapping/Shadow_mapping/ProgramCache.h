@@ -0,0 +1,446 @@
+/*
+Title: Shadow mapping (Hard Shadows)
+File Name: ProgramCache.h
+Copyright  2015
+Original authors: Srinivasan Thiagarajan
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+This file contains the program cache: it makes every shader program, lets
+the driver compile them in parallel, and saves them to disk so later runs
+don't have to compile them again.
+
+Compiling and linking GLSL is slow, and it happens again on every launch,
+for every variant of every shader. After a program is linked from source,
+the driver is asked for the program in its own binary form
+(glGetProgramBinary), and that is written to a file in PROGRAM_CACHE_DIR.
+The next time the same program is asked for, the binary is handed back to
+the driver with glProgramBinary and nothing is compiled.
+
+A binary is only good for the exact same source, and the exact same
+driver. So the file's name is a hash of the source of every stage
+(defines included, since they are inserted into the source) and of the
+GL vendor, renderer and version strings. A new driver or an edited shader
+gives a new name, and the old file is just never read again. The driver
+may still refuse a binary, for instance after an update which didn't
+change its version string. Then the program is compiled from source after
+all, and its file is written again.
+
+Drivers which can't give out binaries report no binary formats, and the
+cache does nothing on them.
+
+Programs which do have to be compiled are only requested: request()
+compiles and links them, but doesn't ask whether that worked, since asking
+makes the CPU wait for the answer. With GL_KHR_parallel_shader_compile (or
+the ARB version) the driver compiles on its own threads meanwhile, so all
+the programs requested before the first one is used compile at the same
+time. That is why the modules request their programs (requestPrograms)
+separately from the rest of their setup, which looks up uniforms and so
+has to wait for its program.
+
+A requested program is pending until it is finished: its compile and link
+logs checked, its binary saved, and the time from its request until it
+was found done recorded. update() finishes the pending programs which are
+done, without waiting for the others, and ready() tells whether a program
+is done, so the frame loop can keep drawing with the program it had until
+a new variant is ready (see requestShadowFilter in main.cpp). Without the
+extension there is no way to ask that without waiting, so update()
+finishes one pending program per call, and ready() waits.
+*/
+
+#ifndef _PROGRAM_CACHE_H
+#define _PROGRAM_CACHE_H
+
+#include "GLIncludes.h"
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// Whether linked programs are saved and loaded, unless it is switched at runtime.
+#ifndef PROGRAM_CACHE
+#define PROGRAM_CACHE 1
+#endif
+
+// The folder the binaries are kept in, relative to the working directory like the shader files.
+#define PROGRAM_CACHE_DIR "shader_cache"
+
+// Marks the start of a cache file, and changes if the file's layout does.
+#define PROGRAM_CACHE_MAGIC 0x31424753u
+
+// From GL_KHR_parallel_shader_compile, which our GLEW doesn't know yet. ARB_parallel_shader_compile uses the same value.
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// In BasicFunctions.h.
+GLuint createShader(std::string sourceCode, GLenum shaderType);
+bool checkShader(GLuint shader);
+
+// One stage of a program: its type, like GL_VERTEX_SHADER, and its whole source.
+struct ShaderStage
+{
+	GLenum type;
+	std::string source;
+
+	ShaderStage(GLenum iType, const std::string &iSource)
+	{
+		type = iType;
+		source = iSource;
+	}
+};
+
+// How long it took to get one program.
+struct ProgramTiming
+{
+	std::string name;
+	bool fromCache;		// Loaded from its binary rather than compiled
+	double requestMs;	// Spent in request() itself
+	double readyMs;		// From the request until the program was found done
+};
+
+struct ProgramCache
+{
+	bool enabled = PROGRAM_CACHE != 0;
+
+	// Hashed into every program's key. Read once there is a context.
+	std::string driver;
+	bool supported = false;
+	bool parallel = false;		// Whether the driver can say if a compile is done without waiting for it
+	bool initialized = false;
+
+	// A program which was compiled and linked, and hasn't been finished yet.
+	struct PendingProgram
+	{
+		GLuint program;
+		std::vector<GLuint> shaders;
+		unsigned long long key;		// 0 if it isn't saved
+		int timing;					// Its entry in timings
+		std::chrono::high_resolution_clock::time_point start;
+	};
+	std::vector<PendingProgram> pending;
+
+	// What happened to the programs asked for so far, and how long each one took.
+	int loaded = 0;
+	int compiled = 0;
+	int rejected = 0;
+	std::vector<ProgramTiming> timings;
+
+	//Reads the driver's strings, whether it can give out binaries at all, and whether it compiles in parallel.
+	void init()
+	{
+		initialized = true;
+		driver = std::string((const char*)glGetString(GL_VENDOR)) + "\n" + (const char*)glGetString(GL_RENDERER) + "\n"
+			+ (const char*)glGetString(GL_VERSION) + "\n" + (const char*)glGetString(GL_SHADING_LANGUAGE_VERSION) + "\n";
+
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		supported = formats > 0;
+
+		// The number of compiler threads starts out unlimited, so there is nothing to set, only to find.
+		GLint extensions = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &extensions);
+		for (int i = 0; i < extensions; i++)
+		{
+			std::string name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+			if (name == "GL_KHR_parallel_shader_compile" || name == "GL_ARB_parallel_shader_compile")
+				parallel = true;
+		}
+
+		if (enabled)
+		{
+#ifdef _WIN32
+			_mkdir(PROGRAM_CACHE_DIR);
+#else
+			mkdir(PROGRAM_CACHE_DIR, 0755);
+#endif
+		}
+	}
+
+	//Returns the 64 bit FNV-1a hash of the driver and of every stage.
+	unsigned long long key(const std::vector<ShaderStage> &stages)
+	{
+		unsigned long long hash = 14695981039346656037ULL;
+		auto add = [&](const std::string &text)
+		{
+			for (unsigned int i = 0; i < text.size(); i++)
+			{
+				hash ^= (unsigned char)text[i];
+				hash *= 1099511628211ULL;
+			}
+		};
+
+		add(driver);
+		for (unsigned int i = 0; i < stages.size(); i++)
+		{
+			add(std::to_string(stages[i].type) + "\n");
+			add(stages[i].source);
+		}
+		return hash;
+	}
+
+	std::string fileName(unsigned long long programKey)
+	{
+		std::ostringstream name;
+		name << PROGRAM_CACHE_DIR << "/" << std::hex << std::setw(16) << std::setfill('0') << programKey << ".bin";
+		return name.str();
+	}
+
+	//Returns a program made of the given stages, loaded from its binary if there is one. Otherwise it is compiled
+	//and linked, but not waited for: it can be used right away (the driver waits if it has to), and is pending until finished.
+	GLuint request(const std::string &name, const std::vector<ShaderStage> &stages)
+	{
+		PROFILE_ZONE("programCache.request");
+		auto start = std::chrono::high_resolution_clock::now();
+		if (!initialized)
+			init();
+
+		ProgramTiming timing;
+		timing.name = name;
+		unsigned long long programKey = (enabled && supported) ? key(stages) : 0;
+
+		GLuint program = programKey != 0 ? load(programKey) : 0;
+		timing.fromCache = program != 0;
+		if (program != 0)
+			loaded++;
+		else
+		{
+			PendingProgram compiling;
+			compiling.program = program = glCreateProgram();
+			for (unsigned int i = 0; i < stages.size(); i++)
+			{
+				compiling.shaders.push_back(createShader(stages[i].source, stages[i].type));
+				glAttachShader(program, compiling.shaders[i]);
+			}
+
+			// Tell the driver we will ask for the binary.
+			if (programKey != 0)
+				glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+			glLinkProgram(program);
+
+			compiling.key = programKey;
+			compiling.timing = timings.size();
+			compiling.start = start;
+			pending.push_back(compiling);
+			compiled++;
+		}
+
+		timing.requestMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		timing.readyMs = timing.requestMs;
+		timings.push_back(timing);
+		return program;
+	}
+
+	//Returns a program of a vertex and a fragment shader, and a geometry shader if its source isn't empty. See request.
+	GLuint request(const std::string &name, const std::string &vertexSource, const std::string &fragmentSource, const std::string &geometrySource = "")
+	{
+		std::vector<ShaderStage> stages;
+		stages.push_back(ShaderStage(GL_VERTEX_SHADER, vertexSource));
+		if (!geometrySource.empty())
+			stages.push_back(ShaderStage(GL_GEOMETRY_SHADER, geometrySource));
+		stages.push_back(ShaderStage(GL_FRAGMENT_SHADER, fragmentSource));
+		return request(name, stages);
+	}
+
+	//Returns a program of a single compute shader. See request.
+	GLuint requestCompute(const std::string &name, const std::string &computeSource)
+	{
+		return request(name, std::vector<ShaderStage>(1, ShaderStage(GL_COMPUTE_SHADER, computeSource)));
+	}
+
+	//Returns whether the program is done. If it is, it is finished. Without parallel compiles, this waits until it is done.
+	bool ready(GLuint program)
+	{
+		for (unsigned int i = 0; i < pending.size(); i++)
+		{
+			if (pending[i].program != program)
+				continue;
+
+			if (parallel && !done(pending[i]))
+				return false;
+			finish(i);
+			return true;
+		}
+		return true;
+	}
+
+	//Finishes the pending programs which are done, without waiting. Called once a frame.
+	void update()
+	{
+		if (pending.empty())
+			return;
+
+		PROFILE_ZONE("programCache.update");
+		if (!parallel)
+		{
+			// Only the oldest one, so a frame doesn't wait for all of them.
+			finish(0);
+			return;
+		}
+
+		for (unsigned int i = 0; i < pending.size(); )
+		{
+			if (done(pending[i]))
+				finish(i);
+			else
+				i++;
+		}
+	}
+
+	//Deletes the program, which may still be pending. Its request doesn't get a ready time.
+	void release(GLuint program)
+	{
+		for (unsigned int i = 0; i < pending.size(); i++)
+			if (pending[i].program == program)
+			{
+				for (unsigned int s = 0; s < pending[i].shaders.size(); s++)
+					glDeleteShader(pending[i].shaders[s]);
+				pending.erase(pending.begin() + i);
+				break;
+			}
+		glDeleteProgram(program);
+	}
+
+	//Waits for every pending program, and finishes them.
+	void finishAll()
+	{
+		while (!pending.empty())
+			finish(0);
+	}
+
+	//Returns whether the driver is done with the program's compile and link. Only asked with parallel compiles.
+	bool done(const PendingProgram &compiling)
+	{
+		GLint complete = GL_FALSE;
+		glGetProgramiv(compiling.program, GL_COMPLETION_STATUS_KHR, &complete);
+		return complete != GL_FALSE;
+	}
+
+	//Checks the pending program's compile and link, records how long it took, saves its binary and takes it off the list.
+	void finish(unsigned int index)
+	{
+		PendingProgram compiling = pending[index];
+		pending.erase(pending.begin() + index);
+
+		// Asking for the link status is what waits, if the program isn't done yet.
+		GLint isLinked = 0;
+		glGetProgramiv(compiling.program, GL_LINK_STATUS, &isLinked);
+		ProgramTiming &timing = timings[compiling.timing];
+		timing.readyMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - compiling.start).count();
+
+		// The program keeps what it needs from the shaders. Their logs say what went wrong, if anything did.
+		for (unsigned int i = 0; i < compiling.shaders.size(); i++)
+		{
+			checkShader(compiling.shaders[i]);
+			glDeleteShader(compiling.shaders[i]);
+		}
+
+		if (isLinked == GL_FALSE)
+		{
+			char infolog[1024];
+			glGetProgramInfoLog(compiling.program, 1024, NULL, infolog);
+			std::cout << "The program " << timing.name << " failed to link with the error:" << std::endl << infolog << std::endl;
+			return;
+		}
+
+		if (compiling.key != 0)
+			save(compiling.key, compiling.program);
+	}
+
+	//Returns the program in the key's file, or 0 if there is no such file or the driver refuses the binary in it.
+	GLuint load(unsigned long long programKey)
+	{
+		std::ifstream file(fileName(programKey).c_str(), std::ios::in | std::ios::binary);
+		if (!file.good())
+			return 0;
+
+		// The file starts with the magic number, the key, the binary's format and its length.
+		unsigned int magic = 0;
+		unsigned long long fileKey = 0;
+		GLenum format = 0;
+		GLint length = 0;
+		file.read((char*)&magic, sizeof(magic));
+		file.read((char*)&fileKey, sizeof(fileKey));
+		file.read((char*)&format, sizeof(format));
+		file.read((char*)&length, sizeof(length));
+		if (!file.good() || magic != PROGRAM_CACHE_MAGIC || fileKey != programKey || length <= 0)
+			return 0;
+
+		std::vector<char> binary(length);
+		file.read(&binary[0], length);
+		if (!file.good())
+			return 0;
+
+		GLuint program = glCreateProgram();
+		glProgramBinary(program, format, &binary[0], length);
+
+		GLint isLinked = 0;
+		glGetProgramiv(program, GL_LINK_STATUS, &isLinked);
+		if (isLinked == GL_FALSE)
+		{
+			glDeleteProgram(program);
+			rejected++;
+			return 0;
+		}
+		return program;
+	}
+
+	//Writes the program's binary to the key's file.
+	void save(unsigned long long programKey, GLuint program)
+	{
+		GLint length = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0)
+			return;
+
+		std::vector<char> binary(length);
+		GLenum format = 0;
+		glGetProgramBinary(program, length, &length, &format, &binary[0]);
+
+		std::ofstream file(fileName(programKey).c_str(), std::ios::out | std::ios::binary);
+		if (!file.good())
+			return;
+
+		unsigned int magic = PROGRAM_CACHE_MAGIC;
+		file.write((const char*)&magic, sizeof(magic));
+		file.write((const char*)&programKey, sizeof(programKey));
+		file.write((const char*)&format, sizeof(format));
+		file.write((const char*)&length, sizeof(length));
+		file.write(&binary[0], length);
+	}
+
+	//Prints how many programs were loaded and compiled, and how long each one took.
+	void printSummary(std::ostream &out)
+	{
+		out << "program cache: " << loaded << " programs loaded, " << compiled << " compiled" << (parallel ? " in parallel" : "")
+			<< ", " << rejected << " binaries rejected, " << pending.size() << " still pending"
+			<< (enabled && !supported ? " (the driver has no binary formats)" : "") << "\n";
+		for (unsigned int i = 0; i < timings.size(); i++)
+			out << "  " << timings[i].name << ": " << (timings[i].fromCache ? "loaded" : "compiled") << ", " << timings[i].requestMs
+				<< " ms to request, ready after " << timings[i].readyMs << " ms\n";
+	}
+
+}programCache;
+
+#endif _PROGRAM_CACHE_H
@@ -0,0 +1,341 @@
+/*
+Title: Shadow mapping (Hard Shadows)
+File Name: Scene.h
+Copyright  2015
+Original authors: Srinivasan Thiagarajan
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+This file contains the scene: every object which gets drawn, stored as a
+structure of arrays.
+
+Instead of a struct per object, the scene keeps one array per property:
+all the model matrices one after the other, all the bounding spheres, all
+the mesh ids and so on. A pass which only needs the bounding spheres (like
+the culling) walks through one tightly packed array, instead of skipping
+over the rest of every object.
+
+The arrays are dense: removing an object moves the last one into its
+place. So the position of an object in the arrays isn't stable, and the
+rest of the program refers to objects by ObjectHandle instead. A handle
+holds a slot, which points at the object's current position, and a
+generation. The slot is reused once the object is gone, with the
+generation increased, so an old handle to the removed object can be told
+apart from the object now using the slot.
+
+Everything derived from an object's model matrix (the bounds, and the
+matrices the shaders get) is cached. Moving an object, or changing its
+material, only marks it dirty, and updateTransforms recomputes the dirty
+objects once per frame, however often they were changed. Objects which
+didn't change cost nothing but the copy into the frame's object array.
+
+Every frame, writeObjects copies the objects into the frame's object array
+in the order the draw calls want them: grouped by mesh, the static ones
+before the dynamic ones. That is a counting sort on the mesh id, which
+takes two linear passes over the arrays.
+*/
+
+#ifndef _SCENE_H
+#define _SCENE_H
+
+#include "GLIncludes.h"
+#include <cassert>
+
+// How many times the matrices were computed, in the last frame and since the start. Matrices which were still
+// valid and reused aren't counted. Besides the objects, the camera and the light count theirs here too.
+struct TransformStats
+{
+	int objects;		// Objects whose instance data and bounds were recomputed in the last frame
+	int camera;			// Times the camera's view and projection were recomputed in the last frame
+	int light;			// Times the light's matrices were recomputed in the last frame
+	long long total;	// All of the above, since the start
+
+	TransformStats()
+	{
+		objects = camera = light = 0;
+		total = 0;
+	}
+
+	//Starts counting a new frame.
+	void beginFrame()
+	{
+		objects = camera = light = 0;
+	}
+}transformStats;
+
+// Refers to an object of the scene.
+struct ObjectHandle
+{
+	unsigned int slot;
+	unsigned int generation;
+};
+
+// What an object's surface looks like. For now just a color, which multiplies the mesh's own colors.
+struct Material
+{
+	glm::vec4 color;
+};
+
+struct Scene
+{
+	// One entry per object.
+	std::vector<glm::mat4> models;			// Model matrix, taking the mesh to world space
+	std::vector<InstanceFormat> instances;	// What the shaders get: model and normal matrix and material color. Cached.
+	std::vector<glm::vec4> bounds;			// World space bounding sphere. Cached.
+	std::vector<BoundingBox> boxes;			// World space box, tighter than the sphere for flat meshes like the plane. Cached.
+	std::vector<unsigned char> dirty;		// Whether the cached entries are out of date
+	std::vector<int> meshIDs;				// Mesh in the meshRegistry
+	std::vector<int> materialIDs;			// Entry in materials
+	std::vector<unsigned char> dynamic;		// Whether the object is expected to move. Static ones can be kept in the cached shadow map.
+	std::vector<unsigned int> slots;		// The slot pointing at the entry, to update it when the entry moves
+
+	// For every slot, the entry it points at and its current generation. Free slots are kept in freeSlots.
+	std::vector<unsigned int> entries;
+	std::vector<unsigned int> generations;
+	std::vector<unsigned int> freeSlots;
+
+	std::vector<Material> materials;
+
+	// Number of objects marked dynamic, kept up to date by create and destroy.
+	int dynamicObjects = 0;
+
+	//Set whenever a static or a dynamic object is added, moved or removed. The shadow pass clears them once it has caught up.
+	bool staticChanged = true;
+	bool dynamicChanged = true;
+
+	//The bounding sphere and the slot of every object in the frame's object array, in the same order. Filled by writeObjects.
+	std::vector<glm::vec4> objectBounds;
+	std::vector<unsigned int> objectSlots;
+
+	// Number of objects of each mesh and layer (mesh * 2, + 1 for dynamic), reused by writeObjects.
+	std::vector<int> counts;
+
+	Scene()
+	{
+		// Material 0 leaves the mesh's colors alone.
+		addMaterial(glm::vec4(1.0f));
+	}
+
+	int size() const
+	{
+		return models.size();
+	}
+
+	//Adds a material and returns its id.
+	int addMaterial(const glm::vec4 &color)
+	{
+		Material material;
+		material.color = color;
+		materials.push_back(material);
+		return materials.size() - 1;
+	}
+
+	//Adds an object drawing the given mesh, placed with the given model matrix.
+	//Objects which will move should be marked dynamic, so the static part of the shadow map can be cached.
+	ObjectHandle create(int meshID, const glm::mat4 &model, int materialID = 0, bool isDynamic = false)
+	{
+		ObjectHandle handle;
+		if (!freeSlots.empty())
+		{
+			handle.slot = freeSlots.back();
+			freeSlots.pop_back();
+		}
+		else
+		{
+			handle.slot = entries.size();
+			entries.push_back(0);
+			generations.push_back(0);
+		}
+		handle.generation = generations[handle.slot];
+
+		entries[handle.slot] = models.size();
+		models.push_back(model);
+		instances.push_back(InstanceFormat());
+		bounds.push_back(glm::vec4(0.0f));
+		boxes.push_back(BoundingBox());
+		dirty.push_back(1);
+		meshIDs.push_back(meshID);
+		materialIDs.push_back(materialID);
+		dynamic.push_back(isDynamic);
+		slots.push_back(handle.slot);
+		if (isDynamic)
+			dynamicObjects++;
+
+		markChanged(isDynamic);
+		return handle;
+	}
+
+	//Returns whether the handle still refers to an object.
+	bool valid(ObjectHandle handle) const
+	{
+		return handle.slot < generations.size() && generations[handle.slot] == handle.generation;
+	}
+
+	//Removes the object. The last object takes its place in the arrays.
+	void destroy(ObjectHandle handle)
+	{
+		if (!valid(handle))
+			return;
+
+		unsigned int entry = entries[handle.slot];
+		unsigned int last = models.size() - 1;
+		markChanged(dynamic[entry] != 0);
+		if (dynamic[entry])
+			dynamicObjects--;
+
+		models[entry] = models[last];
+		instances[entry] = instances[last];
+		bounds[entry] = bounds[last];
+		boxes[entry] = boxes[last];
+		dirty[entry] = dirty[last];
+		meshIDs[entry] = meshIDs[last];
+		materialIDs[entry] = materialIDs[last];
+		dynamic[entry] = dynamic[last];
+		slots[entry] = slots[last];
+		entries[slots[entry]] = entry;
+
+		models.pop_back();
+		instances.pop_back();
+		bounds.pop_back();
+		boxes.pop_back();
+		dirty.pop_back();
+		meshIDs.pop_back();
+		materialIDs.pop_back();
+		dynamic.pop_back();
+		slots.pop_back();
+
+		// Old handles to this slot no longer match.
+		generations[handle.slot]++;
+		freeSlots.push_back(handle.slot);
+	}
+
+	//Moves an existing object. What depends on the model matrix is recomputed by the next updateTransforms.
+	//Does nothing if the object was destroyed.
+	void setTransform(ObjectHandle handle, const glm::mat4 &model)
+	{
+		if (!valid(handle))
+			return;
+
+		unsigned int entry = entries[handle.slot];
+		models[entry] = model;
+		dirty[entry] = 1;
+		markChanged(dynamic[entry] != 0);
+	}
+
+	//Gives an existing object another material. Does nothing if the object was destroyed.
+	void setMaterial(ObjectHandle handle, int materialID)
+	{
+		if (!valid(handle))
+			return;
+
+		unsigned int entry = entries[handle.slot];
+		materialIDs[entry] = materialID;
+		dirty[entry] = 1;
+	}
+
+	//Changes a material's color, which marks every object using it dirty.
+	void setMaterialColor(int materialID, const glm::vec4 &color)
+	{
+		materials[materialID].color = color;
+		for (int i = 0; i < size(); i++)
+			if (materialIDs[i] == materialID)
+				dirty[i] = 1;
+	}
+
+	//Recomputes the cached matrices and bounds of the objects which changed since the last call.
+	//Call once per frame, before anything reads bounds, boxes or instances.
+	void updateTransforms()
+	{
+		PROFILE_ZONE("scene.updateTransforms");
+		for (int i = 0; i < size(); i++)
+		{
+			if (!dirty[i])
+				continue;
+
+			Mesh &mesh = meshRegistry.meshes[meshIDs[i]];
+			instances[i] = InstanceFormat(models[i], mesh.base.dequantize, materials[materialIDs[i]].color * mesh.base.materialColor);
+			bounds[i] = mesh.worldBounds(models[i]);
+			boxes[i] = mesh.base.boundingBox.transformed(models[i]);
+			dirty[i] = 0;
+			transformStats.objects++;
+			transformStats.total++;
+		}
+	}
+
+	//Returns the object's model matrix. The handle has to be valid, since there is nothing to return otherwise.
+	const glm::mat4 &transform(ObjectHandle handle) const
+	{
+		assert(valid(handle));
+		return models[entries[handle.slot]];
+	}
+
+	void markChanged(bool isDynamic)
+	{
+		if (isDynamic)
+			dynamicChanged = true;
+		else
+			staticChanged = true;
+	}
+
+	//Returns whether any object is dynamic.
+	bool hasDynamicObjects() const
+	{
+		return dynamicObjects > 0;
+	}
+
+	//Copies the objects' cached instance data into the frame's object array, grouped by mesh with each mesh's static objects first,
+	//and tells every mesh of the registry where its objects are. Returns the number of objects written, which is at most maxObjects.
+	int writeObjects(MeshRegistry &registry, InstanceFormat* objects, int maxObjects)
+	{
+		PROFILE_ZONE("scene.writeObjects");
+		int count = std::min(size(), maxObjects);
+
+		// Count the objects of each mesh and layer, and turn the counts into where each group starts.
+		counts.assign(registry.meshes.size() * 2, 0);
+		for (int i = 0; i < count; i++)
+			counts[meshIDs[i] * 2 + dynamic[i]]++;
+
+		int start = 0;
+		for (unsigned int m = 0; m < registry.meshes.size(); m++)
+		{
+			Mesh &mesh = registry.meshes[m];
+			mesh.firstInstance = start;
+			mesh.staticCount = counts[m * 2];
+			mesh.dynamicCount = counts[m * 2 + 1];
+			counts[m * 2] = start;
+			counts[m * 2 + 1] = start + mesh.staticCount;
+			start += mesh.staticCount + mesh.dynamicCount;
+		}
+
+		// Then put every object at the next free place of its group.
+		objectBounds.resize(count);
+		objectSlots.resize(count);
+		for (int i = 0; i < count; i++)
+		{
+			int position = counts[meshIDs[i] * 2 + dynamic[i]]++;
+			objects[position] = instances[i];
+			objectBounds[position] = bounds[i];
+			objectSlots[position] = slots[i];
+		}
+		return count;
+	}
+
+}scene;
+
+#endif _SCENE_H
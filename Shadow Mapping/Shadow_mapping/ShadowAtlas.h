@@ -0,0 +1,516 @@
+/*
+Title: Shadow mapping (Hard Shadows)
+File Name: ShadowAtlas.h
+Copyright  2015
+Original authors: Srinivasan Thiagarajan
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+This file contains the spot lights and the shadow atlas they share.
+
+A scene can have hundreds of lights. Giving each one its own depth texture
+and framebuffer doesn't scale, so all of their shadow maps are square tiles
+of one big depth texture, the atlas. Every light gets a tile sized by how
+much of the screen it can cover: a light far away, whose cone covers a
+few pixels, doesn't need more than a small tile. Lights which can't be seen
+at all don't get lit, and don't need a tile this frame.
+
+The tiles are handed out by a quadtree allocator. The atlas is split into
+four, each quarter into four again, and so on down to the smallest tile.
+A free tile of the size we ask for is taken if there is one, otherwise a
+bigger one is split. When a tile is given back and its three siblings are
+free too, the four are merged back into their parent.
+
+Tiles are cached: a light keeps its tile, and the shadow in it, until the
+light moves, the casters change or its size on screen calls for another
+size. Lights which go out of view also keep their tiles, so they come back
+without redrawing. Only when the atlas is full are the tiles of the lights
+which haven't been seen for the longest taken away (least recently used).
+A light which had to settle for a smaller tile than it asked for keeps it
+until the size it asked for fits, rather than trying again every frame.
+
+The shadow is drawn one texel inside the edges of its tile, and the texels
+around it are cleared to the far plane. Linear filtering blends the texels
+next to the one looked up, and this way those are never another light's.
+
+The atlas texture is only created once a spot light can be seen, so a
+scene without spot lights doesn't pay for it.
+*/
+
+#ifndef _SHADOW_ATLAS_H
+#define _SHADOW_ATLAS_H
+
+#include "GLIncludes.h"
+#include "FrustumCulling.h"
+#include "Scene.h"
+
+// Size of the atlas texture, and of the smallest and largest tiles. All powers of two.
+#define ATLAS_SIZE 4096
+#define ATLAS_MIN_TILE 64
+#define ATLAS_MAX_TILE 1024
+// The texture unit the lit pass reads the atlas from.
+#define ATLAS_TEXTURE_UNIT 3
+// Near plane of the spot lights' projections.
+#define SPOT_LIGHT_NEAR 0.05f
+
+//Hands out square tiles of a square texture, by splitting it like a quadtree.
+struct QuadtreeAllocator
+{
+	int size;
+	int levels;
+
+	// The corners of the free tiles of each level. Level 0 is the whole texture, and each level halves the size.
+	std::vector<std::vector<glm::ivec2>> freeTiles;
+
+	void init(int iSize, int minTile)
+	{
+		size = iSize;
+		levels = 1;
+		while ((size >> (levels - 1)) > minTile)
+			levels++;
+
+		freeTiles.assign(levels, std::vector<glm::ivec2>());
+		freeTiles[0].push_back(glm::ivec2(0));
+	}
+
+	//Returns the level tiles of the given size are on.
+	int level(int tileSize) const
+	{
+		int l = 0;
+		while ((size >> l) > tileSize && l < levels - 1)
+			l++;
+		return l;
+	}
+
+	//Finds a free tile of the given size, and stores its corner in corner. Returns false if there is none.
+	bool allocate(int tileSize, glm::ivec2 &corner)
+	{
+		int l = level(tileSize);
+
+		// The closest level up with a free tile.
+		int k = l;
+		while (k >= 0 && freeTiles[k].empty())
+			k--;
+		if (k < 0)
+			return false;
+
+		corner = freeTiles[k].back();
+		freeTiles[k].pop_back();
+
+		// Split it until it's small enough. We keep the first quarter, and the other three are free.
+		while (k < l)
+		{
+			k++;
+			int s = size >> k;
+			freeTiles[k].push_back(corner + glm::ivec2(s, 0));
+			freeTiles[k].push_back(corner + glm::ivec2(0, s));
+			freeTiles[k].push_back(corner + glm::ivec2(s, s));
+		}
+		return true;
+	}
+
+	//Gives a tile back, merging it with its siblings for as long as they are all free.
+	void release(glm::ivec2 corner, int tileSize)
+	{
+		int l = level(tileSize);
+		while (l > 0)
+		{
+			int s = size >> l;
+			glm::ivec2 parent = (corner / (2 * s)) * (2 * s);
+
+			// Where the three siblings are in the free list, if they are there.
+			std::vector<glm::ivec2> &tiles = freeTiles[l];
+			int found[3], count = 0;
+			for (int i = 0; i < (int)tiles.size() && count < 3; i++)
+				if (tiles[i] != corner && tiles[i] / (2 * s) * (2 * s) == parent)
+					found[count++] = i;
+			if (count < 3)
+				break;
+
+			// Remove them, the highest index first so the others don't move.
+			std::sort(found, found + 3);
+			for (int i = 2; i >= 0; i--)
+			{
+				tiles[found[i]] = tiles.back();
+				tiles.pop_back();
+			}
+			corner = parent;
+			l--;
+		}
+		freeTiles[l].push_back(corner);
+	}
+};
+
+// A light shining in a cone.
+struct SpotLight
+{
+	glm::vec3 position;
+	glm::vec3 direction;
+	glm::vec3 color;
+	float range;		// Distance at which the light has faded out
+	float angle;		// Half the cone's angle, in radians
+
+	// Set when the light moved, so its shadow has to be drawn again.
+	bool changed;
+
+	// The light's tile in the atlas. tileSize is 0 if it has none.
+	int tileSize;
+	glm::ivec2 tileCorner;
+	// The size the light asked for when it got its tile. Bigger than tileSize if the atlas was too full for it.
+	int requestedSize;
+	// Whether the tile holds this light's current shadow.
+	bool rendered;
+	// The last frame the light could be seen, for the least recently used eviction.
+	int lastUsed;
+
+	glm::mat4 PV;
+};
+
+struct ShadowAtlas
+{
+	std::vector<SpotLight> lights;
+	QuadtreeAllocator allocator;
+
+	GLuint depthTex = 0;
+	GLuint fbo = 0;
+	GLuint program = 0;
+	GLint uni_LightPV;
+
+	// The lights which can be seen this frame, as indices into lights.
+	std::vector<int> visibleLights;
+	int frame = 0;
+
+	// Statistics since the start.
+	int tilesRendered = 0;
+	int tilesReused = 0;
+	int evictions = 0;
+	int unshadowed = 0;
+
+	// Culling results of the tile being rendered, reused between tiles.
+	std::vector<bool> visibleCasters;
+
+	//Requests the program without waiting for it, so it can compile along with the others. init does it if it wasn't done before.
+	void requestPrograms()
+	{
+		// The depth pass' shaders, taking the light's matrix from a uniform instead of the cascades.
+		std::string defines = "#define NUM_CASCADES " + std::to_string(NUM_CASCADES) + "\n#define SPOT_LIGHT_PV\n";
+		program = programCache.request("spot light shadows", addDefines(readShader("VertexShader.glsl"), defines), readShader("FragmentShader.glsl"));
+	}
+
+	void init()
+	{
+		allocator.init(ATLAS_SIZE, ATLAS_MIN_TILE);
+
+		if (program == 0)
+			requestPrograms();
+		uni_LightPV = glGetUniformLocation(program, "LightPV");
+	}
+
+	//Creates the atlas texture and its framebuffer. update does it the first time a spot light can be seen.
+	void createAtlas()
+	{
+		glGenTextures(1, &depthTex);
+		glBindTexture(GL_TEXTURE_2D, depthTex);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT24, ATLAS_SIZE, ATLAS_SIZE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LESS);
+
+		glGenFramebuffers(1, &fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTex, 0);
+		GLenum drawbuf[] = { GL_NONE };
+		glDrawBuffers(1, drawbuf);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	//Adds a spot light and returns its index.
+	int add(const glm::vec3 &position, const glm::vec3 &direction, const glm::vec3 &color, float range, float angle)
+	{
+		SpotLight light;
+		light.position = position;
+		light.direction = glm::normalize(direction);
+		light.color = color;
+		light.range = range;
+		light.angle = angle;
+		light.changed = true;
+		light.tileSize = 0;
+		light.requestedSize = 0;
+		light.rendered = false;
+		light.lastUsed = -1;
+		lights.push_back(light);
+		return lights.size() - 1;
+	}
+
+	//Moves a light. Its shadow is drawn again the next frame it is seen.
+	void move(int index, const glm::vec3 &position, const glm::vec3 &direction)
+	{
+		lights[index].position = position;
+		lights[index].direction = glm::normalize(direction);
+		lights[index].changed = true;
+	}
+
+	//Returns the size of tile a light needs, given how many pixels wide it can get on screen.
+	static int tileSizeFor(float pixels)
+	{
+		int size = ATLAS_MIN_TILE;
+		while (size < pixels && size < ATLAS_MAX_TILE)
+			size *= 2;
+		return size;
+	}
+
+	//Takes the tile of the light which hasn't been seen for the longest, out of those not seen this frame.
+	//Returns false if there is no such light.
+	bool evictLeastRecentlyUsed()
+	{
+		int oldest = -1;
+		for (unsigned int i = 0; i < lights.size(); i++)
+			if (lights[i].tileSize > 0 && lights[i].lastUsed < frame && (oldest < 0 || lights[i].lastUsed < lights[oldest].lastUsed))
+				oldest = i;
+		if (oldest < 0)
+			return false;
+
+		releaseTile(lights[oldest]);
+		evictions++;
+		return true;
+	}
+
+	void releaseTile(SpotLight &light)
+	{
+		allocator.release(light.tileCorner, light.tileSize);
+		light.tileSize = 0;
+		light.rendered = false;
+	}
+
+	//Finds the lights the camera can see, and makes sure each of them has a tile of the size it needs.
+	void update(const glm::mat4 &cameraView, const glm::mat4 &cameraPV, int viewportSize)
+	{
+		PROFILE_ZONE("shadowAtlas.update");
+		frame++;
+		visibleLights.clear();
+
+		Frustum camera(cameraPV);
+
+		// How many pixels one unit covers at a distance of one unit.
+		glm::mat4 projection = cameraPV * glm::inverse(cameraView);
+		float pixelsPerUnit = projection[1][1] * viewportSize * 0.5f;
+
+		std::vector<std::pair<int, int>> requests;
+		for (unsigned int i = 0; i < lights.size(); i++)
+		{
+			SpotLight &light = lights[i];
+
+			// The light can only reach the sphere around it, so if that is out of view so is everything it lights.
+			if (!camera.sphereVisible(glm::vec4(light.position, light.range)))
+				continue;
+
+			// The sphere's size on screen. If the camera is inside it, it can cover the whole screen.
+			float depth = -(cameraView * glm::vec4(light.position, 1.0f)).z;
+			float pixels = (depth > light.range) ? 2.0f * light.range * pixelsPerUnit / depth : (float)viewportSize;
+
+			light.lastUsed = frame;
+			visibleLights.push_back(i);
+			requests.push_back(std::make_pair(tileSizeFor(pixels), (int)i));
+
+			if (light.changed)
+			{
+				glm::vec3 up = (fabs(light.direction.y) > 0.99f) ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+				light.PV = glm::perspective(2.0f * light.angle, 1.0f, SPOT_LIGHT_NEAR, light.range)
+					* glm::lookAt(light.position, light.position + light.direction, up);
+			}
+		}
+
+		// If all the tiles together would be bigger than the atlas, the biggest ones are halved until they fit.
+		// Otherwise a few lights close to the camera would take the whole atlas, and leave the others without shadows.
+		long long area = 0;
+		for (unsigned int r = 0; r < requests.size(); r++)
+			area += (long long)requests[r].first * requests[r].first;
+		int largest = ATLAS_MAX_TILE;
+		while (area > (long long)ATLAS_SIZE * ATLAS_SIZE && largest > ATLAS_MIN_TILE)
+		{
+			for (unsigned int r = 0; r < requests.size(); r++)
+			{
+				if (requests[r].first == largest)
+				{
+					area -= (long long)largest * largest * 3 / 4;
+					requests[r].first /= 2;
+				}
+			}
+			largest /= 2;
+		}
+
+		if (depthTex == 0 && !requests.empty())
+			createAtlas();
+
+		// Lights which now ask for another size give their tile back first, so their space can be reused.
+		// A light which got less than it asked for keeps that, as long as it asks for the same size.
+		for (unsigned int r = 0; r < requests.size(); r++)
+		{
+			SpotLight &light = lights[requests[r].second];
+			if (light.tileSize != 0 && light.requestedSize != requests[r].first)
+				releaseTile(light);
+		}
+
+		// The biggest tiles are placed first, which keeps the small ones from breaking up the space.
+		std::sort(requests.begin(), requests.end(), [](const std::pair<int, int> &a, const std::pair<int, int> &b)
+		{
+			return a.first > b.first || (a.first == b.first && a.second < b.second);
+		});
+
+		for (unsigned int r = 0; r < requests.size(); r++)
+		{
+			SpotLight &light = lights[requests[r].second];
+			if (light.tileSize != 0)
+			{
+				// A smaller tile than asked for moves to the right size once that fits, without evicting anything for it.
+				glm::ivec2 corner;
+				if (light.tileSize < light.requestedSize && allocator.allocate(light.requestedSize, corner))
+				{
+					releaseTile(light);
+					light.tileSize = light.requestedSize;
+					light.tileCorner = corner;
+				}
+				continue;
+			}
+
+			// If the atlas is full, make room by evicting old tiles. If that isn't enough, settle for a smaller tile.
+			int size = requests[r].first;
+			while (!allocator.allocate(size, light.tileCorner))
+			{
+				if (evictLeastRecentlyUsed())
+					continue;
+				if (size == ATLAS_MIN_TILE)
+				{
+					size = 0;
+					break;
+				}
+				size /= 2;
+			}
+			light.tileSize = size;
+			light.requestedSize = requests[r].first;
+			light.rendered = false;
+			if (size == 0)
+				unshadowed++;
+		}
+	}
+
+	//Writes the lights which can be seen this frame, at most maxLights of them. Returns how many were written.
+	int writeLights(SpotLightData* data, int maxLights)
+	{
+		int count = std::min((int)visibleLights.size(), maxLights);
+		for (int i = 0; i < count; i++)
+		{
+			const SpotLight &light = lights[visibleLights[i]];
+			data[i].positionRange = glm::vec4(light.position, light.range);
+			data[i].directionCos = glm::vec4(light.direction, cos(light.angle));
+			data[i].color = glm::vec4(light.color, light.tileSize > 0 ? 1.0f : 0.0f);
+
+			// Clip coordinates (-1 to 1) to the tile's part of the atlas' texture coordinates (0 to 1), and depth to 0 to 1.
+			// The shadow is inside the tile's border texel, as render draws it.
+			float scale = 0.5f * (light.tileSize - 2) / ATLAS_SIZE;
+			glm::vec3 offset = glm::vec3(glm::vec2(light.tileCorner + 1) / (float)ATLAS_SIZE + scale, 0.5f);
+			data[i].shadowMatrix = glm::translate(glm::mat4(1), offset) * glm::scale(glm::mat4(1), glm::vec3(scale, scale, 0.5f)) * light.PV;
+		}
+		return count;
+	}
+
+	//Returns whether a bounding sphere can be inside the light's cone.
+	static bool sphereInCone(const SpotLight &light, const glm::vec4 &sphere)
+	{
+		glm::vec3 v = glm::vec3(sphere) - light.position;
+		float distance = glm::length(v);
+		if (distance > light.range + sphere.w)
+			return false;
+		if (distance <= sphere.w)
+			return true;
+
+		// The angle between the axis and the center, minus the angle the sphere covers as seen from the light.
+		float toCenter = acos(glm::clamp(glm::dot(v, light.direction) / distance, -1.0f, 1.0f));
+		return toCenter - asin(sphere.w / distance) <= light.angle;
+	}
+
+	//Draws the shadows of the visible lights whose tile doesn't hold their current shadow.
+	//castersChanged says whether any object moved since the last frame, which makes every cached tile stale.
+	//The frameRing's objects have to be bound.
+	void render(MeshRegistry &registry, const Scene &scene, bool castersChanged)
+	{
+		PROFILE_ZONE("shadowAtlas.render");
+		if (castersChanged)
+			for (unsigned int i = 0; i < lights.size(); i++)
+				lights[i].rendered = false;
+		if (depthTex == 0)
+			return;
+
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glUseProgram(program);
+		glEnable(GL_SCISSOR_TEST);
+		glEnable(GL_POLYGON_OFFSET_FILL);
+		glPolygonOffset(1.0f, 1.0f);
+		glCullFace(GL_FRONT);
+
+		for (unsigned int i = 0; i < visibleLights.size(); i++)
+		{
+			SpotLight &light = lights[visibleLights[i]];
+			if (light.tileSize == 0)
+				continue;
+			if (light.rendered && !light.changed)
+			{
+				tilesReused++;
+				continue;
+			}
+
+			// The scissor keeps the clear inside the tile, and the viewport leaves its border texel at the far plane.
+			glViewport(light.tileCorner.x + 1, light.tileCorner.y + 1, light.tileSize - 2, light.tileSize - 2);
+			glScissor(light.tileCorner.x, light.tileCorner.y, light.tileSize, light.tileSize);
+			glClear(GL_DEPTH_BUFFER_BIT);
+
+			glUniformMatrix4fv(uni_LightPV, 1, GL_FALSE, glm::value_ptr(light.PV));
+
+			visibleCasters.resize(scene.objectBounds.size());
+			for (unsigned int j = 0; j < scene.objectBounds.size(); j++)
+			{
+				visibleCasters[j] = sphereInCone(light, scene.objectBounds[j]);
+				cullingStats.shadowCulled += !visibleCasters[j];
+			}
+			cullingStats.shadowTested += visibleCasters.size();
+			registry.draw(true, ALL_CASTERS, &visibleCasters);
+
+			light.rendered = true;
+			light.changed = false;
+			tilesRendered++;
+		}
+
+		glDisable(GL_POLYGON_OFFSET_FILL);
+		glDisable(GL_SCISSOR_TEST);
+	}
+
+	//Binds the atlas for the lit pass.
+	void bind()
+	{
+		glActiveTexture(GL_TEXTURE0 + ATLAS_TEXTURE_UNIT);
+		glBindTexture(GL_TEXTURE_2D, depthTex);
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+}shadowAtlas;
+
+#endif _SHADOW_ATLAS_H
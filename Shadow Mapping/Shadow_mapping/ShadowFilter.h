@@ -0,0 +1,243 @@
+/*
+Title: Shadow mapping (Hard Shadows)
+File Name: ShadowFilter.h
+Copyright  2015
+Original authors: Srinivasan Thiagarajan
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+This file selects how the shadow map is filtered when the lit pass looks
+it up (percentage-closer filtering, or PCF).
+
+A single depth comparison is either 0 or 1, so the edge of a shadow shows
+every texel of the shadow map as a stair step. PCF does several comparisons
+around the fragment's position and averages the results, which blurs the
+steps into a soft edge. Averaging comparisons is not the same as comparing
+averaged depths; that is why it has to happen after the comparison.
+
+The kernels are:
+
+- PCF_NONE: one comparison against the nearest texel. Hard edges.
+- PCF_HARDWARE: one lookup with GL_LINEAR filtering. The hardware does the
+  comparison against the 4 nearest texels and blends them bilinearly.
+- PCF_GRID: PCF_GRID_SIZE x PCF_GRID_SIZE hardware lookups, one texel
+  apart.
+- PCF_POISSON: PCF_POISSON_TAPS hardware lookups spread over a disk of
+  PCF_RADIUS texels, in a Poisson disk pattern which is rotated by a
+  different angle for every pixel. The rotation turns banding into noise.
+
+Instead of comparing depths, the lit pass can also look up a moment shadow
+map (see MomentShadows.h), which is filtered before it is sampled:
+
+- MOMENTS_VSM: variance shadow maps, storing depth and depth squared.
+- MOMENTS_EVSM: exponential variance shadow maps, storing the same two
+  moments of the depth warped by a positive and a negative exponential,
+  which leaks much less light where shadows overlap.
+
+With cubeMap set, the shadows come from the point light's cube map (see
+PointShadows.h) instead of the cascades. The cube map is always filtered
+with a single hardware 2x2 lookup.
+
+The kernel is chosen when the shader is compiled: the settings are turned
+into #defines which are added to LightFragShader.glsl, so each kernel gets
+its own program with fixed loop counts and no branches on the kernel type.
+*/
+
+#ifndef _SHADOW_FILTER_H
+#define _SHADOW_FILTER_H
+
+#include "GLIncludes.h"
+
+// The values have to match the ones in LightFragShader.glsl.
+enum PCFKernel { PCF_NONE = 0, PCF_HARDWARE = 1, PCF_GRID = 2, PCF_POISSON = 3 };
+enum ShadowMoments { MOMENTS_NONE = 0, MOMENTS_VSM = 1, MOMENTS_EVSM = 2 };
+
+// The default filter, a single nearest comparison like the shadows have always had.
+// Can be overridden on the command line of the compiler, e.g. -DSHADOW_PCF_KERNEL=PCF_GRID.
+#ifndef SHADOW_PCF_KERNEL
+#define SHADOW_PCF_KERNEL PCF_NONE
+#endif
+#ifndef SHADOW_PCF_GRID_SIZE
+#define SHADOW_PCF_GRID_SIZE 3
+#endif
+#ifndef SHADOW_PCF_POISSON_TAPS
+#define SHADOW_PCF_POISSON_TAPS 12
+#endif
+#ifndef SHADOW_PCF_RADIUS
+#define SHADOW_PCF_RADIUS 1.5f
+#endif
+#ifndef SHADOW_MOMENTS
+#define SHADOW_MOMENTS MOMENTS_NONE
+#endif
+// Set to 1 to shadow the point light in every direction with a cube map, instead of the cascades below it.
+#ifndef USE_POINT_SHADOWS
+#define USE_POINT_SHADOWS 0
+#endif
+
+// Subtracted from the fragment's distance to the light (as a fraction of the cube map's far plane) before comparing.
+#define POINT_SHADOW_BIAS 0.005f
+
+// Moment shadow map settings.
+// Radius of the blur over the moments, in texels. The blur is a gaussian with 2 * radius + 1 taps per direction.
+#define MOMENT_BLUR_RADIUS 3
+// The exponents EVSM warps the depth with. 32 bit floats overflow above about 42 for the positive one.
+#define EVSM_POSITIVE_EXPONENT 40.0f
+#define EVSM_NEGATIVE_EXPONENT 5.0f
+// The smallest variance the lit pass assumes, which hides acne on lit surfaces.
+#define VSM_MIN_VARIANCE 0.00002f
+// Light bleeding reduction: the part of the lit fraction below this is cut off.
+#define VSM_LIGHT_BLEED_REDUCTION 0.2f
+
+// The shader's Poisson disk has this many points.
+#define MAX_POISSON_TAPS 16
+
+struct ShadowFilter
+{
+	PCFKernel kernel;
+	int gridSize;		// Lookups per side for PCF_GRID
+	int poissonTaps;	// Lookups for PCF_POISSON, at most MAX_POISSON_TAPS
+	float radius;		// Radius of the Poisson disk, in texels
+	ShadowMoments moments;	// If not MOMENTS_NONE, the moment shadow map is used and the PCF settings are ignored
+	bool cubeMap;			// If set, the point light's cube map is used and all of the above is ignored
+
+	ShadowFilter()
+	{
+		kernel = SHADOW_PCF_KERNEL;
+		gridSize = SHADOW_PCF_GRID_SIZE;
+		poissonTaps = SHADOW_PCF_POISSON_TAPS;
+		radius = SHADOW_PCF_RADIUS;
+		moments = SHADOW_MOMENTS;
+		cubeMap = USE_POINT_SHADOWS != 0;
+	}
+
+	ShadowFilter(PCFKernel iKernel, int iGridSize, int iPoissonTaps, float iRadius)
+	{
+		kernel = iKernel;
+		gridSize = iGridSize;
+		poissonTaps = std::min(iPoissonTaps, MAX_POISSON_TAPS);
+		radius = iRadius;
+		moments = MOMENTS_NONE;
+		cubeMap = false;
+	}
+
+	ShadowFilter(ShadowMoments iMoments)
+	{
+		kernel = PCF_HARDWARE;
+		gridSize = 1;
+		poissonTaps = 1;
+		radius = 0.0f;
+		moments = iMoments;
+		cubeMap = false;
+	}
+
+	// Returns the cube map filter.
+	static ShadowFilter pointLight()
+	{
+		ShadowFilter filter(PCF_HARDWARE, 1, 1, 0.0f);
+		filter.cubeMap = true;
+		return filter;
+	}
+
+	// The #define lines which specialize LightFragShader.glsl for this filter.
+	std::string defines() const
+	{
+		return "#define PCF_KERNEL " + std::to_string((int)kernel) + "\n"
+			+ "#define PCF_GRID_SIZE " + std::to_string(gridSize) + "\n"
+			+ "#define PCF_POISSON_TAPS " + std::to_string(poissonTaps) + "\n"
+			+ "#define PCF_RADIUS " + std::to_string(radius) + "\n"
+			+ (cubeMap ? "#define POINT_SHADOWS\n#define POINT_SHADOW_BIAS " + std::to_string(POINT_SHADOW_BIAS) + "\n" : "")
+			+ momentDefines();
+	}
+
+	// The #define lines shared by LightFragShader.glsl and MomentBlur.glsl, which have to agree on how the moments are stored.
+	std::string momentDefines() const
+	{
+		return "#define SHADOW_MOMENTS " + std::to_string((int)moments) + "\n"
+			+ "#define MOMENT_BLUR_RADIUS " + std::to_string(MOMENT_BLUR_RADIUS) + "\n"
+			+ "#define EVSM_POSITIVE_EXPONENT " + std::to_string(EVSM_POSITIVE_EXPONENT) + "\n"
+			+ "#define EVSM_NEGATIVE_EXPONENT " + std::to_string(EVSM_NEGATIVE_EXPONENT) + "\n"
+			+ "#define VSM_MIN_VARIANCE " + std::to_string(VSM_MIN_VARIANCE) + "\n"
+			+ "#define VSM_LIGHT_BLEED_REDUCTION " + std::to_string(VSM_LIGHT_BLEED_REDUCTION) + "\n";
+	}
+
+	// Every kernel but PCF_NONE relies on the hardware blending the 4 nearest comparisons.
+	GLint textureFilter() const
+	{
+		return kernel == PCF_NONE ? GL_NEAREST : GL_LINEAR;
+	}
+
+	// A short description, like "grid 3x3", for printing.
+	std::string name() const
+	{
+		if (cubeMap)
+			return "cube map";
+		if (moments == MOMENTS_VSM)
+			return "vsm";
+		if (moments == MOMENTS_EVSM)
+			return "evsm";
+
+		switch (kernel)
+		{
+		case PCF_NONE:
+			return "none";
+		case PCF_HARDWARE:
+			return "hardware 2x2";
+		case PCF_GRID:
+			return "grid " + std::to_string(gridSize) + "x" + std::to_string(gridSize);
+		default:
+			return "poisson " + std::to_string(poissonTaps);
+		}
+	}
+
+	// Returns the filter with the given short name: none, hardware, grid3 (or any other size), poisson8 (or any
+	// other number of taps), vsm, evsm or cube. Returns false, and leaves filter as it was, for any other name.
+	static bool parse(const std::string &text, ShadowFilter &filter)
+	{
+		if (text == "none")
+			filter = ShadowFilter(PCF_NONE, 1, 1, 0.0f);
+		else if (text == "hardware")
+			filter = ShadowFilter(PCF_HARDWARE, 1, 1, 0.0f);
+		else if (text.compare(0, 4, "grid") == 0 && atoi(text.c_str() + 4) > 0)
+			filter = ShadowFilter(PCF_GRID, atoi(text.c_str() + 4), 1, 0.0f);
+		else if (text.compare(0, 7, "poisson") == 0 && atoi(text.c_str() + 7) > 0)
+			filter = ShadowFilter(PCF_POISSON, 1, atoi(text.c_str() + 7), SHADOW_PCF_RADIUS);
+		else if (text == "vsm")
+			filter = ShadowFilter(MOMENTS_VSM);
+		else if (text == "evsm")
+			filter = ShadowFilter(MOMENTS_EVSM);
+		else if (text == "cube")
+			filter = pointLight();
+		else
+			return false;
+		return true;
+	}
+
+	// How many shadow map lookups the fragment shader does per fragment.
+	int lookups() const
+	{
+		if (kernel == PCF_GRID)
+			return gridSize * gridSize;
+		if (kernel == PCF_POISSON)
+			return poissonTaps;
+		return 1;
+	}
+
+}shadowFilter;
+
+#endif _SHADOW_FILTER_H
@@ -0,0 +1,199 @@
+/*
+Title: Shadow mapping (Hard Shadows)
+File Name: OcclusionCullingTest.cpp
+Copyright  2015
+Original authors: Srinivasan Thiagarajan
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+Description:
+This file tests the CPU occlusion culler (OcclusionCulling.h) on its own.
+It doesn't use OpenGL or open a window, so it can run on build machines
+without a GPU. Build and run it from this folder with, for example:
+
+	g++ -std=c++11 -O2 -I../include OcclusionCullingTest.cpp -o OcclusionCullingTest -lpthread
+	./OcclusionCullingTest
+
+It prints every check, and returns 1 if any of them failed.
+
+The checks are:
+
+- Spheres right behind a wall of boxes are culled, while spheres in front
+  of it, beside it, or looking out past its edge are not.
+- A sphere behind the part of a pixel the occluder doesn't cover is not
+  culled, even though the pixel's center is covered.
+- The scalar and the SSE paths, and one or several threads, write exactly
+  the same depth buffer and cull the same spheres.
+*/
+
+#include "../OcclusionCulling.h"
+#include "glm/gtc/matrix_transform.hpp"
+#include <iostream>
+#include <cstring>
+
+int failures = 0;
+
+void check(bool condition, const std::string &what)
+{
+	std::cout << (condition ? "  ok:     " : "  FAILED: ") << what << "\n";
+	if (!condition)
+		failures++;
+}
+
+// A unit box around the origin.
+std::vector<glm::vec3> boxPositions()
+{
+	std::vector<glm::vec3> box;
+	for (int i = 0; i < 8; i++)
+		box.push_back(glm::vec3((i & 1) ? 0.5f : -0.5f, (i & 2) ? 0.5f : -0.5f, (i & 4) ? 0.5f : -0.5f));
+	return box;
+}
+
+std::vector<unsigned int> boxIndices()
+{
+	unsigned int faces[] = { 0, 1, 3, 0, 3, 2, 4, 6, 7, 4, 7, 5, 0, 4, 5, 0, 5, 1, 2, 3, 7, 2, 7, 6, 0, 2, 6, 0, 6, 4, 1, 5, 7, 1, 7, 3 };
+	return std::vector<unsigned int>(faces, faces + 36);
+}
+
+// The camera at the origin, looking down -z, like in the occlusion benchmark in main.cpp.
+glm::mat4 cameraPV()
+{
+	return glm::perspective(1.0f, 1.0f, 0.1f, 100.0f) * glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+}
+
+// One big box, 10 units in front of the camera, 4 units wide and high.
+void testWall()
+{
+	std::cout << "A wall in front of the camera:\n";
+	DepthRasterizer rasterizer;
+	rasterizer.begin(cameraPV());
+	rasterizer.addOccluder(boxPositions(), boxIndices(), glm::scale(glm::translate(glm::mat4(1), glm::vec3(0.0f, 0.0f, -10.0f)), glm::vec3(4.0f, 4.0f, 1.0f)));
+	rasterizer.rasterize();
+
+	check(rasterizer.occluded(glm::vec4(0.0f, 0.0f, -20.0f, 0.5f)), "a sphere right behind it is culled");
+	check(rasterizer.occluded(glm::vec4(1.0f, -1.0f, -30.0f, 1.0f)), "a bigger sphere further behind it is culled");
+	check(!rasterizer.occluded(glm::vec4(0.0f, 0.0f, -5.0f, 0.5f)), "a sphere in front of it is not culled");
+	check(!rasterizer.occluded(glm::vec4(8.0f, 0.0f, -20.0f, 0.5f)), "a sphere beside it is not culled");
+	check(!rasterizer.occluded(glm::vec4(4.0f, 0.0f, -20.0f, 0.5f)), "a sphere looking out past its edge is not culled");
+	check(!rasterizer.occluded(glm::vec4(0.0f, 0.0f, -10.0f, 1.0f)), "a sphere sticking out of its front is not culled");
+	check(!rasterizer.occluded(glm::vec4(0.0f, 0.0f, 1.0f, 0.5f)), "a sphere around the camera is not culled");
+}
+
+// An occluder whose left edge crosses a pixel to the right of its center. The pixel's center is covered,
+// but a small sphere behind the uncovered left part of the pixel can be seen.
+void testPartlyCoveredPixel()
+{
+	std::cout << "An occluder covering part of a pixel:\n";
+
+	// An orthographic camera which maps x and y straight to pixels of the depth buffer.
+	glm::mat4 PV = glm::ortho(0.0f, (float)OCCLUSION_WIDTH, 0.0f, (float)OCCLUSION_HEIGHT, 0.1f, 100.0f);
+	std::vector<glm::vec3> quad;
+	quad.push_back(glm::vec3(100.3f, 10.0f, -10.0f));
+	quad.push_back(glm::vec3(250.0f, 10.0f, -10.0f));
+	quad.push_back(glm::vec3(250.0f, 250.0f, -10.0f));
+	quad.push_back(glm::vec3(100.3f, 250.0f, -10.0f));
+	unsigned int faces[] = { 0, 1, 2, 0, 2, 3 };
+
+	DepthRasterizer rasterizer;
+	rasterizer.begin(PV);
+	rasterizer.addOccluder(quad, std::vector<unsigned int>(faces, faces + 6), glm::mat4(1));
+	rasterizer.rasterize();
+
+	check(rasterizer.depth[128 * OCCLUSION_WIDTH + 100] == 1.0f, "the partly covered pixel isn't written");
+	check(rasterizer.depth[128 * OCCLUSION_WIDTH + 101] < 1.0f, "the pixel next to it is");
+	check(!rasterizer.occluded(glm::vec4(100.15f, 128.0f, -50.0f, 0.1f)), "a sphere behind the uncovered part is not culled");
+	check(rasterizer.occluded(glm::vec4(180.0f, 128.0f, -50.0f, 0.1f)), "a sphere behind the middle is culled");
+}
+
+// Renders a wall of boxes with gaps, seen at an angle, and tests a grid of spheres behind it.
+void render(DepthRasterizer &rasterizer, bool simd, int threads, std::vector<bool> &occluded)
+{
+	rasterizer.simd = simd;
+	rasterizer.threads = threads;
+
+	glm::mat4 PV = glm::perspective(1.0f, 1.0f, 0.1f, 100.0f) * glm::lookAt(glm::vec3(3.0f, 2.0f, 0.0f), glm::vec3(0.0f, 0.0f, -10.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	std::vector<glm::vec3> box = boxPositions();
+	std::vector<unsigned int> indices = boxIndices();
+
+	rasterizer.begin(PV);
+	for (int y = 0; y < 8; y++)
+	{
+		for (int x = 0; x < 16; x++)
+		{
+			glm::mat4 model = glm::translate(glm::mat4(1), glm::vec3(-12.0f + x * 1.6f, -6.0f + y * 1.6f, -10.0f));
+			model = glm::rotate(model, 0.1f * x + 0.2f * y, glm::vec3(0.3f, 1.0f, 0.2f));
+			rasterizer.addOccluder(box, indices, glm::scale(model, glm::vec3(1.5f, 1.5f, 0.5f)));
+		}
+	}
+	rasterizer.rasterize();
+
+	occluded.clear();
+	for (int z = 0; z < 4; z++)
+		for (int y = 0; y < 16; y++)
+			for (int x = 0; x < 32; x++)
+				occluded.push_back(rasterizer.occluded(glm::vec4(-16.0f + x, -8.0f + y, -4.0f - z * 8.0f, 0.3f)));
+}
+
+void testPathsAgree()
+{
+	std::cout << "The scalar and SSE paths, on one and on several threads:\n";
+
+	DepthRasterizer reference;
+	std::vector<bool> referenceOccluded;
+	render(reference, false, 1, referenceOccluded);
+
+	int culled = 0;
+	for (unsigned int i = 0; i < referenceOccluded.size(); i++)
+		culled += referenceOccluded[i];
+	check(culled > 0 && culled < (int)referenceOccluded.size(), "some but not all of the spheres are culled (" + std::to_string(culled) + ")");
+
+	// The pool is started with more threads than tiles per thread, and the same rasterizer is used for several frames.
+	DepthRasterizer pooled;
+	pooled.threads = 4;
+	pooled.init();
+	for (int simd = 0; simd < 2; simd++)
+	{
+		if (simd && !OCCLUSION_SSE)
+			continue;
+		for (int threads = 1; threads <= 4; threads++)
+		{
+			std::vector<bool> occluded;
+			render(pooled, simd != 0, threads, occluded);
+			std::string name = std::string(simd ? "sse" : "scalar") + " on " + std::to_string(threads) + " threads";
+			check(memcmp(&pooled.depth[0], &reference.depth[0], sizeof(float) * reference.depth.size()) == 0, name + " writes the same depths");
+			check(pooled.tileMax == reference.tileMax, name + " finds the same furthest depth of every tile");
+			check(occluded == referenceOccluded, name + " culls the same spheres");
+		}
+	}
+}
+
+int main()
+{
+	testWall();
+	testPartlyCoveredPixel();
+	testPathsAgree();
+
+	if (failures > 0)
+	{
+		std::cout << failures << " checks failed.\n";
+		return 1;
+	}
+	std::cout << "All checks passed.\n";
+	return 0;
+}
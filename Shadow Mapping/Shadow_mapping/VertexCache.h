@@ -0,0 +1,204 @@
+/*
+Title: Shadow mapping (Hard Shadows)
+File Name: VertexCache.h
+Copyright  2015
+Original authors: Srinivasan Thiagarajan
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+This file contains the helpers used to prepare indexed meshes for the GPU.
+
+After a vertex is run through the vertex shader, the GPU keeps the result in
+a small post-transform cache. If an index shows up again while it is still
+in the cache, the vertex shader does not have to run again. The order of the
+triangles decides how often that happens.
+
+optimizeVertexCache() reorders the triangles of an index buffer using Tom
+Forsyth's "Linear-Speed Vertex Cache Optimisation". Every vertex gets a score
+based on where it sits in a simulated cache and how many triangles still use
+it; the triangle with the highest total score is emitted next.
+
+computeACMR() measures the result. ACMR (average cache miss ratio) is the
+number of vertex shader runs per triangle, simulated with a FIFO cache. 3.0
+means no reuse at all (which is always the case with glDrawArrays), and a
+well ordered closed mesh gets close to 0.5.
+
+References:
+Tom Forsyth, Linear-Speed Vertex Cache Optimisation
+(https://tomforsyth1000.github.io/papers/fast_vert_cache_opt.html)
+*/
+
+#ifndef _VERTEX_CACHE_H
+#define _VERTEX_CACHE_H
+
+#include "GLIncludes.h"
+
+// Size of the cache simulated while reordering the triangles.
+#define VERTEX_CACHE_SIZE 32
+// Size of the FIFO cache used to measure the ACMR. Kept small, since that is what older hardware has.
+#define ACMR_CACHE_SIZE 16
+
+// Computes how much it is worth to use a vertex next, given its position in the cache (-1 if it isn't in it)
+// and the number of triangles which still have to be emitted using it.
+float vertexCacheScore(int cachePosition, int remainingTriangles)
+{
+	if (remainingTriangles == 0)
+		return -1.0f;
+
+	float score = 0.0f;
+	if (cachePosition >= 0)
+	{
+		// The vertices of the triangle we just emitted get a fixed score, so we don't just keep making long strips.
+		if (cachePosition < 3)
+			score = 0.75f;
+		else
+			score = powf(1.0f - (cachePosition - 3) / (float)(VERTEX_CACHE_SIZE - 3), 1.5f);
+	}
+
+	// Vertices with only a few triangles left get a boost, so we get rid of them and don't leave lone triangles behind.
+	score += 2.0f * powf((float)remainingTriangles, -0.5f);
+	return score;
+}
+
+// Returns a copy of the triangle list "indices" with the triangles reordered for the post-transform cache.
+std::vector<GLuint> optimizeVertexCache(const std::vector<GLuint>& indices, int numVertices)
+{
+	int numTriangles = indices.size() / 3;
+
+	// For every vertex, the list of triangles using it.
+	std::vector<int> remaining(numVertices, 0);
+	for (unsigned int i = 0; i < indices.size(); i++)
+		remaining[indices[i]]++;
+
+	std::vector<int> offsets(numVertices + 1, 0);
+	for (int v = 0; v < numVertices; v++)
+		offsets[v + 1] = offsets[v] + remaining[v];
+
+	std::vector<int> vertexTriangles(indices.size());
+	std::vector<int> fill(offsets.begin(), offsets.end() - 1);
+	for (unsigned int i = 0; i < indices.size(); i++)
+		vertexTriangles[fill[indices[i]]++] = i / 3;
+
+	std::vector<int> cachePosition(numVertices, -1);
+	std::vector<float> vertexScore(numVertices);
+	for (int v = 0; v < numVertices; v++)
+		vertexScore[v] = vertexCacheScore(-1, remaining[v]);
+
+	std::vector<bool> emitted(numTriangles, false);
+	std::vector<float> triangleScore(numTriangles);
+	for (int t = 0; t < numTriangles; t++)
+		triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+
+	std::vector<GLuint> output;
+	output.reserve(indices.size());
+
+	// The cache holds 3 extra entries, the ones which are pushed out by the triangle being added.
+	std::vector<int> cache;
+	int nextTriangle = -1;
+
+	for (int emittedCount = 0; emittedCount < numTriangles; emittedCount++)
+	{
+		// If none of the triangles touching the cache is left, fall back to the best triangle overall.
+		if (nextTriangle < 0)
+		{
+			float best = -1.0f;
+			for (int t = 0; t < numTriangles; t++)
+			{
+				if (!emitted[t] && triangleScore[t] > best)
+				{
+					best = triangleScore[t];
+					nextTriangle = t;
+				}
+			}
+		}
+
+		int t = nextTriangle;
+		emitted[t] = true;
+
+		// Emit the triangle, move its vertices to the front of the cache and take it out of the vertex' triangle lists.
+		for (int k = 0; k < 3; k++)
+		{
+			GLuint v = indices[t * 3 + k];
+			output.push_back(v);
+
+			std::vector<int>::iterator it = std::find(cache.begin(), cache.end(), (int)v);
+			if (it != cache.end())
+				cache.erase(it);
+			cache.insert(cache.begin(), v);
+
+			int* begin = &vertexTriangles[offsets[v]];
+			int* end = begin + remaining[v];
+			*std::find(begin, end, t) = *(end - 1);
+			remaining[v]--;
+		}
+
+		// Update the scores of everything in the cache, including the vertices which just fell out of it.
+		for (unsigned int i = 0; i < cache.size(); i++)
+		{
+			int v = cache[i];
+			cachePosition[v] = (i < VERTEX_CACHE_SIZE) ? i : -1;
+			vertexScore[v] = vertexCacheScore(cachePosition[v], remaining[v]);
+		}
+
+		// Re-score the triangles around the cache and pick the best of them for the next iteration.
+		nextTriangle = -1;
+		float best = -1.0f;
+		for (unsigned int i = 0; i < cache.size(); i++)
+		{
+			int v = cache[i];
+			for (int j = 0; j < remaining[v]; j++)
+			{
+				int tri = vertexTriangles[offsets[v] + j];
+				triangleScore[tri] = vertexScore[indices[tri * 3]] + vertexScore[indices[tri * 3 + 1]] + vertexScore[indices[tri * 3 + 2]];
+				if (triangleScore[tri] > best)
+				{
+					best = triangleScore[tri];
+					nextTriangle = tri;
+				}
+			}
+		}
+
+		if (cache.size() > VERTEX_CACHE_SIZE)
+			cache.resize(VERTEX_CACHE_SIZE);
+	}
+
+	return output;
+}
+
+// Simulates a FIFO post-transform cache of the given size and returns the number of cache misses per triangle.
+float computeACMR(const std::vector<GLuint>& indices, int cacheSize)
+{
+	std::vector<GLuint> fifo;
+	int misses = 0;
+
+	for (unsigned int i = 0; i < indices.size(); i++)
+	{
+		if (std::find(fifo.begin(), fifo.end(), indices[i]) != fifo.end())
+			continue;
+
+		misses++;
+		fifo.push_back(indices[i]);
+		if ((int)fifo.size() > cacheSize)
+			fifo.erase(fifo.begin());
+	}
+
+	return misses / (indices.size() / 3.0f);
+}
+
+#endif _VERTEX_CACHE_H
@@ -0,0 +1,205 @@
+/*
+Title: Shadow mapping (Hard Shadows)
+File Name: VertexPacking.h
+Copyright  2015
+Original authors: Srinivasan Thiagarajan
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Description:
+This file contains the compact vertex layouts a mesh can be stored in.
+
+A VertexFormat takes 40 bytes: a float4 color, a float3 position and a
+float3 normal. Most of that precision is wasted, so each of the three can
+be stored in a smaller format instead:
+
+Positions
+- POSITION_FLOAT:   3 floats, 12 bytes.
+- POSITION_HALF:    4 half floats, 8 bytes.
+- POSITION_UNORM16: 4 unsigned shorts, 8 bytes. The positions are stored
+  relative to the mesh's bounding box, in the range 0 to 1. The matrix
+  taking them back to model space (dequantize) is folded into the model
+  matrix of every instance, so the shaders don't have to know about it.
+
+Normals
+- NORMAL_FLOAT:      3 floats, 12 bytes.
+- NORMAL_SNORM10:    10:10:10:2 signed normalized, 4 bytes.
+- NORMAL_OCTAHEDRAL: 2 signed shorts, 4 bytes. The unit sphere is folded
+  onto an octahedron and flattened into a square. The vertex shader
+  unfolds it again (OCTAHEDRAL_NORMALS is defined for it). This only
+  stores directions, so the normals come out normalized.
+
+Colors
+- COLOR_FLOAT:    4 floats, 16 bytes.
+- COLOR_RGBA8:    4 unsigned bytes, 4 bytes.
+- COLOR_MATERIAL: nothing per vertex. The color of the first vertex is used
+  for the whole mesh, and set as a constant attribute before it is drawn.
+
+The layout every mesh uses is picked with POSITION_PACKING, NORMAL_PACKING
+and COLOR_PACKING, which can be defined before this file is included.
+All the packing functions come from glm/gtc/packing.hpp.
+
+References:
+Cigolle et al., A Survey of Efficient Representations for Independent Unit Vectors
+*/
+
+#ifndef _VERTEX_PACKING_H
+#define _VERTEX_PACKING_H
+
+#include "GLIncludes.h"
+#include "glm/gtc/packing.hpp"
+
+enum PositionFormat { POSITION_FLOAT, POSITION_HALF, POSITION_UNORM16 };
+enum NormalFormat { NORMAL_FLOAT, NORMAL_SNORM10, NORMAL_OCTAHEDRAL };
+enum ColorFormat { COLOR_FLOAT, COLOR_RGBA8, COLOR_MATERIAL };
+
+// 8 + 4 + 4 = 16 bytes per vertex by default, and 8 bytes in the depth pass' position stream.
+#ifndef POSITION_PACKING
+#define POSITION_PACKING POSITION_UNORM16
+#endif
+#ifndef NORMAL_PACKING
+#define NORMAL_PACKING NORMAL_SNORM10
+#endif
+#ifndef COLOR_PACKING
+#define COLOR_PACKING COLOR_RGBA8
+#endif
+
+// Describes how the vertices of a mesh are stored on the GPU.
+struct VertexLayout
+{
+	PositionFormat position;
+	NormalFormat normal;
+	ColorFormat color;
+
+	// The default is the uncompressed VertexFormat.
+	VertexLayout()
+	{
+		position = POSITION_FLOAT;
+		normal = NORMAL_FLOAT;
+		color = COLOR_FLOAT;
+	}
+
+	VertexLayout(PositionFormat iPosition, NormalFormat iNormal, ColorFormat iColor)
+	{
+		position = iPosition;
+		normal = iNormal;
+		color = iColor;
+	}
+
+	int positionSize() const { return position == POSITION_FLOAT ? 12 : 8; }
+	int normalSize() const { return normal == NORMAL_FLOAT ? 12 : 4; }
+	int colorSize() const { return color == COLOR_FLOAT ? 16 : (color == COLOR_RGBA8 ? 4 : 0); }
+
+	// Size of one interleaved vertex, in bytes. The position comes first, then the normal, then the color.
+	int stride() const { return positionSize() + normalSize() + colorSize(); }
+};
+
+// The layout used for every mesh in the scene.
+VertexLayout vertexLayout(POSITION_PACKING, NORMAL_PACKING, COLOR_PACKING);
+
+// The vertices of a mesh, converted to a VertexLayout and ready to be uploaded.
+struct PackedVertices
+{
+	std::vector<unsigned char> vertices;	// Interleaved, layout.stride() bytes per vertex
+	std::vector<unsigned char> positions;	// Only the positions, layout.positionSize() bytes per vertex
+	glm::mat4 dequantize;					// Takes the stored positions back to model space
+	glm::vec4 materialColor;				// The mesh's color, for COLOR_MATERIAL
+};
+
+// Appends the bytes of value to the buffer.
+template <typename T>
+void appendBytes(std::vector<unsigned char> &buffer, const T &value)
+{
+	const unsigned char* bytes = (const unsigned char*)&value;
+	buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+}
+
+// Maps a unit vector onto the octahedron, and the octahedron onto the square -1 to 1.
+glm::vec2 octahedralEncode(glm::vec3 n)
+{
+	n /= (fabs(n.x) + fabs(n.y) + fabs(n.z));
+	glm::vec2 p(n.x, n.y);
+
+	// The lower half is folded over the diagonals onto the corners of the square.
+	if (n.z < 0.0f)
+	{
+		p.x = (1.0f - fabs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+		p.y = (1.0f - fabs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+	}
+	return p;
+}
+
+// Converts the vertices into the given layout.
+void packVertices(const VertexLayout &layout, int numVertices, VertexFormat* vertices, PackedVertices &packed)
+{
+	// The bounding box of the mesh, used to quantize the positions.
+	glm::vec3 boxMin = vertices[0].position;
+	glm::vec3 boxMax = vertices[0].position;
+	for (int i = 1; i < numVertices; i++)
+	{
+		boxMin = glm::min(boxMin, vertices[i].position);
+		boxMax = glm::max(boxMax, vertices[i].position);
+	}
+
+	// A flat mesh has no extent along one axis, which would divide by zero.
+	glm::vec3 extent = boxMax - boxMin;
+	for (int k = 0; k < 3; k++)
+		if (extent[k] == 0.0f)
+			extent[k] = 1.0f;
+
+	if (layout.position == POSITION_UNORM16)
+		packed.dequantize = glm::scale(glm::translate(glm::mat4(1), boxMin), extent);
+	else
+		packed.dequantize = glm::mat4(1);
+	packed.materialColor = vertices[0].color;
+
+	packed.vertices.clear();
+	packed.positions.clear();
+	packed.vertices.reserve(numVertices * layout.stride());
+	packed.positions.reserve(numVertices * layout.positionSize());
+
+	for (int i = 0; i < numVertices; i++)
+	{
+		const VertexFormat &v = vertices[i];
+		size_t start = packed.vertices.size();
+
+		if (layout.position == POSITION_FLOAT)
+			appendBytes(packed.vertices, v.position);
+		else if (layout.position == POSITION_HALF)
+			appendBytes(packed.vertices, glm::packHalf4x16(glm::vec4(v.position, 1.0f)));
+		else
+			appendBytes(packed.vertices, glm::packUnorm4x16(glm::vec4((v.position - boxMin) / extent, 0.0f)));
+
+		// The position is the first thing in the vertex, so the position stream is just a copy of it.
+		packed.positions.insert(packed.positions.end(), packed.vertices.begin() + start, packed.vertices.end());
+
+		if (layout.normal == NORMAL_FLOAT)
+			appendBytes(packed.vertices, v.normal);
+		else if (layout.normal == NORMAL_SNORM10)
+			appendBytes(packed.vertices, glm::packSnorm3x10_1x2(glm::vec4(v.normal, 0.0f)));
+		else
+			appendBytes(packed.vertices, glm::packSnorm2x16(octahedralEncode(glm::normalize(v.normal))));
+
+		if (layout.color == COLOR_FLOAT)
+			appendBytes(packed.vertices, v.color);
+		else if (layout.color == COLOR_RGBA8)
+			appendBytes(packed.vertices, glm::packUnorm4x8(v.color));
+	}
+}
+
+#endif _VERTEX_PACKING_H
@@ -49,13 +49,45 @@ OpenGL 4 Shading language Cookbook
 
 #version 430 core // Identifies the version of the shader, this line must be on a separate line from the rest of the shader code
  
-layout(location = 0) in vec3 in_position;	// Get in a vec3 for position
-layout(location = 1) in vec3 in_normal;
-layout(location = 2) in vec4 in_color;		// Get in a vec4 for color
+layout(location = 0) in vec3 in_position;	// Get in a vec3 for position. This is all the depth pass' vao provides per vertex.
+layout(location = 3) in uint in_objectID;	// Index of the object being drawn, read once per instance
 
-uniform mat4 MVP; // Our uniform MVP matrix to modify our position values
+#ifdef SPOT_LIGHT_PV
+uniform mat4 LightPV;						// The spot light being rendered into the shadow atlas, see ShadowAtlas.h
+#else
+uniform int Cascade;						// The cascade being rendered, which picks the light matrix
+#endif
+
+// Filled once per frame from the frameRing. See FrameConstants in FrameRing.h for the C++ side.
+layout(std140) uniform FrameConstants
+{
+	mat4 PV;
+	mat4 ViewMatrix;
+	mat4 CascadePV[NUM_CASCADES];	// Light projection * light view, cropped to each cascade
+	vec4 CascadeSplits;				// View space depth at which each cascade ends
+	vec4 LightPosition;
+	vec4 LightIntensity;
+};
+
+struct Object
+{
+	mat4 model;
+	mat4 normalMatrix;		// Inverse transpose of the model matrix, only the upper 3x3 is used
+	vec4 color;				// The material's color
+};
+
+// Every object drawn this frame. in_objectID picks ours.
+layout(std430) readonly buffer Objects
+{
+	Object objects[];
+};
 
 void main(void)
 {
-	gl_Position = MVP * vec4(in_position, 1.0);
+	// We render from the light's point of view in this pass, zoomed in on one cascade.
+#ifdef SPOT_LIGHT_PV
+	gl_Position = LightPV * objects[in_objectID].model * vec4(in_position, 1.0);
+#else
+	gl_Position = CascadePV[Cascade] * objects[in_objectID].model * vec4(in_position, 1.0);
+#endif
 }
\ No newline at end of file
@@ -50,40 +50,156 @@ OpenGL 4 Shading language Cookbook
 #pragma once
 #include "GLIncludes.h"
 #include "BasicFunctions.h"
+#include "Scene.h"
+#include "MomentShadows.h"
+#include "PointShadows.h"
+#include "ShadowAtlas.h"
+#include "OcclusionCulling.h"
+#include "HiZCulling.h"
+#include "GpuTimers.h"
+#include "Benchmark.h"
+#include "Headless.h"
+#include "VertexCache.h"
+#include "LightFit.h"
+#include <chrono>
 
 #define PI 3.14159265
 #define WindowSize 800
-#define DIVISIONS 40
-#define TextureSize 800.0f
 #define speed 0.3f
-
-//Handle to the texture storing the depth
+// Segments around the spheres, the size of each cascade's layer of the shadow map, the number of spheres, and how many of them move.
+// They are the defaults, which --divisions, --shadow-map-size, --objects and --dynamic-objects change before setup.
+#ifndef DIVISIONS
+#define DIVISIONS 40
+#endif
+#ifndef SHADOW_MAP_SIZE
+#define SHADOW_MAP_SIZE 800
+#endif
+#ifndef SPHERES
+#define SPHERES 2
+#endif
+#ifndef DYNAMIC_SPHERES
+#define DYNAMIC_SPHERES 1
+#endif
+// Seconds for a moving sphere to go up and back down.
+#define BOUNCE_PERIOD 2.0f
+// Number of spot lights spread over the plane, each with its shadow in the atlas (see ShadowAtlas.h).
+#ifndef SPOT_LIGHTS
+#define SPOT_LIGHTS 0
+#endif
+
+int spotLightCount = SPOT_LIGHTS;
+int sphereDivisions = DIVISIONS;
+int shadowMapSize = SHADOW_MAP_SIZE;
+int sphereCount = SPHERES;
+int dynamicSphereCount = DYNAMIC_SPHERES;
+
+//The spheres which are marked dynamic and moved by update, and where each one rests on the plane.
+std::vector<ObjectHandle> movingSpheres;
+std::vector<glm::vec3> restingPositions;
+//Seconds since the start. update() advances it.
+double simulationTime = 0.0;
+
+//Handle to the texture array storing the depth, one layer per cascade (see Cascades.h)
 GLuint depthTex;
 //Handle to the FBO to which depthTex will be attached.
 GLuint fboHandle;
 
+//For every object in the frame's object array, whether the lit pass draws it.
+//Objects outside the camera's frustum, or hidden behind occluders, are left out.
+std::vector<bool> litVisible;
+
+//The shadow map is only rendered again when the light or a caster changes.
+//The static casters are kept in their own depth texture, so when only dynamic casters move,
+//the static depth is copied into depthTex and just the dynamic casters are drawn on top of it.
+//Without dynamic casters, the static ones are drawn straight into depthTex and staticDepthTex is left out of date.
+GLuint staticDepthTex;
+GLuint staticFboHandle;
+bool staticDepthCurrent = false;
+
+//How often the shadow map was rebuilt, partially redrawn, or reused as it was.
+struct ShadowCacheStats
+{
+	int staticRenders;
+	int dynamicRenders;
+	int skipped;
+	long long texelsRendered;	// Every texel of every layer drawn, for the fill rate
+}shadowCacheStats;
+
 glm::mat4 PV;
+glm::mat4 View;
+
+// A struct to store the camera. View and PV above are only computed again when something here changed.
+struct CameraParams
+{
+	glm::vec3 position;
+	glm::vec3 target;
+	glm::vec3 up;
+	float fov;
+	float aspect;
+	float nearPlane;
+	float farPlane;
+
+	bool changed;			// Set whenever one of the above is changed, cleared by update
+
+	void init()
+	{
+		position = glm::vec3(0.0f, 1.0f, 3.0f);
+		target = glm::vec3(0.0f, 0.0f, 0.0f);
+		up = glm::vec3(0.0f, 1.0f, 0.0f);
+		fov = 45.0f;
+		aspect = 800.0f / 800.0f;
+		nearPlane = 0.1f;
+		farPlane = 100.0f;
+		changed = true;
+	}
+
+	//Recomputes View and PV, if the camera changed since the last call.
+	void update()
+	{
+		if (!changed)
+			return;
+
+		View = glm::lookAt(position, target, up);
+		glm::mat4 proj = glm::perspective(fov, aspect, nearPlane, farPlane);
+		PV = proj * View;
+		changed = false;
+
+		transformStats.camera++;
+		transformStats.total++;
+	}
+
+}camera;
 
-// A struct to hold the handle to the uniforms in the shader.
+// A struct to hold the handle to the uniform blocks in the shader.
+// All the uniforms live in blocks which are filled from the frameRing, so there are no glUniform* calls per frame.
 struct shaderParams
 {
-	GLuint vec3_LightPos;
-	GLuint vec3_LightIntensity;
-	GLuint mat4_MVP;
-	GLuint mat4_ModelViewMatrix;
-	GLuint mat3_NormalMatrix;
-	GLuint mat4_ShadowMatrix;
-
-	//This function retrieves the handle to the uniforms and stores it in the respective variables.
+	GLuint block_FrameConstants;
+	GLuint block_Objects;
+	GLuint block_SpotLights;
+
+	//The only plain uniform: which cascade the depth pass is rendering. Only the depth program has it.
+	GLint uni_Cascade = -1;
+
+	//This function retrieves the handle to the blocks and attaches them to the binding points the frameRing binds its buffer to.
+	//A program which doesn't use one of the blocks gets GL_INVALID_INDEX for it, which we skip.
 	void initUniforms(GLuint programID)
 	{
-		glUseProgram(programID);
-		vec3_LightPos = glGetUniformLocation(programID, "pointLight.position");
-		vec3_LightIntensity = glGetUniformLocation(programID, "pointLight.Intensity");
-		mat4_MVP = glGetUniformLocation(programID, "MVP");
-		mat4_ModelViewMatrix = glGetUniformLocation(programID, "ModelViewMatrix");
-		mat3_NormalMatrix = glGetUniformLocation(programID, "NormalMatrix");
-		mat4_ShadowMatrix = glGetUniformLocation(programID, "ShadowMatrix");
+		block_FrameConstants = glGetUniformBlockIndex(programID, "FrameConstants");
+		if (block_FrameConstants != GL_INVALID_INDEX)
+			glUniformBlockBinding(programID, block_FrameConstants, FRAME_CONSTANTS_BINDING);
+
+		block_Objects = glGetProgramResourceIndex(programID, GL_SHADER_STORAGE_BLOCK, "Objects");
+		if (block_Objects != GL_INVALID_INDEX)
+			glShaderStorageBlockBinding(programID, block_Objects, OBJECTS_BINDING);
+
+		block_SpotLights = glGetProgramResourceIndex(programID, GL_SHADER_STORAGE_BLOCK, "SpotLights");
+		if (block_SpotLights != GL_INVALID_INDEX)
+			glShaderStorageBlockBinding(programID, block_SpotLights, SPOT_LIGHTS_BINDING);
+
+		GLint cascade = glGetUniformLocation(programID, "Cascade");
+		if (cascade != -1)
+			uni_Cascade = cascade;
 	}
 	
 }uniforms;
@@ -97,8 +213,14 @@ struct LightParams
 
 	glm::mat4 Bias;
 	glm::mat4 Projection;
+	glm::mat4 DefaultProjection;	// Used when the projection can't be fitted to the scene
 	glm::mat4 View;
-	glm::mat4 S;			// S = Bias * Projection * View * by the model matrix of the object being rendered
+	glm::mat4 S;			// S = Bias * Projection * View. The vertex shader multiplies it by the model matrix of the instance being rendered
+
+	bool changed;			// Set when the matrices changed, cleared by the shadow pass once the shadow map is up to date
+
+	glm::mat4 fittedCameraPV;	// The camera the projection was last fitted for
+	int fits;					// How often the projection was fitted
 	
 	void initMatrices()
 	{
@@ -111,17 +233,55 @@ struct LightParams
 				0.0f, 0.0f, 0.5f, 0.0f,
 				0.5f, 0.5f, 0.5f, 1.0f};
 		
-		Projection = glm::perspective(45.0f, 800.0f / 800.0f, 0.1f, 100.0f);
-		//Projection = glm::ortho(0.0f, TextureSize , 0.0f, TextureSize, 0.01f, 100.0f);
+		DefaultProjection = glm::perspective(45.0f, 800.0f / 800.0f, 0.1f, 100.0f);
+		Projection = DefaultProjection;
+		//Projection = glm::ortho(0.0f, shadowMapSize , 0.0f, shadowMapSize, 0.01f, 100.0f);
 		View = glm::lookAt(position, glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));//glm::lookAt(position, forward, glm::vec3(0.0f, 0.0f, 1.0f));
 		S = Bias * (Projection * (View));
+		changed = true;
+		countRecompute();
+	}
+
+	//Counts a computation of the light's matrices in the transformStats.
+	void countRecompute()
+	{
+		transformStats.light++;
+		transformStats.total++;
 	}
 
 	//this functions re-calculates the matrices when the position of the light changes.
 	void recaliberate()
 	{
+		glm::mat4 previous = S;
 		View = glm::lookAt(position, forward, glm::vec3(0.0f, 1.0f, 0.0f));
 		S = Bias * (Projection * (View));
+		changed = changed || (S != previous);
+		countRecompute();
+	}
+
+	//Fits the projection to the part of the scene the camera sees, and the casters which can shadow it. See LightFit.h.
+	void fitProjection(const glm::mat4 &cameraView, const glm::mat4 &cameraPV)
+	{
+		PROFILE_ZONE("light.fitProjection");
+		glm::vec3 frustum[8];
+		glm::vec4 frustumPlanes[6];
+		cameraFrustumCorners(cameraView, cameraPV, SHADOW_DISTANCE, frustum);
+		hexahedronPlanes(frustum, frustumPlanes);
+
+		// Every object receives shadows and casts them.
+		std::vector<glm::vec3> receivers;
+		for (int i = 0; i < scene.size(); i++)
+			intersectFrustumBox(frustum, frustumPlanes, scene.boxes[i], receivers);
+
+		glm::mat4 previous = S;
+		if (!fitLightProjection(View, receivers, scene.bounds, scene.boxes, Projection))
+			Projection = DefaultProjection;
+		S = Bias * (Projection * (View));
+		changed = changed || (S != previous);
+		countRecompute();
+
+		fittedCameraPV = cameraPV;
+		fits++;
 	}
 
 }light;
@@ -129,68 +289,170 @@ struct LightParams
 //This function sets up the geometry we will render. 
 void createGeometry()
 {
+	PROFILE_ZONE("createGeometry");
 	std::vector<VertexFormat> vertices;
+	std::vector<GLuint> indices;
 
 	float radius = 0.5f;
 	float pitch, yaw;
-	yaw = 0.0f;
-	pitch = 0.0f;
 	int i, j;
-	float pitchDelta = 360 / DIVISIONS;
-	float yawDelta = 360 / DIVISIONS;
+	// Pitch only has to go from one pole to the other (0 to 180 degrees), the yaw then goes all the way around.
+	int rings = sphereDivisions / 2;
+	float pitchDelta = 180.0f / rings;
+	float yawDelta = 360.0f / sphereDivisions;
 	glm::vec4 color(0.3f, 0.2f, 0.7f, 2.0f);
 
-	VertexFormat p1, p2, p3, p4;
+	VertexFormat p;
+
+	// Every point on the sphere is stored once. The poles are a single vertex each, and the seam at yaw = 360
+	// is the same vertex as yaw = 0, so all the triangles around a vertex share it.
+	p.position = glm::vec3(0.0f, 0.0f, radius);
+	p.normal = p.position;
+	p.color = color;
+	vertices.push_back(p);
 
-	for (i = 0; i < DIVISIONS; i++)
+	for (i = 1; i < rings; i++)
 	{
-		for (j = 0; j < DIVISIONS; j++)
+		pitch = i * pitchDelta;
+		for (j = 0; j < sphereDivisions; j++)
 		{
-			p1.position.x = radius * sin((pitch)* PI / 180.0) * cos((yaw)* PI / 180.0);
-			p1.position.y = radius * sin((pitch)* PI / 180.0) * sin((yaw)* PI / 180.0);;
-			p1.position.z = radius * cos((pitch)* PI / 180.0);
-			p1.normal = p1.position;
-			p1.color = color;
-
-
-			p2.position.x = radius * sin((pitch)* PI / 180.0) * cos((yaw + yawDelta)* PI / 180.0);
-			p2.position.y = radius * sin((pitch)* PI / 180.0) * sin((yaw + yawDelta)* PI / 180.0);;
-			p2.position.z = radius * cos((pitch)* PI / 180.0);
-			p2.normal = p2.position;
-			p2.color = color;
-
-			p3.position.x = radius * sin((pitch + pitchDelta)* PI / 180.0) * cos((yaw + yawDelta)* PI / 180.0);
-			p3.position.y = radius * sin((pitch + pitchDelta)* PI / 180.0) * sin((yaw + yawDelta)* PI / 180.0);;
-			p3.position.z = radius * cos((pitch + pitchDelta)* PI / 180.0);
-			p3.normal = p3.position;
-			p3.color = color;
-
-			p4.position.x = radius * sin((pitch + pitchDelta)* PI / 180.0) * cos((yaw)* PI / 180.0);
-			p4.position.y = radius * sin((pitch + pitchDelta)* PI / 180.0) * sin((yaw)* PI / 180.0);;
-			p4.position.z = radius * cos((pitch + pitchDelta)* PI / 180.0);
-			p4.normal = p4.position;
-			p4.color = color;
-
-			vertices.push_back(p1);
-			vertices.push_back(p2);
-			vertices.push_back(p3);
-			vertices.push_back(p1);
-			vertices.push_back(p3);
-			vertices.push_back(p4);
-
-			yaw = yaw + yawDelta;
+			yaw = j * yawDelta;
+			p.position.x = radius * sin((pitch)* PI / 180.0) * cos((yaw)* PI / 180.0);
+			p.position.y = radius * sin((pitch)* PI / 180.0) * sin((yaw)* PI / 180.0);
+			p.position.z = radius * cos((pitch)* PI / 180.0);
+			p.normal = p.position;
+			vertices.push_back(p);
 		}
+	}
+
+	p.position = glm::vec3(0.0f, 0.0f, -radius);
+	p.normal = p.position;
+	vertices.push_back(p);
 
-		pitch += pitchDelta;
+	// Returns the index of the vertex on ring i (0 and rings being the poles) at segment j.
+	auto index = [&](int i, int j) -> GLuint
+	{
+		if (i == 0)
+			return 0;
+		if (i == rings)
+			return vertices.size() - 1;
+		return 1 + (i - 1) * sphereDivisions + (j % sphereDivisions);
+	};
+
+	// Each quad p1 p2 p3 p4 is split into the triangles p1 p2 p3 and p1 p3 p4.
+	// At the poles one of the two collapses into a line, so we leave it out.
+	for (i = 0; i < rings; i++)
+	{
+		for (j = 0; j < sphereDivisions; j++)
+		{
+			GLuint p1 = index(i, j);
+			GLuint p2 = index(i, j + 1);
+			GLuint p3 = index(i + 1, j + 1);
+			GLuint p4 = index(i + 1, j);
+
+			if (i > 0)
+			{
+				indices.push_back(p1);
+				indices.push_back(p2);
+				indices.push_back(p3);
+			}
+			if (i < rings - 1)
+			{
+				indices.push_back(p1);
+				indices.push_back(p3);
+				indices.push_back(p4);
+			}
+		}
+	}
+
+	float generatedACMR = computeACMR(indices, ACMR_CACHE_SIZE);
+	indices = optimizeVertexCache(indices, vertices.size());
+	float optimizedACMR = computeACMR(indices, ACMR_CACHE_SIZE);
+
+	// Compare against drawing the same sphere without indices: 6 vertices per quad for the full 360 degrees of pitch.
+	int unindexedVertices = sphereDivisions * sphereDivisions * 6;
+	std::cout << "Sphere mesh (ACMR simulated with a " << ACMR_CACHE_SIZE << " entry FIFO cache):\n";
+	std::cout << "  unindexed: " << unindexedVertices / 3 << " triangles, " << unindexedVertices << " vertices, "
+		<< unindexedVertices * sizeof(VertexFormat) << " bytes, ACMR 3\n";
+	std::cout << "  indexed:   " << indices.size() / 3 << " triangles, " << vertices.size() << " vertices, "
+		<< vertices.size() * vertexLayout.stride() + indices.size() * sizeof(GLuint) << " bytes, ACMR "
+		<< generatedACMR << " before / " << optimizedACMR << " after reordering\n";
+	std::cout << "  vertex layout: " << vertexLayout.stride() << " bytes per vertex (VertexFormat: " << sizeof(VertexFormat)
+		<< "), " << vertexLayout.positionSize() << " bytes in the depth pass (float3: " << sizeof(glm::vec3) << ")\n";
+
+	// Both spheres use the same mesh, so it is uploaded once and each sphere is an object drawing it.
+	int sphereMesh = meshRegistry.add("sphere", vertices.size(), &vertices[0], indices.size(), &indices[0]);
+
+	// The spheres are solid, so they can hide other objects.
+	meshRegistry.setOccluder(sphereMesh, vertices.size(), &vertices[0], indices.size(), &indices[0]);
+
+	std::vector<glm::vec3> positions;
+	if (sphereCount > 0)
+		positions.push_back(glm::vec3(0.0f));
+	if (sphereCount > 1)
+		positions.push_back(glm::vec3(-1.0f, 0.0f, -2.0f));
+
+	// Any more spheres (see --objects) stand in a grid over the plane.
+	int extra = sphereCount - 2;
+	int perRow = (int)ceil(sqrt((float)std::max(extra, 1)));
+	float spacing = 18.0f / perRow;
+	for (int k = 0; k < extra; k++)
+		positions.push_back(glm::vec3(-9.0f + spacing * (k % perRow + 0.5f), 0.0f, -9.0f + spacing * (k / perRow + 0.5f)));
+
+	// The last dynamicSphereCount spheres bounce (see update), so they are drawn over the cached static shadow map.
+	int firstMoving = (int)positions.size() - std::min(dynamicSphereCount, (int)positions.size());
+	for (int k = 0; k < (int)positions.size(); k++)
+	{
+		ObjectHandle handle = scene.create(sphereMesh, glm::translate(glm::mat4(1), positions[k]), 0, k >= firstMoving);
+		if (k >= firstMoving)
+		{
+			movingSpheres.push_back(handle);
+			restingPositions.push_back(positions[k]);
+		}
 	}
 
-	sphere1.base.initBuffer(vertices.size(), &vertices[0]);
-	sphere2.base.initBuffer(vertices.size(), &vertices[0]);
+	// The plane lies just below the spheres, so they touch it.
+	scene.create(createPlaneMesh(), glm::translate(glm::mat4(1), glm::vec3(0.0f, -0.5f, 0.0f)));
+}
 
-	sphere1.origin = glm::vec3(0.0f);
-	sphere2.origin = glm::vec3(-1.0f, 0.0f, -2.0f);
-	sphere1.radius = radius;
-	sphere2.radius = radius;
+//Spreads count spot lights in a grid over the plane, pointing down and a little towards the middle, each in its own color.
+void createSpotLights(int count)
+{
+	int perRow = (int)ceil(sqrt((float)count));
+	float spacing = 18.0f / std::max(perRow, 1);
+	for (int i = 0; i < count; i++)
+	{
+		glm::vec3 position(-9.0f + spacing * (i % perRow + 0.5f), 2.5f, -9.0f + spacing * (i / perRow + 0.5f));
+		glm::vec3 direction = glm::vec3(0.0f, -2.5f, 0.0f) - 0.2f * glm::vec3(position.x, 0.0f, position.z);
+		float hue = 6.2831853f * i / std::max(count, 1);
+		glm::vec3 color = 0.2f + 0.2f * glm::vec3(cos(hue), cos(hue - 2.0944f), cos(hue + 2.0944f));
+		shadowAtlas.add(position, direction, color, 6.0f, 0.6f);
+	}
+}
+
+//Creates the texture and FBO holding the depth of the static casters only. It is never sampled, just copied into depthTex.
+void setStaticFrameBuffer()
+{
+	glGenFramebuffers(1, &staticFboHandle);
+	glBindFramebuffer(GL_FRAMEBUFFER, staticFboHandle);
+
+	glGenTextures(1, &staticDepthTex);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, staticDepthTex);
+	// Same size, format and number of layers as depthTex, which glCopyImageSubData needs.
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT32, shadowMapSize, shadowMapSize, NUM_CASCADES);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+	// The first pass attaches the layer of the cascade it is rendering.
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, staticDepthTex, 0, 0);
+
+	GLenum drawbuf[] = { GL_NONE };
+	glDrawBuffers(1, drawbuf);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		std::cout << "Static frame buffer not created. \n" << glCheckFramebufferStatus(GL_FRAMEBUFFER);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
 void setFrameBUffer()
@@ -203,27 +465,27 @@ void setFrameBUffer()
 	glGenFramebuffers(1, &fboHandle);
 	glBindFramebuffer(GL_FRAMEBUFFER, fboHandle);
 
-	//generate the depth buffer
+	//generate the depth buffer. Every cascade gets a layer of the same size.
 	glGenTextures(1, &depthTex);
-	glBindTexture(GL_TEXTURE_2D, depthTex);
-	glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32, TextureSize, TextureSize);
-	//glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32, TextureSize, TextureSize, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, depthTex);
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT32, shadowMapSize, shadowMapSize, NUM_CASCADES);
+	// Every kernel but PCF_NONE filters linearly, which makes the hardware compare against the 4 nearest texels and blend the results (see ShadowFilter.h).
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, shadowFilter.textureFilter());
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, shadowFilter.textureFilter());
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
 	// if the texture coordinate, is out of bounds, we want it to return true and not false. hence we set the border value.
-	glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, border);
+	glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
 	// by setting the compare mode, the texture sampling won't return a rgb value, instead it will return 1 or 0 based on 
 	// comparing the the current depth woth the value stored in the texture.
-	// For sampling, instead of using texture(), we shall use textureProj()
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LESS);
+	// For sampling, we pass the depth to compare against to texture() along with the coordinates and the layer.
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LESS);
 
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, depthTex);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, depthTex);
 
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTex, 0);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTex, 0, 0);
 
 	GLenum drawbuf[] = { GL_NONE };
 
@@ -234,36 +496,101 @@ void setFrameBUffer()
 
 	//unbind the frame buffer
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	setStaticFrameBuffer();
 }
 
 void setup()
 {
+	PROFILE_ZONE("setup");
+	// Every program is requested before any of them is used, so the driver can compile them all at the same time.
+	// init() already requested the depth and lit pass programs. See ProgramCache.h.
+	pointShadowMap.requestPrograms();
+	shadowAtlas.requestPrograms();
+	gpuCulling.requestPrograms();
+	hiZCulling.requestPrograms();
+
 	setFrameBUffer();
 
 	createGeometry();
-
-	plane.initBuffer();
 	
-	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 1.0f, 3.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-	glm::mat4 proj = glm::perspective(45.0f, 800.0f / 800.0f, 0.1f, 100.0f);
+	camera.init();
+	camera.update();
+
+	light.initMatrices();
+
+	// The block bindings are stored in the program, so it doesn't matter that the second call overwrites the indices.
+	uniforms.initUniforms(program);
+	uniforms.initUniforms(renderProgram);
 
-	PV = proj * view;
+	frameRing.init();
 
-	sphere1.MVP = PV * glm::translate(glm::mat4(1), sphere1.origin);
-	sphere1.ModelView = view * glm::translate(glm::mat4(1), sphere1.origin);
-	sphere1.NormalMatrix = glm::transpose(glm::inverse( glm::mat3(sphere1.ModelView)));
+	momentShadowMap.init(shadowMapSize, NUM_CASCADES, shadowFilter);
 
-	sphere2.MVP = PV * glm::translate(glm::mat4(1), sphere2.origin);
-	sphere2.ModelView = view * glm::translate(glm::mat4(1), sphere2.origin);
-	sphere2.NormalMatrix = glm::transpose(glm::inverse(glm::mat3(sphere2.ModelView)));
+	pointShadowMap.init();
+	uniforms.initUniforms(pointShadowMap.program);
 
-	plane.MVP = PV * glm::translate(glm::mat4(1), plane.origin);
-	plane.ModelView = view * glm::translate(glm::mat4(1), plane.origin);
-	plane.NormalMatrix = glm::transpose(glm::inverse(glm::mat3(plane.ModelView)));
+	shadowAtlas.init();
+	uniforms.initUniforms(shadowAtlas.program);
+	createSpotLights(spotLightCount);
 
-	light.initMatrices();
+	gpuCulling.init(meshRegistry);
 
+	// The Hi-Z culling is the second phase of the GPU culling.
+	hiZCulling.init();
+	uniforms.initUniforms(hiZCulling.program);
+	if (hiZCulling.enabled)
+		gpuCulling.enabled = gpuCulling.twoPhase = true;
+
+	// Starts the threads which rasterize the occluders, once for the whole run.
+	occlusionCulling.init();
+}
+
+//Switches the lit pass to another shadow filter, drawn with the given program, which was requested for it.
+void switchShadowFilter(const ShadowFilter &filter, GLuint filterProgram)
+{
+	shadowFilter = filter;
+	programCache.release(renderProgram);
+	renderProgram = filterProgram;
 	uniforms.initUniforms(renderProgram);
+
+	// The moment map is only built from the shadow map when that changes, so make sure it does.
+	momentShadowMap.init(shadowMapSize, NUM_CASCADES, shadowFilter);
+	light.changed = true;
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, depthTex);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, shadowFilter.textureFilter());
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, shadowFilter.textureFilter());
+}
+
+//Switches the lit pass to another shadow filter right away. The program is compiled again with the filter's defines.
+void setShadowFilter(const ShadowFilter &filter)
+{
+	switchShadowFilter(filter, requestRenderProgram(filter));
+}
+
+// The filter requestShadowFilter asked for, and its program, until the program is ready.
+ShadowFilter pendingFilter;
+GLuint pendingRenderProgram = 0;
+
+//Switches the lit pass to another shadow filter once its program is compiled. Until then, it keeps the filter it has.
+void requestShadowFilter(const ShadowFilter &filter)
+{
+	if (pendingRenderProgram != 0)
+		programCache.release(pendingRenderProgram);
+	pendingFilter = filter;
+	pendingRenderProgram = requestRenderProgram(filter);
+	momentShadowMap.requestPrograms(filter);
+}
+
+//Switches to the requested filter if its program is ready. Called every frame.
+void updateShadowFilter()
+{
+	if (pendingRenderProgram == 0 || !programCache.ready(pendingRenderProgram) || !momentShadowMap.programsReady())
+		return;
+
+	switchShadowFilter(pendingFilter, pendingRenderProgram);
+	pendingRenderProgram = 0;
 }
 
 // Functions called between every frame. game logic
@@ -272,10 +599,49 @@ void setup()
 // This runs once every physics timestep.
 void update()
 {
+	PROFILE_ZONE("update");
+#ifdef HEADLESS
+	// Without a window, every frame is one step of the benchmark's timestep, so runs can be repeated.
+	simulationTime += BENCHMARK_TIMESTEP;
+#else
+	simulationTime = glfwGetTime();
+#endif
+
+	// The moving spheres hop off the plane and back. Only the dynamic part of the shadow map has to be redrawn for them.
+	float height = 0.5f - 0.5f * (float)cos(2.0 * PI * simulationTime / BOUNCE_PERIOD);
+	for (unsigned int i = 0; i < movingSpheres.size(); i++)
+		scene.setTransform(movingSpheres[i], glm::translate(glm::mat4(1), restingPositions[i] + glm::vec3(0.0f, height, 0.0f)));
 }
 
 void firstDrawPass()
 {
+	PROFILE_ZONE("firstDrawPass");
+	// The shadow map only depends on the light, the cascades and the casters. If none of them changed, last frame's map is still valid.
+	bool staticDirty = light.changed || shadowCascades.changed || scene.staticChanged;
+	bool dynamicDirty = scene.dynamicChanged;
+	bool hasDynamic = scene.hasDynamicObjects();
+	// If the static casters were last drawn straight into depthTex, the cache has to be filled before dynamic casters can go over it.
+	if (dynamicDirty && hasDynamic && !staticDepthCurrent)
+		staticDirty = true;
+	if (!staticDirty && !dynamicDirty)
+	{
+		shadowCacheStats.skipped++;
+		return;
+	}
+
+	// The point light's cube map is drawn in one go. It isn't split into static and dynamic casters.
+	if (shadowFilter.cubeMap)
+	{
+		GpuTimed timed("point shadows");
+		pointShadowMap.render(meshRegistry, scene);
+		shadowCacheStats.staticRenders++;
+		shadowCacheStats.texelsRendered += 6LL * POINT_SHADOW_SIZE * POINT_SHADOW_SIZE;
+		light.changed = false;
+		scene.staticChanged = false;
+		scene.dynamicChanged = false;
+		return;
+	}
+
 	glUseProgram(program);
 
 	// GL_Polygonoffset displaces the depth value by an offest which is computed using the values we give as parameters.
@@ -283,109 +649,242 @@ void firstDrawPass()
 	// Commenting out the two lines below would produce "shadow acne".
 	glEnable(GL_POLYGON_OFFSET_FILL);
 	glPolygonOffset(1.0f, 1.0f);
+	// The light isn't fitted again when dynamic casters move, so one can come closer than the near plane.
+	// Its depth is clamped to the near plane instead of being clipped away, and it still casts its shadow.
+	glEnable(GL_DEPTH_CLAMP);
 	
-	//Render from the perspective of the camera
-	glBindFramebuffer(GL_FRAMEBUFFER, fboHandle);
-	glClear(GL_DEPTH_BUFFER_BIT);
-	//glClearDepth(0.5f);
-	glViewport(0, 0, WindowSize, WindowSize);
-	{
-		glCullFace(GL_FRONT);
-		glm::mat4 MVP;
-		glm::mat4 PV = light.Projection * light.View;
+	glViewport(0, 0, shadowMapSize, shadowMapSize);
+	glCullFace(GL_FRONT);
 
-		//Plane
-		MVP = PV * (glm::translate(glm::mat4(1), plane.origin));
-		glUniformMatrix4fv(uniMVP, 1, GL_FALSE, glm::value_ptr(MVP));
-		glBindVertexArray(plane.base.vao);
-		glBindBuffer(GL_ARRAY_BUFFER, plane.base.vbo);
-		glDrawArrays(GL_TRIANGLES, 0, plane.numberOfVertices);
+	// The cascades' matrices and the model matrices come from the frameRing.
+	// Only the position stream is needed for depth.
+	std::vector<bool> visible;
+	if (staticDirty)
+	{
+		GpuTimed timed("static casters");
 
-		//Sphere1
-		MVP = PV * (glm::translate(glm::mat4(1), sphere1.origin));
-		glUniformMatrix4fv(uniMVP, 1, GL_FALSE, glm::value_ptr(MVP));
-		glBindVertexArray(sphere1.base.vao);
-		glBindBuffer(GL_ARRAY_BUFFER, sphere1.base.vbo);
-		glDrawArrays(GL_TRIANGLES, 0, sphere1.base.numberOfVertices);
+		//Render the static casters from the perspective of the light into each cascade's layer. This is what gets cached.
+		//With no dynamic casters to draw over them, they go straight into depthTex and there is nothing to copy.
+		GLuint target = hasDynamic ? staticDepthTex : depthTex;
+		glBindFramebuffer(GL_FRAMEBUFFER, hasDynamic ? staticFboHandle : fboHandle);
+		for (int i = 0; i < NUM_CASCADES; i++)
+		{
+			glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, target, 0, i);
+			glClear(GL_DEPTH_BUFFER_BIT);
+			glUniform1i(uniforms.uni_Cascade, i);
+
+			// Casters which can't be seen in this cascade's part of the light's image are left out.
+			// The GPU culling already left out those outside the light's frustum, and can't do better per cascade.
+			if (gpuCulling.enabled)
+			{
+				gpuCulling.drawCasters(meshRegistry, STATIC_CASTERS);
+				continue;
+			}
+			cullingStats.shadowCulled += shadowCascades.cullCasters(i, scene.objectBounds, visible);
+			cullingStats.shadowTested += visible.size();
+			meshRegistry.draw(true, STATIC_CASTERS, &visible);
+		}
+		shadowCacheStats.staticRenders++;
+		shadowCacheStats.texelsRendered += (long long)NUM_CASCADES * shadowMapSize * shadowMapSize;
+		staticDepthCurrent = hasDynamic;
+	}
 
-		//Sphere2
-		MVP = PV * (glm::translate(glm::mat4(1), sphere2.origin));
-		glUniformMatrix4fv(uniMVP, 1, GL_FALSE, glm::value_ptr(MVP));
-		glBindVertexArray(sphere2.base.vao);
-		glBindBuffer(GL_ARRAY_BUFFER, sphere2.base.vbo);
-		glDrawArrays(GL_TRIANGLES, 0, sphere2.base.numberOfVertices);
+	// Start from the cached static depth, and draw the dynamic casters on top of it.
+	// This also takes the last dynamic casters out again after they were all removed.
+	if (staticDepthCurrent)
+		glCopyImageSubData(staticDepthTex, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, depthTex, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, shadowMapSize, shadowMapSize, NUM_CASCADES);
 
+	if (hasDynamic)
+	{
+		GpuTimed timed("dynamic casters");
+		glBindFramebuffer(GL_FRAMEBUFFER, fboHandle);
+		for (int i = 0; i < NUM_CASCADES; i++)
+		{
+			glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTex, 0, i);
+			glUniform1i(uniforms.uni_Cascade, i);
+			if (gpuCulling.enabled)
+			{
+				gpuCulling.drawCasters(meshRegistry, DYNAMIC_CASTERS);
+				continue;
+			}
+			cullingStats.shadowCulled += shadowCascades.cullCasters(i, scene.objectBounds, visible);
+			cullingStats.shadowTested += visible.size();
+			meshRegistry.draw(true, DYNAMIC_CASTERS, &visible);
+		}
+		shadowCacheStats.dynamicRenders++;
+		shadowCacheStats.texelsRendered += (long long)NUM_CASCADES * shadowMapSize * shadowMapSize;
 	}
 
 	glDisable(GL_POLYGON_OFFSET_FILL);
+	glDisable(GL_DEPTH_CLAMP);
+
+	// With a VSM or EVSM filter, the moments are computed from the new depth and blurred.
+	if (shadowFilter.moments != MOMENTS_NONE)
+	{
+		GpuTimed timed("moment blur");
+		momentShadowMap.update(depthTex);
+	}
+
+	light.changed = false;
+	shadowCascades.changed = false;
+	scene.staticChanged = false;
+	scene.dynamicChanged = false;
 }
 
 void secondDrawPass()
 {
+	PROFILE_ZONE("secondDrawPass");
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, sceneFbo);
 	// This function acts on the frabe buffer currently in use. 
 	// So if we use this statement before unbinding the framebuffer, it will clear the depth texture attached to it and also all the data we had stored in it.
 	glClear(GL_DEPTH_BUFFER_BIT);			
 	glUseProgram(renderProgram);
 	
 	//Rendering to the main window.
-	// We have to calculate the shadow matrix for each game object and pass it into the shader
+	// The shadow matrix of each game object is the light's S matrix times the object's model matrix, which the shader calculates per instance
 	glViewport(0, 0, WindowSize, WindowSize);
 	{
 		glCullFace(GL_BACK);
 		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, depthTex);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, depthTex);
+		momentShadowMap.bind();
+		pointShadowMap.bind();
+		shadowAtlas.bind();
+
+		if (gpuCulling.enabled)
+			gpuCulling.drawLit(meshRegistry);
+		else
+			meshRegistry.draw(false, ALL_CASTERS, &litVisible);
+	}
+}
 
-		glUniform3fv(uniforms.vec3_LightPos, 1, glm::value_ptr(light.position));
-		glUniform3fv(uniforms.vec3_LightIntensity, 1, glm::value_ptr(light.Intensity));
+// Fills litVisible with the objects the camera can see: those inside its frustum, which the occluders don't hide.
+// The shadow passes do their own culling, since objects the camera can't see can still cast shadows it can.
+void cullObjects()
+{
+	PROFILE_ZONE("cullObjects");
+	cullingStats.viewCulled = Frustum(PV).cullSpheres(scene.objectBounds, litVisible);
+	cullingStats.viewTested = litVisible.size();
+	cullingStats.occluded = 0;
+#if OCCLUSION_CULLING
+	occlusionCulling.begin(PV);
+	for (int i = 0; i < scene.size(); i++)
+	{
+		Mesh &mesh = meshRegistry.meshes[scene.meshIDs[i]];
+		if (!mesh.occluderIndices.empty())
+			occlusionCulling.addOccluder(mesh.occluderPositions, mesh.occluderIndices, scene.models[i]);
+	}
+	occlusionCulling.rasterize();
 
-		glm::mat4 shadowMat;
-		
-		//Sphere1
-		glUniformMatrix4fv(uniforms.mat4_MVP, 1, GL_FALSE, glm::value_ptr(sphere1.MVP));
-		glUniformMatrix4fv(uniforms.mat4_ModelViewMatrix, 1, GL_FALSE, glm::value_ptr(sphere1.ModelView));
-		glUniformMatrix3fv(uniforms.mat3_NormalMatrix, 1, GL_FALSE, glm::value_ptr(sphere1.NormalMatrix));
-		shadowMat = light.S * glm::translate(glm::mat4(1), sphere1.origin);	//Calculating the shadow matrix
-		glUniformMatrix4fv(uniforms.mat4_ShadowMatrix, 1, GL_FALSE, glm::value_ptr(shadowMat));
-		glBindVertexArray(sphere1.base.vao);
-		glBindBuffer(GL_ARRAY_BUFFER, sphere1.base.vbo);
-		glDrawArrays(GL_TRIANGLES, 0, sphere1.base.numberOfVertices);
-
-		//Sphere2
-		glUniformMatrix4fv(uniforms.mat4_MVP, 1, GL_FALSE, glm::value_ptr(sphere2.MVP));
-		glUniformMatrix4fv(uniforms.mat4_ModelViewMatrix, 1, GL_FALSE, glm::value_ptr(sphere2.ModelView));
-		glUniformMatrix3fv(uniforms.mat3_NormalMatrix, 1, GL_FALSE, glm::value_ptr(sphere2.NormalMatrix));
-		shadowMat = light.S * glm::translate(glm::mat4(1), sphere2.origin);
-		glUniformMatrix4fv(uniforms.mat4_ShadowMatrix, 1, GL_FALSE, glm::value_ptr(shadowMat));
-		glBindVertexArray(sphere2.base.vao);
-		glBindBuffer(GL_ARRAY_BUFFER, sphere2.base.vbo);
-		glDrawArrays(GL_TRIANGLES, 0, sphere2.base.numberOfVertices);
-
-		//Plane
-		glUniformMatrix4fv(uniforms.mat4_MVP, 1, GL_FALSE, glm::value_ptr(plane.MVP));
-		glUniformMatrix4fv(uniforms.mat4_ModelViewMatrix, 1, GL_FALSE, glm::value_ptr(plane.ModelView));
-		glUniformMatrix3fv(uniforms.mat3_NormalMatrix, 1, GL_FALSE, glm::value_ptr(plane.NormalMatrix));
-		shadowMat = light.S * glm::translate(glm::mat4(1), plane.origin);
-		glUniformMatrix4fv(uniforms.mat4_ShadowMatrix, 1, GL_FALSE, glm::value_ptr(shadowMat));
-		glBindVertexArray(plane.base.vao);
-		glBindBuffer(GL_ARRAY_BUFFER, plane.base.vbo);
-		glDrawArrays(GL_TRIANGLES, 0, plane.numberOfVertices);
+	// Only what's in view is worth testing.
+	for (unsigned int i = 0; i < litVisible.size(); i++)
+	{
+		if (litVisible[i] && occlusionCulling.occluded(scene.objectBounds[i]))
+		{
+			litVisible[i] = false;
+			cullingStats.occluded++;
+		}
 	}
+#endif
+}
+
+// Writes everything the shaders need this frame into the frameRing, and binds it.
+void uploadFrameConstants()
+{
+	PROFILE_ZONE("uploadFrameConstants");
+	FrameConstants* constants = frameRing.beginFrame();
+	constants->PV = PV;
+	constants->View = View;
+	for (int i = 0; i < NUM_CASCADES; i++)
+	{
+		constants->CascadePV[i] = shadowCascades.PV[i];
+		constants->CascadeSplits[i] = shadowCascades.splits[i];
+	}
+	constants->lightIntensity = glm::vec4(light.Intensity, 0.0f);
+
+	int objectCount = scene.writeObjects(meshRegistry, frameRing.objects(), MAX_OBJECTS);
+
+	// The cube map's far plane depends on where the objects are, so it is set once their bounds are known.
+	if (shadowFilter.cubeMap)
+		pointShadowMap.updateMatrices(light.position, scene.objectBounds);
+	constants->lightPosition = glm::vec4(light.position, pointShadowMap.farPlane);
+	int spotLightCount = shadowAtlas.writeLights(frameRing.spotLights(), MAX_SPOT_LIGHTS);
+	frameRing.bind(objectCount, spotLightCount);
 }
 
 // This function runs every frame
 void renderScene()
 {
+	PROFILE_ZONE("renderScene");
+	gpuTimers.beginFrame();
+	transformStats.beginFrame();
+
+	// Programs which finished compiling since the last frame are checked and saved, and a requested filter is switched to.
+	programCache.update();
+	updateShadowFilter();
+	meshRegistry.drawCalls = 0;
+	meshRegistry.commandsDrawn = 0;
+	meshRegistry.trianglesDrawn = 0;
+
+	// Only what moved since the last frame gets its matrices computed again.
+	camera.update();
+	scene.updateTransforms();
+
+	// The light's frustum only has to be fitted again if the light, the camera or a static object moved.
+	// Refitting it for the dynamic objects would change every texel, and the static casters would have to be drawn again each time.
+	if (light.changed || scene.staticChanged || PV != light.fittedCameraPV)
+		light.fitProjection(View, PV);
+
+	// The cascades follow the camera, so they are fitted again every frame. They only flag a change if they actually moved.
+	shadowCascades.update(View, PV, light.Projection * light.View, shadowMapSize);
+
+	// Pick the spot lights which can be seen, and give them tiles in the atlas.
+	shadowAtlas.update(View, PV, WindowSize);
+
+	uploadFrameConstants();
+
+	// The objects' bounds are known once they are in the frame's object array.
+	if (gpuCulling.enabled)
+	{
+		GpuTimed timed("gpu culling");
+		gpuCulling.cull(meshRegistry, scene, PV, light.Projection * light.View);
+	}
+	else
+		cullObjects();
+
+	// Objects hidden behind what was visible last frame are left out of the lit pass.
+	if (gpuCulling.twoPhase)
+	{
+		GpuTimed timed("hi-z culling");
+		hiZCulling.update(meshRegistry, gpuCulling, PV);
+	}
+
+	// The atlas has to know whether the casters moved before firstDrawPass clears the flags.
+	{
+		GpuTimed timed("spot light shadows");
+		shadowAtlas.render(meshRegistry, scene, scene.staticChanged || scene.dynamicChanged);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, sceneFbo);
+
 	// Clear the color buffer and the depth buffer
 	glClear(GL_COLOR_BUFFER_BIT);
 
 	// Clear the screen to white
 	glClearColor(1.0, 1.0, 1.0, 1.0);
 
+	gpuTimers.begin("first pass");
 	firstDrawPass();
+	gpuTimers.end();
 
+	gpuTimers.begin("second pass");
 	secondDrawPass();
+	gpuTimers.end();
+
+	// Both passes have been submitted, so this frame's section of the ring can be fenced.
+	frameRing.endFrame();
+	gpuTimers.endFrame();
 }
 
 #pragma endregion Helper_functions
@@ -409,14 +908,562 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 			light.position += glm::vec3(0, -1, 0) * speed;
 		if (key == GLFW_KEY_R)
 			light.position = glm::vec3(0.1f, 10, 0);
+
+		//Cycles through the shadow filters. The lit pass keeps the filter it has until the next one's program is compiled.
+		if (key == GLFW_KEY_F && action == GLFW_PRESS)
+		{
+			static const char* filters[] = { "none", "hardware", "grid3", "grid5", "poisson8", "poisson16", "vsm", "evsm", "cube" };
+			static int current = 0;
+			current = (current + 1) % 9;
+			ShadowFilter filter;
+			ShadowFilter::parse(filters[current], filter);
+			requestShadowFilter(filter);
+			std::cout << "Switching to the " << filter.name() << " shadow filter\n";
+		}
+
+		//Writes how long the passes took on the GPU, in every frame read so far.
+		if (key == GLFW_KEY_T && action == GLFW_PRESS && gpuTimers.write("gpu_times.csv"))
+			std::cout << "GPU times written to gpu_times.csv\n";
 		
 		//Once the light source is changed, the matrices need to be recalculated
 		light.recaliberate();
 	}
 }
 
-void main()
+#ifdef HEADLESS
+// Renders the given number of frames into the offscreen target and prints how long each one took.
+// glFinish() makes sure the time includes the GPU work of the frame and not just the time to submit it.
+// With switchTo, the shadow filter is switched to it after the first frame, without waiting for its program.
+void runHeadless(int frames, const ShadowFilter *switchTo)
+{
+	double total = 0.0, fastest = 1e9, slowest = 0.0;
+
+	for (int i = 0; i < frames; i++)
+	{
+		if (i == 1 && switchTo != nullptr)
+			requestShadowFilter(*switchTo);
+
+		auto start = std::chrono::high_resolution_clock::now();
+
+		update();
+		renderScene();
+		{
+			PROFILE_ZONE("glFinish");
+			glFinish();
+		}
+
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		std::cout << "frame " << i << ": " << ms << " ms" << (pendingRenderProgram != 0 ? " (new filter still compiling)" : "") << "\n";
+
+		total += ms;
+		fastest = std::min(fastest, ms);
+		slowest = std::max(slowest, ms);
+	}
+
+	if (frames > 0)
+		std::cout << frames << " frames, avg " << total / frames << " ms, min " << fastest << " ms, max " << slowest << " ms\n";
+
+	std::cout << "shadow map: " << shadowCacheStats.staticRenders << " static renders, " << shadowCacheStats.dynamicRenders
+		<< " dynamic renders, " << shadowCacheStats.skipped << " frames reused\n";
+	std::cout << "light frustum: fitted " << light.fits << " times\n";
+	std::cout << "matrices: " << transformStats.objects << " objects, " << transformStats.camera << " camera and "
+		<< transformStats.light << " light recomputes in the last frame, " << transformStats.total << " in total\n";
+	std::cout << "cascades: " << NUM_CASCADES << " layers of " << shadowMapSize << "x" << shadowMapSize << ", split at";
+	for (int i = 0; i < NUM_CASCADES; i++)
+		std::cout << " " << shadowCascades.splits[i];
+	std::cout << "\n";
+	// With the GPU culling, the CPU's culling statistics aren't updated, and the results are read back instead.
+	if (!gpuCulling.enabled)
+		std::cout << "culling: " << cullingStats.viewCulled << " of " << cullingStats.viewTested << " objects outside the view and "
+			<< cullingStats.occluded << " hidden in the last frame, " << cullingStats.shadowCulled << " of " << cullingStats.shadowTested
+			<< " caster draws outside the shadow maps\n";
+	else
+	{
+		int firstPhase, revealed, casters;
+		gpuCulling.readCounts(firstPhase, revealed, casters);
+		std::cout << "gpu culling: " << gpuCulling.objectsTested << " objects tested in " << gpuCulling.groups << " work groups, "
+			<< firstPhase + revealed << " drawn by the lit pass and " << casters << " casters inside the light's frustum in the last frame\n";
+		if (gpuCulling.twoPhase)
+			std::cout << "hi-z culling: " << firstPhase << " objects visible in the frame before, " << revealed << " revealed, "
+				<< gpuCulling.objectsTested - firstPhase - revealed << " hidden or outside the view in the last frame\n";
+	}
+	std::cout << "draws: " << meshRegistry.drawCalls << " draw calls for " << meshRegistry.commandsDrawn << " draw commands in the last frame\n";
+	std::cout << "occlusion culling: " << occlusionCulling.trianglesDrawn << " occluder triangles in the last frame\n";
+	std::cout << "shadow atlas: " << shadowAtlas.lights.size() << " spot lights, " << shadowAtlas.visibleLights.size() << " in view, "
+		<< shadowAtlas.tilesRendered << " tiles rendered, " << shadowAtlas.tilesReused << " reused, " << shadowAtlas.evictions
+		<< " evicted, " << shadowAtlas.unshadowed << " times a light got no tile\n";
+}
+
+// Renders frames along the scripted path of Benchmark.h with the GPU culling, and after each one compares what the compute
+// shader culled with the CPU culling of the same objects (see GpuCulling::check). Returns how many results disagreed.
+int runCullingCheck(int frames)
+{
+	gpuCulling.enabled = true;
+	int mismatches = 0, failedFrames = 0;
+	for (int i = 0; i < frames; i++)
+	{
+		double time = i * BENCHMARK_TIMESTEP;
+		camera.position = benchmarkPath.cameraPosition(time);
+		camera.changed = true;
+		light.position = benchmarkPath.lightPosition(time);
+		light.recaliberate();
+
+		update();
+		renderScene();
+
+		int frameMismatches = gpuCulling.check(scene);
+		if (frameMismatches > 0)
+		{
+			std::cout << "frame " << i << ": " << frameMismatches << " objects culled differently than on the CPU\n";
+			failedFrames++;
+		}
+		mismatches += frameMismatches;
+	}
+
+	std::cout << "gpu culling check: " << frames << " frames of " << gpuCulling.objectsTested << " objects, "
+		<< (gpuCulling.twoPhase ? "two phases, " : "") << mismatches << " differences from the CPU culling in " << failedFrames << " frames\n";
+	return mismatches;
+}
+
+// Renders frames along the scripted path of Benchmark.h, and prints how long they took, how many triangles were drawn
+// and how fast the shadow map was filled. With a results file, the run is also appended to it.
+// The BENCHMARK_WARMUP frames before the start of the path are rendered as well, but not timed.
+void runScriptedBenchmark(int frames, const std::string &resultsFile)
 {
+	BenchmarkRun run;
+	run.divisions = sphereDivisions;
+	run.shadowMapSize = shadowMapSize;
+	run.objects = sphereCount;
+	run.dynamicObjects = (int)movingSpheres.size();
+	run.spotLights = spotLightCount;
+	run.filter = shadowFilter.name();
+	run.culling = gpuCulling.twoPhase ? "hi-z" : (gpuCulling.enabled ? "gpu" : "cpu");
+	run.trianglesCounted = !gpuCulling.enabled;
+
+	long long firstTimedFrame = 0;
+	long long texelsBefore = 0;
+	int staticBefore = 0, dynamicBefore = 0;
+	for (int i = -BENCHMARK_WARMUP; i < frames; i++)
+	{
+		// Where the path is only depends on the frame, not on how long the frames took.
+		double time = i * BENCHMARK_TIMESTEP;
+		camera.position = benchmarkPath.cameraPosition(time);
+		camera.changed = true;
+		light.position = benchmarkPath.lightPosition(time);
+		light.recaliberate();
+
+		if (i == 0)
+		{
+			firstTimedFrame = gpuTimers.frame;
+			texelsBefore = shadowCacheStats.texelsRendered;
+			staticBefore = shadowCacheStats.staticRenders;
+			dynamicBefore = shadowCacheStats.dynamicRenders;
+		}
+
+		auto start = std::chrono::high_resolution_clock::now();
+
+		update();
+		renderScene();
+		glFinish();
+
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		if (i < 0)
+			continue;
+
+		run.frameMs.push_back(ms);
+		run.triangles += meshRegistry.trianglesDrawn;
+	}
+	run.shadowTexels = shadowCacheStats.texelsRendered - texelsBefore;
+	run.staticRenders = shadowCacheStats.staticRenders - staticBefore;
+	run.dynamicRenders = shadowCacheStats.dynamicRenders - dynamicBefore;
+
+	// The shadow pass is the first pass, whatever kind of shadow map it draws.
+	gpuTimers.flush();
+	for (unsigned int r = 0; r < gpuTimers.records.size(); r++)
+	{
+		if (gpuTimers.records[r].frame < firstTimedFrame)
+			continue;
+		for (unsigned int s = 0; s < gpuTimers.records[r].scopes.size(); s++)
+			if (gpuTimers.records[r].scopes[s].name == "first pass")
+			{
+				run.shadowGpuMs += gpuTimers.records[r].scopes[s].durationMs;
+				run.shadowGpuFrames++;
+			}
+	}
+
+	run.print(std::cout);
+	if (!resultsFile.empty() && !run.append(resultsFile))
+		std::cout << "Couldn't write " << resultsFile << "\n";
+}
+
+// Renders the scene with every shadow filter kernel and prints what each one costs and how its shadow edges look.
+// The cost is the time of a whole frame, both as measured on the GPU with a timer query and on the CPU until
+// glFinish() returns. The shadow map is redrawn every frame, since the VSM and EVSM filters do their work there.
+// The edge quality is the root mean square difference (0 to 255) from an image filtered with a wide grid, the
+// smoothest kernel we have. Hard, stair stepped edges differ the most from it.
+void runFilterBenchmark(int frames)
+{
+	std::vector<ShadowFilter> filters;
+	filters.push_back(ShadowFilter(PCF_NONE, 1, 1, 0.0f));
+	filters.push_back(ShadowFilter(PCF_HARDWARE, 1, 1, 0.0f));
+	filters.push_back(ShadowFilter(PCF_GRID, 3, 1, 0.0f));
+	filters.push_back(ShadowFilter(PCF_GRID, 5, 1, 0.0f));
+	filters.push_back(ShadowFilter(PCF_POISSON, 1, 8, 1.5f));
+	filters.push_back(ShadowFilter(PCF_POISSON, 1, 16, 2.5f));
+	filters.push_back(ShadowFilter(MOMENTS_VSM));
+	filters.push_back(ShadowFilter(MOMENTS_EVSM));
+	ShadowFilter reference(PCF_GRID, 7, 1, 0.0f);
+
+	std::vector<unsigned char> referenceImage(WindowSize * WindowSize * 4), image(WindowSize * WindowSize * 4);
+	GLuint query;
+	glGenQueries(1, &query);
+
+	std::cout << "kernel, lookups, gpu ms, frame ms, min frame ms, edge rmse\n";
+	for (int f = -1; f < (int)filters.size(); f++)
+	{
+		const ShadowFilter &filter = (f < 0) ? reference : filters[f];
+		setShadowFilter(filter);
+
+		// The first frame with a new program pays for compiling it on some drivers, so it isn't timed.
+		renderScene();
+		glFinish();
+
+		double gpuTotal = 0.0, total = 0.0, fastest = 1e9;
+		for (int i = 0; i < frames; i++)
+		{
+			// Redraw the shadow map every frame, so the cost of turning it into moments counts as well.
+			light.changed = true;
+
+			auto start = std::chrono::high_resolution_clock::now();
+
+			glBeginQuery(GL_TIME_ELAPSED, query);
+			renderScene();
+			glEndQuery(GL_TIME_ELAPSED);
+			glFinish();
+
+			double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+			total += ms;
+			fastest = std::min(fastest, ms);
+
+			// Waits for the query's result. Fine for a benchmark, but not something to do every frame.
+			GLuint64 ns = 0;
+			glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+			gpuTotal += ns / 1e6;
+		}
+
+		glBindFramebuffer(GL_FRAMEBUFFER, sceneFbo);
+		glReadPixels(0, 0, WindowSize, WindowSize, GL_RGBA, GL_UNSIGNED_BYTE, (f < 0) ? &referenceImage[0] : &image[0]);
+
+		double squared = 0.0;
+		if (f >= 0)
+			for (unsigned int i = 0; i < image.size(); i++)
+				squared += (image[i] - referenceImage[i]) * (image[i] - referenceImage[i]);
+
+		std::cout << filter.name() << ", " << filter.lookups() << ", " << gpuTotal / std::max(frames, 1) << ", "
+			<< total / std::max(frames, 1) << ", " << fastest << ", " << sqrt(squared / image.size()) << (f < 0 ? " (reference)" : "") << "\n";
+	}
+
+	glDeleteQueries(1, &query);
+	setShadowFilter(ShadowFilter());
+}
+
+// Renders the point light's cube map in one pass with layered rendering, and then in six passes, one per face,
+// and prints what each one costs. Both draw the same culled (object, face) pairs, so the images should match.
+void runCubeBenchmark(int frames)
+{
+	setShadowFilter(ShadowFilter::pointLight());
+
+	std::vector<unsigned char> singleImage(WindowSize * WindowSize * 4), image(WindowSize * WindowSize * 4);
+	GLuint query;
+	glGenQueries(1, &query);
+
+	std::cout << "cube map: " << POINT_SHADOW_SIZE << "x" << POINT_SHADOW_SIZE << " per face, layer from the "
+		<< (pointShadowMap.vertexLayer ? "vertex" : "geometry") << " shader\n";
+	std::cout << "mode, draw calls, face pairs, of, gpu ms, frame ms, min frame ms, image rmse\n";
+	for (int mode = 0; mode < 2; mode++)
+	{
+		pointShadowMap.singlePass = (mode == 0);
+
+		renderScene();
+		glFinish();
+
+		double gpuTotal = 0.0, total = 0.0, fastest = 1e9;
+		for (int i = 0; i < frames; i++)
+		{
+			light.changed = true;
+
+			auto start = std::chrono::high_resolution_clock::now();
+
+			glBeginQuery(GL_TIME_ELAPSED, query);
+			renderScene();
+			glEndQuery(GL_TIME_ELAPSED);
+			glFinish();
+
+			double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+			total += ms;
+			fastest = std::min(fastest, ms);
+
+			GLuint64 ns = 0;
+			glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+			gpuTotal += ns / 1e6;
+		}
+
+		glBindFramebuffer(GL_FRAMEBUFFER, sceneFbo);
+		glReadPixels(0, 0, WindowSize, WindowSize, GL_RGBA, GL_UNSIGNED_BYTE, (mode == 0) ? &singleImage[0] : &image[0]);
+
+		double squared = 0.0;
+		if (mode > 0)
+			for (unsigned int i = 0; i < image.size(); i++)
+				squared += (image[i] - singleImage[i]) * (image[i] - singleImage[i]);
+
+		// Without culling, every object would be drawn into all six faces.
+		std::cout << (mode == 0 ? "single pass" : "six passes") << ", " << pointShadowMap.drawCalls << ", " << pointShadowMap.pairsDrawn << ", "
+			<< 6 * scene.objectBounds.size() << ", " << gpuTotal / std::max(frames, 1) << ", " << total / std::max(frames, 1) << ", "
+			<< fastest << ", " << sqrt(squared / image.size()) << "\n";
+	}
+
+	glDeleteQueries(1, &query);
+	pointShadowMap.singlePass = true;
+	setShadowFilter(ShadowFilter());
+}
+
+// Times the CPU occlusion culling on a dense made up scene: a wall of boxes in front of the camera, with a grid of
+// spheres both in front of and behind it. It only uses the CPU, so it runs without a GL context.
+void runOcclusionBenchmark(int frames)
+{
+	occlusionCulling.init();
+
+	// A unit box, whose faces are the occluder triangles.
+	std::vector<glm::vec3> box;
+	for (int i = 0; i < 8; i++)
+		box.push_back(glm::vec3((i & 1) ? 0.5f : -0.5f, (i & 2) ? 0.5f : -0.5f, (i & 4) ? 0.5f : -0.5f));
+	GLuint faces[] = { 0, 1, 3, 0, 3, 2, 4, 6, 7, 4, 7, 5, 0, 4, 5, 0, 5, 1, 2, 3, 7, 2, 7, 6, 0, 2, 6, 0, 6, 4, 1, 5, 7, 1, 7, 3 };
+	std::vector<GLuint> boxIndices(faces, faces + 36);
+
+	// 16 x 8 boxes, with gaps between them, standing 10 units in front of the camera.
+	std::vector<glm::mat4> walls;
+	for (int y = 0; y < 8; y++)
+		for (int x = 0; x < 16; x++)
+			walls.push_back(glm::scale(glm::translate(glm::mat4(1), glm::vec3(-12.0f + x * 1.6f, -6.0f + y * 1.6f, -10.0f)), glm::vec3(1.5f, 1.5f, 0.5f)));
+
+	// 32 x 16 x 8 spheres, from 4 to 60 units away.
+	std::vector<glm::vec4> spheres;
+	for (int z = 0; z < 8; z++)
+		for (int y = 0; y < 16; y++)
+			for (int x = 0; x < 32; x++)
+				spheres.push_back(glm::vec4(-16.0f + x, -8.0f + y, -4.0f - z * 8.0f, 0.3f));
+
+	glm::mat4 cameraPV = glm::perspective(1.0f, 1.0f, 0.1f, 100.0f) * glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+	std::cout << "occlusion buffer: " << OCCLUSION_WIDTH << "x" << OCCLUSION_HEIGHT << " in tiles of " << OCCLUSION_TILE << ", "
+		<< walls.size() * 12 << " occluder triangles, " << spheres.size() << " spheres tested\n";
+	std::cout << "simd, threads, rasterize ms, test ms, min total ms, occluded\n";
+
+	int maxThreads = occlusionCulling.threads;
+	for (int simd = 0; simd < 2; simd++)
+	{
+		if (simd && !OCCLUSION_SSE)
+			continue;
+		for (int threads = 1; threads <= maxThreads; threads *= 2)
+		{
+			occlusionCulling.simd = simd != 0;
+			occlusionCulling.threads = threads;
+
+			double rasterTotal = 0.0, testTotal = 0.0, fastest = 1e9;
+			int occluded = 0;
+			for (int i = 0; i < frames; i++)
+			{
+				auto start = std::chrono::high_resolution_clock::now();
+
+				occlusionCulling.begin(cameraPV);
+				for (unsigned int w = 0; w < walls.size(); w++)
+					occlusionCulling.addOccluder(box, boxIndices, walls[w]);
+				occlusionCulling.rasterize();
+
+				auto rasterized = std::chrono::high_resolution_clock::now();
+
+				occluded = 0;
+				for (unsigned int s = 0; s < spheres.size(); s++)
+					occluded += occlusionCulling.occluded(spheres[s]);
+
+				auto end = std::chrono::high_resolution_clock::now();
+				double rasterMs = std::chrono::duration<double, std::milli>(rasterized - start).count();
+				double testMs = std::chrono::duration<double, std::milli>(end - rasterized).count();
+				rasterTotal += rasterMs;
+				testTotal += testMs;
+				fastest = std::min(fastest, rasterMs + testMs);
+			}
+
+			std::cout << (simd ? "sse" : "scalar") << ", " << threads << ", " << rasterTotal / std::max(frames, 1) << ", "
+				<< testTotal / std::max(frames, 1) << ", " << fastest << ", " << occluded << "\n";
+		}
+	}
+
+	occlusionCulling.simd = OCCLUSION_SSE != 0;
+	occlusionCulling.threads = maxThreads;
+}
+#endif
+
+int main(int argc, char** argv)
+{
+#ifdef HEADLESS
+	// Usage: Shadow_mapping [frames]
+	//        Shadow_mapping --pcf-benchmark [frames per kernel]
+	//        Shadow_mapping --cube-benchmark [frames per mode]
+	//        Shadow_mapping --occlusion-benchmark [frames per mode]
+	//        Shadow_mapping --benchmark [frames]
+	//        Shadow_mapping --gpu-culling-check [frames], which exits with 1 if the GPU culling differs from the CPU's
+	//        Any of them can start with --spot-lights count, --gpu-culling or --hiz-culling, and --gpu-times file, in that order.
+	//        --gpu-times writes the GPU time of every pass in every frame to the file, as JSON if it ends in .json and as CSV otherwise.
+	//        --cpu-trace file, after all of those, writes the CPU profiler's zones as a Chrome trace (in builds which have the profiler).
+	//        After that, in any order: --divisions n, --shadow-map-size n, --objects n (spheres), --filter name (see ShadowFilter::parse),
+	//        --dynamic-objects n (how many of the spheres bounce, over the cached static shadow map; 1 by default),
+	//        and --results file, which --benchmark appends its run to, as a line of JSON if it ends in .json or .jsonl and of CSV otherwise.
+	//        --switch-filter name switches to the filter after the first frame, while its program compiles (only without a benchmark).
+	if (argc > 2 && std::string(argv[1]) == "--spot-lights")
+	{
+		spotLightCount = atoi(argv[2]);
+		argc -= 2;
+		argv += 2;
+	}
+
+	if (argc > 1 && std::string(argv[1]) == "--gpu-culling")
+	{
+		gpuCulling.enabled = true;
+		argc--;
+		argv++;
+	}
+	else if (argc > 1 && std::string(argv[1]) == "--hiz-culling")
+	{
+		hiZCulling.enabled = true;
+		argc--;
+		argv++;
+	}
+
+	std::string gpuTimesFile;
+	if (argc > 2 && std::string(argv[1]) == "--gpu-times")
+	{
+		gpuTimesFile = argv[2];
+		argc -= 2;
+		argv += 2;
+	}
+
+	std::string cpuTraceFile;
+	if (argc > 2 && std::string(argv[1]) == "--cpu-trace")
+	{
+		cpuTraceFile = argv[2];
+		argc -= 2;
+		argv += 2;
+	}
+
+	std::string resultsFile;
+	ShadowFilter switchFilter;
+	bool switchFilterGiven = false;
+	while (argc > 2)
+	{
+		std::string option = argv[1];
+		if (option == "--divisions")
+			sphereDivisions = std::max(atoi(argv[2]), 4);
+		else if (option == "--shadow-map-size")
+			shadowMapSize = std::max(atoi(argv[2]), 1);
+		else if (option == "--objects")
+			// The plane takes one object as well.
+			sphereCount = std::min(std::max(atoi(argv[2]), 0), MAX_OBJECTS - 1);
+		else if (option == "--dynamic-objects")
+			dynamicSphereCount = std::max(atoi(argv[2]), 0);
+		else if (option == "--filter")
+		{
+			if (!ShadowFilter::parse(argv[2], shadowFilter))
+			{
+				std::cout << "Unknown filter " << argv[2] << "\n";
+				return 1;
+			}
+		}
+		else if (option == "--results")
+			resultsFile = argv[2];
+		else if (option == "--switch-filter")
+		{
+			if (!ShadowFilter::parse(argv[2], switchFilter))
+			{
+				std::cout << "Unknown filter " << argv[2] << "\n";
+				return 1;
+			}
+			switchFilterGiven = true;
+		}
+		else
+			break;
+		argc -= 2;
+		argv += 2;
+	}
+
+	bool filterBenchmark = argc > 1 && std::string(argv[1]) == "--pcf-benchmark";
+	bool cubeBenchmark = argc > 1 && std::string(argv[1]) == "--cube-benchmark";
+	bool occlusionBenchmark = argc > 1 && std::string(argv[1]) == "--occlusion-benchmark";
+	bool scriptedBenchmark = argc > 1 && std::string(argv[1]) == "--benchmark";
+	bool cullingCheck = argc > 1 && std::string(argv[1]) == "--gpu-culling-check";
+	if (filterBenchmark || cubeBenchmark || occlusionBenchmark || scriptedBenchmark || cullingCheck)
+	{
+		argc--;
+		argv++;
+	}
+
+	int frames = 100;
+	if (argc > 1)
+		frames = atoi(argv[1]);
+
+	// The occlusion culling runs on the CPU only, so it doesn't need a context.
+	if (occlusionBenchmark)
+	{
+		runOcclusionBenchmark(frames);
+		return 0;
+	}
+
+	std::cout << "Rendering " << frames << " frames without a window.\n";
+
+	if (!createHeadlessContext())
+		return 1;
+
+	// The context is a core profile, so GLEW has to load entry points it doesn't find in the extension string.
+	glewExperimental = GL_TRUE;
+	auto launch = std::chrono::high_resolution_clock::now();
+	init();
+	setup();
+	createOffscreenTarget(WindowSize, WindowSize);
+	std::cout << "init and setup: " << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - launch).count() << " ms\n";
+
+	int exitCode = 0;
+	if (filterBenchmark)
+		runFilterBenchmark(frames);
+	else if (cubeBenchmark)
+		runCubeBenchmark(frames);
+	else if (scriptedBenchmark)
+		runScriptedBenchmark(frames, resultsFile);
+	else if (cullingCheck)
+		exitCode = runCullingCheck(frames) > 0 ? 1 : 0;
+	else
+		runHeadless(frames, switchFilterGiven ? &switchFilter : nullptr);
+
+	// Whatever is still compiling is waited for, so every program gets its time.
+	programCache.finishAll();
+	programCache.printSummary(std::cout);
+
+	// The last frames' results are still in flight.
+	gpuTimers.flush();
+	if (!filterBenchmark && !cubeBenchmark && !scriptedBenchmark && !cullingCheck)
+		gpuTimers.printSummary(std::cout);
+	if (!gpuTimesFile.empty() && !gpuTimers.write(gpuTimesFile))
+		std::cout << "Couldn't write " << gpuTimesFile << "\n";
+
+	int zones, droppedZones;
+	cpuProfiler.counts(zones, droppedZones);
+	std::cout << "cpu profiler: " << zones << " zones recorded, " << droppedZones << " dropped\n";
+	if (!cpuTraceFile.empty() && !cpuProfiler.writeTrace(cpuTraceFile))
+		std::cout << "Couldn't write " << cpuTraceFile << " (is the profiler compiled in?)\n";
+
+	glDeleteProgram(program);
+	destroyHeadlessContext();
+	return exitCode;
+#else
 	glfwInit();
 
 	// Creates a window given (width, height, title, monitorPtr, windowPtr).
@@ -426,6 +1473,7 @@ void main()
 	std::cout << "This example produces hard shadows.\n";
 	std::cout << "Use 'w' 'a' 's' 'd' to move the light source in x-z plane.\n";
 	std::cout << "you can also use 'left shift' and 'Space' to move the light source higher or lower.";
+	std::cout << "\nUse 'f' to switch to the next shadow filter.\n";
 	// Makes the OpenGL context current for the created window.
 	glfwMakeContextCurrent(window);
 
@@ -453,19 +1501,33 @@ void main()
 
 		// Swaps the back buffer to the front buffer
 		// Remember, you're rendering to the back buffer, then once rendering is complete, you're moving the back buffer to the front so it can be displayed.
-		glfwSwapBuffers(window);
+		// With VSync on, or the GPU behind, this is where the CPU waits.
+		{
+			PROFILE_ZONE("glfwSwapBuffers");
+			glfwSwapBuffers(window);
+		}
 
 		// Checks to see if any events are pending and then processes them.
-		glfwPollEvents();
+		{
+			PROFILE_ZONE("glfwPollEvents");
+			glfwPollEvents();
+		}
 	}
 
+	programCache.finishAll();
+	programCache.printSummary(std::cout);
+
+	// The zones of the whole run, to open in chrome://tracing. Release builds don't record any.
+	if (cpuProfiler.writeTrace("cpu_trace.json"))
+		std::cout << "CPU trace written to cpu_trace.json\n";
+
 	// After the program is over, cleanup your data!
-	glDeleteShader(vertex_shader);
-	glDeleteShader(fragment_shader);
 	glDeleteProgram(program);
 	// Note: If at any point you stop using a "program" or shaders, you should free the data up then and there.
 
 
 	// Frees up GLFW memory
 	glfwTerminate();
+	return 0;
+#endif
 }
\ No newline at end of file